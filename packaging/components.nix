@@ -371,6 +371,8 @@ in
     version = fineVersion;
   };
 
+  nix-benchmarks = callPackage ../src/nix-benchmarks/package.nix { };
+
   nix-manual = callPackage ../doc/manual/package.nix { version = fineVersion; };
   nix-internal-api-docs = callPackage ../src/internal-api-docs/package.nix { version = fineVersion; };
   nix-external-api-docs = callPackage ../src/external-api-docs/package.nix { version = fineVersion; };
@@ -133,6 +133,7 @@ pkgs.nixComponents2.nix-util.overrideAttrs (
       ++ pkgs.nixComponents2.nix-expr.buildInputs
       ++ pkgs.nixComponents2.nix-expr.externalPropagatedBuildInputs
       ++ pkgs.nixComponents2.nix-cmd.buildInputs
+      ++ pkgs.nixComponents2.nix-benchmarks.externalBuildInputs
       ++ lib.optionals havePerl pkgs.nixComponents2.nix-perl-bindings.externalBuildInputs
       ++ lib.optional havePerl pkgs.perl;
   }
@@ -57,6 +57,16 @@ namespace nix {
         ASSERT_EQ(getJSONValue(v), "\"test\\\"\"");
     }
 
+    TEST_F(JSONValueTest, ErrorWritesNothing) {
+        // Large enough that the writer has flushed by the time it
+        // reaches the failing element.
+        auto v = eval("builtins.genList (i: if i == 100000 then throw \"oops\" else \"aaaaaaaaaa\") 100001");
+        std::stringstream ss;
+        NixStringContext ps;
+        ASSERT_THROW(printValueAsJSON(state, true, v, noPos, ss, ps), ThrownError);
+        ASSERT_EQ(ss.str(), "");
+    }
+
     // The dummy store doesn't support writing files. Fails with this exception message:
     // C++ exception with description "error: operation 'addToStoreFromDump' is
     // not supported by store 'dummy'" thrown in the test body.
@@ -71,6 +71,100 @@ namespace nix {
         ASSERT_THAT(*b->value, IsIntEq(2));
     }
 
+    TEST_F(TrivialExpressionTest, largeAttrsLookup) {
+        // Large sets get a hash index after a number of lookups, so
+        // look up every attribute (and some missing ones) repeatedly.
+        auto v = eval(R"(
+            let
+              names = builtins.genList (n: "a${toString n}") 1000;
+              s = builtins.listToAttrs (map (name: { inherit name; value = name; }) names);
+              check = name: s.${name} == name && !(s ? "x${name}");
+            in builtins.all (round: builtins.all check names) [ 1 2 3 ]
+        )");
+        ASSERT_THAT(v, IsTrue());
+    }
+
+    TEST_F(TrivialExpressionTest, largeAttrsUpdate) {
+        auto v = eval(R"(
+            let
+              s = builtins.listToAttrs (builtins.genList (n: { name = "a${toString n}"; value = n; }) 500);
+              t = s // { a7 = "new"; b = 1; };
+            in builtins.genList (n: t.a7) 20 == builtins.genList (n: "new") 20 && t.a499 == 499 && t.b == 1
+        )");
+        ASSERT_THAT(v, IsTrue());
+    }
+
+    TEST_F(TrivialExpressionTest, layeredAttrsUpdateChain) {
+        // Repeated small updates of a large set produce layered sets,
+        // which are flattened when the chain gets too deep. Lookups
+        // and iteration must see the topmost value of each attribute.
+        auto v = eval(R"(
+            let
+              s = builtins.listToAttrs (builtins.genList (n: { name = "a${toString n}"; value = n; }) 100);
+              t = builtins.foldl' (acc: n: acc // { a5 = n; "b${toString n}" = n; }) s (builtins.genList (n: n) 20);
+            in
+              t.a5 == 19 && t.a99 == 99 && t.b0 == 0 && t.b19 == 19 && !(t ? c)
+              && builtins.length (builtins.attrNames t) == 120
+              && builtins.attrNames t == builtins.sort builtins.lessThan (builtins.attrNames t)
+              && builtins.attrValues t == map (name: t.${name}) (builtins.attrNames t)
+        )");
+        ASSERT_THAT(v, IsTrue());
+    }
+
+    TEST_F(TrivialExpressionTest, layeredAttrsIteration) {
+        auto v = eval(R"(
+            let
+              s = builtins.listToAttrs (builtins.genList (n: { name = "a${toString n}"; value = n; }) 64);
+            in s // { a0 = "x"; a63 = "y"; b = "z"; }
+        )");
+        ASSERT_THAT(v, IsAttrsOfSize(65));
+
+        // Iteration and indexing see the same sorted sequence, with
+        // the overridden attributes taking their new values.
+        size_t n = 0;
+        for (auto & attr : *v.attrs()) {
+            ASSERT_EQ(&attr, &(*v.attrs())[n]);
+            if (n > 0)
+                ASSERT_LT((*v.attrs())[n - 1].name, attr.name);
+            ASSERT_EQ(attr.value, v.attrs()->get(attr.name)->value);
+            n++;
+        }
+        ASSERT_EQ(n, 65);
+
+        auto a0 = v.attrs()->find(createSymbol("a0"));
+        ASSERT_NE(a0, v.attrs()->end());
+        ASSERT_THAT(*a0->value, IsStringEq("x"));
+        ASSERT_EQ(v.attrs()->find(createSymbol("c")), v.attrs()->end());
+    }
+
+    TEST_F(TrivialExpressionTest, layeredAttrsIterateFromFind) {
+        auto v = eval(R"(
+            let
+              s = builtins.listToAttrs (builtins.genList (n: { name = "a${toString n}"; value = n; }) 64);
+            in s // { a10 = "x"; b = "z"; }
+        )");
+        ASSERT_THAT(v, IsAttrsOfSize(65));
+        ASSERT_GT(v.attrs()->layers(), 1u);
+
+        // Iterating from the result of `find()` visits the remaining
+        // attributes in order and then reaches `end()`.
+        auto i = v.attrs()->find(createSymbol("a10"));
+        ASSERT_NE(i, v.attrs()->end());
+        ASSERT_THAT(*i->value, IsStringEq("x"));
+
+        size_t n = 0;
+        for (auto j = v.attrs()->begin(); j->name != i->name; ++j)
+            n++;
+
+        Symbol prev = i->name;
+        for (++i, ++n; i != v.attrs()->end(); ++i, ++n) {
+            ASSERT_LT(prev, i->name);
+            ASSERT_EQ(i->value, v.attrs()->get(i->name)->value);
+            prev = i->name;
+        }
+        ASSERT_EQ(n, 65);
+    }
+
     TEST_F(TrivialExpressionTest, hasAttrOpFalse) {
         auto v = eval("{} ? a");
         ASSERT_THAT(v, IsFalse());
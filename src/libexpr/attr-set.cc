@@ -1,5 +1,6 @@
 #include "nix/expr/attr-set.hh"
 #include "nix/expr/eval-inline.hh"
+#include "nix/expr/eval-gc.hh"
 
 #include <algorithm>
 
@@ -11,15 +12,17 @@ namespace nix {
 /* Allocate a new array of attributes for an attribute set with a specific
    capacity. The space is implicitly reserved after the Bindings
    structure. */
-Bindings * EvalState::allocBindings(size_t capacity)
+Bindings * EvalState::allocBindings(size_t capacity, bool layered)
 {
-    if (capacity == 0)
+    if (capacity == 0 && !layered)
         return &emptyBindings;
     if (capacity > std::numeric_limits<Bindings::size_t>::max())
         throw Error("attribute set of size %d is too big", capacity);
     nrAttrsets++;
     nrAttrsInAttrsets += capacity;
-    return new (allocBytes(sizeof(Bindings) + sizeof(Attr) * capacity)) Bindings((Bindings::size_t) capacity);
+    auto extended = Bindings::needsExtension(capacity, layered);
+    auto bytes = sizeof(Bindings) + sizeof(Attr) * capacity + (extended ? sizeof(Bindings::Extension) : 0);
+    return new (allocBytes(bytes)) Bindings((Bindings::size_t) capacity, extended);
 }
 
 
@@ -40,6 +43,111 @@ Value & BindingsBuilder::alloc(std::string_view name, PosIdx pos)
 void Bindings::sort()
 {
     if (size_) std::sort(begin(), end());
+    /* Positions have changed, so any existing index is stale. */
+    if (extended) {
+        ext().hashIndex.store(nullptr, std::memory_order_relaxed);
+        ext().nrLookups.store(0, std::memory_order_relaxed);
+    }
+}
+
+
+const Bindings::HashIndex * Bindings::buildHashIndex() const
+{
+    /* Use a load factor of at most 1/2 to keep probe sequences short. */
+    unsigned int bits = 1;
+    while ((std::size_t(1) << bits) < 2 * std::size_t(size_))
+        bits++;
+    const std::size_t nrSlots = std::size_t(1) << bits;
+    const std::size_t mask = nrSlots - 1;
+
+    /* The index contains no pointers, so the GC doesn't need to scan
+       it. */
+    auto bytes = sizeof(HashIndex) + nrSlots * sizeof(HashIndex::Slot);
+    auto index = (HashIndex *) GC_MALLOC_ATOMIC(bytes);
+    if (!index) throw std::bad_alloc();
+    memset((void *) index, 0, bytes);
+    index->bits = bits;
+
+    for (size_t n = 0; n < size_; n++) {
+        auto i = HashIndex::slotOf(attrs[n].name, bits);
+        while (index->slots[i].name)
+            i = (i + 1) & mask;
+        index->slots[i] = {attrs[n].name, n};
+    }
+
+    /* If another thread won the race, use its index and let the GC
+       reclaim ours. */
+    const HashIndex * expected = nullptr;
+    if (!ext().hashIndex.compare_exchange_strong(expected, index, std::memory_order_acq_rel))
+        return expected;
+    return index;
+}
+
+
+const Attr * Bindings::flatten() const
+{
+    /* Merge the layers, taking the attribute from the topmost layer
+       when several layers have the same name. There are at most
+       `maxLayers` layers, so a linear scan over them is fine. */
+    struct Cursor
+    {
+        const Attr * cur, * end;
+    };
+    Cursor cursors[maxLayers];
+    unsigned int nrCursors = 0;
+    for (auto layer = this; layer; layer = layer->baseLayer()) {
+        assert(nrCursors < maxLayers);
+        cursors[nrCursors++] = {&layer->attrs[0], &layer->attrs[layer->size_]};
+    }
+
+    /* The flattened array refers to values, so it has to be scanned
+       by the GC. */
+    auto numAttrs = ext().numAttrs;
+    auto flat = (Attr *) allocBytes(numAttrs * sizeof(Attr));
+
+    size_t n = 0;
+    while (true) {
+        const Attr * next = nullptr;
+        for (unsigned int i = 0; i < nrCursors; ++i) {
+            auto & c = cursors[i];
+            if (c.cur == c.end) continue;
+            /* On a tie, the earlier (i.e. higher) layer wins. */
+            if (!next || c.cur->name < next->name)
+                next = c.cur;
+        }
+        if (!next) break;
+        auto name = next->name;
+        assert(n < numAttrs);
+        flat[n++] = *next;
+        for (unsigned int i = 0; i < nrCursors; ++i) {
+            auto & c = cursors[i];
+            if (c.cur != c.end && c.cur->name == name) ++c.cur;
+        }
+    }
+    assert(n == numAttrs);
+
+    const Attr * expected = nullptr;
+    if (!ext().flatAttrs.compare_exchange_strong(expected, flat, std::memory_order_acq_rel))
+        return expected;
+    return flat;
+}
+
+
+Bindings * BindingsBuilder::layeredOver(const Bindings & base)
+{
+    assert(bindings->size_ > 0);
+    assert(base.layers() < Bindings::maxLayers);
+
+    size_t numAttrs = base.size();
+    for (auto & attr : *bindings)
+        if (!base.get(attr.name)) numAttrs++;
+
+    auto & ext = bindings->ext();
+    ext.baseLayer = &base;
+    ext.numLayers = base.layers() + 1;
+    ext.numAttrs = numAttrs;
+    bindings->layered = true;
+    return bindings;
 }
 
 
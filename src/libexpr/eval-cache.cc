@@ -7,6 +7,12 @@
 // Need specialization involving `SymbolStr` just in this one module.
 #include "nix/util/strings-inline.hh"
 
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <filesystem>
+#include <random>
+#include <span>
+
 namespace nix::eval_cache {
 
 CachedEvalError::CachedEvalError(ref<AttrCursor> cursor, Symbol attr)
@@ -39,6 +45,225 @@ create table if not exists Attributes (
 );
 )sql";
 
+/**
+ * An immutable, memory-mapped snapshot of the `Attributes` table. It
+ * is written when an `AttrDb` is closed and consulted before SQLite
+ * when it is opened again, turning lookups into a binary search over
+ * a sorted array.
+ *
+ * The file consists of a `Header`, an array of `Record`s sorted by
+ * parent and name (so the children of an attribute are contiguous),
+ * and a pool of strings. Attribute names are interned in the pool.
+ *
+ * Rows are only ever added to the `Attributes` table (replacing a row
+ * gives it a new row ID), so the rows with a row ID greater than
+ * `Header::maxRowId` are exactly the changes since the snapshot was
+ * taken.
+ */
+struct FrozenAttrDb
+{
+    static constexpr char magic[8] = {'N', 'i', 'x', 'E', 'C', 'v', '2', '\n'};
+
+    struct Header
+    {
+        char magic[8];
+        /* The ID of the database (its `user_version`), and the
+           highest row ID of the `Attributes` table at the time the
+           snapshot was taken. */
+        uint64_t dbId;
+        uint64_t maxRowId;
+        uint64_t nrRecords;
+        uint64_t stringsSize;
+    };
+
+    struct Record
+    {
+        uint64_t rowId;
+        uint64_t parent;
+        /* The integer value for `Bool` and `Int`, otherwise the offset
+           of the string value in the string pool. */
+        uint64_t value;
+        uint64_t name;
+        uint64_t context;
+        uint32_t nameLen;
+        uint32_t valueLen;
+        uint32_t contextLen;
+        uint32_t type;
+    };
+
+    boost::iostreams::mapped_file_source file;
+    const Header * header = nullptr;
+    std::span<const Record> records;
+    std::string_view strings;
+
+    /**
+     * Map the snapshot at `path`. Return `nullptr` if it doesn't
+     * exist, is obviously corrupt, or doesn't belong to the SQLite
+     * database. The records themselves are checked when they're
+     * used, see `valid()`.
+     */
+    static std::unique_ptr<FrozenAttrDb> open(const Path & path, uint64_t dbId, uint64_t maxRowId)
+    {
+        if (!pathExists(path)) return nullptr;
+
+        auto db = std::make_unique<FrozenAttrDb>();
+        try {
+            db->file.open(path);
+        } catch (std::exception & e) {
+            debug("cannot map evaluation cache snapshot '%s': %s", path, e.what());
+            return nullptr;
+        }
+
+        auto size = db->file.size();
+        auto data = db->file.data();
+        if (size < sizeof(Header)) return nullptr;
+
+        db->header = (const Header *) data;
+        if (memcmp(db->header->magic, magic, sizeof(magic)) != 0
+            || db->header->dbId != dbId
+            || db->header->maxRowId > maxRowId
+            || db->header->nrRecords > (size - sizeof(Header)) / sizeof(Record)
+            || db->header->stringsSize != size - sizeof(Header) - db->header->nrRecords * sizeof(Record))
+            return nullptr;
+
+        db->records = {(const Record *) (data + sizeof(Header)), db->header->nrRecords};
+        db->strings = {data + sizeof(Header) + db->header->nrRecords * sizeof(Record), db->header->stringsSize};
+
+        return db;
+    }
+
+    /**
+     * Whether the strings of `r` are within the string pool.
+     */
+    bool valid(const Record & r) const
+    {
+        return r.name + r.nameLen <= strings.size()
+            && r.context + r.contextLen <= strings.size()
+            && (r.type == AttrType::Bool || r.type == AttrType::Int || r.value + r.valueLen <= strings.size());
+    }
+
+    std::string_view getString(uint64_t offset, uint32_t len) const
+    {
+        /* Don't throw on corrupt offsets, `valid()` catches those. */
+        return offset <= strings.size() ? strings.substr(offset, len) : std::string_view();
+    }
+
+    /**
+     * Return the record for attribute `name` of the attribute with row
+     * ID `parent`, or `nullptr` if there is none.
+     */
+    const Record * lookup(AttrId parent, std::string_view name) const
+    {
+        auto i = std::lower_bound(records.begin(), records.end(), std::pair{parent, name},
+            [&](const Record & r, const std::pair<AttrId, std::string_view> & key) {
+                return std::pair{r.parent, getString(r.name, r.nameLen)} < key;
+            });
+        if (i == records.end() || i->parent != parent || getString(i->name, i->nameLen) != name)
+            return nullptr;
+        return &*i;
+    }
+
+    std::span<const Record> children(AttrId parent) const
+    {
+        auto cmp = [](const Record & r, AttrId parent) { return r.parent < parent; };
+        auto begin = std::lower_bound(records.begin(), records.end(), parent, cmp);
+        auto end = begin;
+        while (end != records.end() && end->parent == parent) ++end;
+        return {begin, end};
+    }
+
+    /**
+     * Write a snapshot of the `Attributes` table in `db`, whose ID is
+     * `dbId`, to `path`.
+     */
+    static void write(SQLite & db, uint64_t dbId, const Path & path)
+    {
+        struct Row
+        {
+            uint64_t rowId, parent;
+            std::string name;
+            AttrType type;
+            int64_t intValue = 0;
+            std::string value;
+            std::optional<std::string> context;
+        };
+
+        std::vector<Row> rows;
+        uint64_t maxRowId = 0;
+
+        SQLiteStmt query(db, "select rowid, parent, name, type, value, context from Attributes");
+        auto use(query.use());
+        while (use.next()) {
+            Row row{
+                .rowId = (uint64_t) use.getInt(0),
+                .parent = (uint64_t) use.getInt(1),
+                .name = use.isNull(2) ? "" : use.getStr(2),
+                .type = (AttrType) use.getInt(3),
+            };
+            if (row.type == AttrType::Bool || row.type == AttrType::Int)
+                row.intValue = use.getInt(4);
+            else if (!use.isNull(4))
+                row.value = use.getStr(4);
+            if (!use.isNull(5))
+                row.context = use.getStr(5);
+            maxRowId = std::max(maxRowId, row.rowId);
+            rows.push_back(std::move(row));
+        }
+
+        std::sort(rows.begin(), rows.end(), [](const Row & a, const Row & b) {
+            return std::tie(a.parent, a.name) < std::tie(b.parent, b.name);
+        });
+
+        std::string pool;
+        std::unordered_map<std::string, uint64_t> names;
+        std::vector<Record> records;
+        records.reserve(rows.size());
+
+        auto addString = [&](std::string_view s) {
+            auto offset = pool.size();
+            pool.append(s);
+            return offset;
+        };
+
+        for (auto & row : rows) {
+            auto name = names.find(row.name);
+            if (name == names.end())
+                name = names.emplace(row.name, addString(row.name)).first;
+            Record r{
+                .rowId = row.rowId,
+                .parent = row.parent,
+                .value = row.type == AttrType::Bool || row.type == AttrType::Int
+                    ? (uint64_t) row.intValue
+                    : addString(row.value),
+                .name = name->second,
+                .context = row.context ? addString(*row.context) : 0,
+                .nameLen = (uint32_t) row.name.size(),
+                .valueLen = (uint32_t) row.value.size(),
+                .contextLen = row.context ? (uint32_t) row.context->size() : 0,
+                .type = row.type,
+            };
+            records.push_back(r);
+        }
+
+        Header header;
+        memcpy(header.magic, magic, sizeof(magic));
+        header.dbId = dbId;
+        header.maxRowId = maxRowId;
+        header.nrRecords = records.size();
+        header.stringsSize = pool.size();
+
+        std::string out;
+        out.reserve(sizeof(Header) + records.size() * sizeof(Record) + pool.size());
+        out.append((const char *) &header, sizeof(header));
+        out.append((const char *) records.data(), records.size() * sizeof(Record));
+        out.append(pool);
+
+        auto tmp = makeTempPath(path);
+        writeFile(tmp, out);
+        std::filesystem::rename(tmp, path);
+    }
+};
+
 struct AttrDb
 {
     std::atomic_bool failed{false};
@@ -53,12 +278,25 @@ struct AttrDb
         SQLiteStmt queryAttribute;
         SQLiteStmt queryAttributes;
         std::unique_ptr<SQLiteTxn> txn;
+        /* Attributes written since the snapshot was taken. These are
+           out of date in `frozen`. */
+        std::set<AttrKey> modified;
     };
 
+    /* Take a new snapshot once this many attributes have been written
+       since the last one, or a fraction of its size if that is
+       larger. Until then, the changes are read from SQLite. */
+    static constexpr size_t minRefreezeDelta = 1024;
+    static constexpr size_t refreezeFraction = 8;
+
     std::unique_ptr<Sync<State>> _state;
 
     SymbolTable & symbols;
 
+    Path frozenPath;
+    std::unique_ptr<FrozenAttrDb> frozen;
+    uint64_t dbId = 0;
+
     AttrDb(
         const StoreDirConfig & cfg,
         const Hash & fingerprint,
@@ -90,6 +328,37 @@ struct AttrDb
         state->queryAttributes.create(state->db,
             "select name from Attributes where parent = ?");
 
+        /* Give the database a random ID, so that a snapshot of a
+           previous database with the same fingerprint isn't used. */
+        {
+            SQLiteStmt queryId(state->db, "pragma user_version");
+            auto use(queryId.use());
+            if (use.next())
+                dbId = (uint32_t) use.getInt(0);
+        }
+        if (!dbId) {
+            std::random_device rd;
+            dbId = std::uniform_int_distribution<uint32_t>(1, INT32_MAX)(rd);
+            state->db.exec(fmt("pragma user_version = %d", dbId));
+        }
+
+        frozenPath = cacheDir + "/" + fingerprint.to_string(HashFormat::Base16, false) + ".attrs";
+        {
+            SQLiteStmt queryMaxRowId(state->db, "select coalesce(max(rowid), 0) from Attributes");
+            auto use(queryMaxRowId.use());
+            if (use.next())
+                frozen = FrozenAttrDb::open(frozenPath, dbId, use.getInt(0));
+        }
+
+        /* Attributes written after the snapshot was taken have to be
+           read from SQLite. */
+        if (frozen) {
+            SQLiteStmt queryDelta(state->db, "select parent, name from Attributes where rowid > ?");
+            auto use(queryDelta.use()(frozen->header->maxRowId));
+            while (use.next())
+                state->modified.emplace(use.getInt(0), symbols.create(use.isNull(1) ? "" : use.getStr(1)));
+        }
+
         state->txn = std::make_unique<SQLiteTxn>(state->db);
     }
 
@@ -100,6 +369,16 @@ struct AttrDb
             if (!failed && state->txn->active)
                 state->txn->commit();
             state->txn.reset();
+            /* Take a new snapshot if there is none or if enough has
+               changed since the last one. */
+            if (!failed
+                && (!frozen
+                    || state->modified.size() >= std::max<size_t>(
+                        minRefreezeDelta, frozen->records.size() / refreezeFraction)))
+            {
+                frozen.reset();
+                FrozenAttrDb::write(state->db, dbId, frozenPath);
+            }
         } catch (...) {
             ignoreExceptionInDestructor();
         }
@@ -125,6 +404,7 @@ struct AttrDb
         return doSQLite([&]()
         {
             auto state(_state->lock());
+            state->modified.insert(key);
 
             state->insertAttribute.use()
                 (key.first)
@@ -154,6 +434,7 @@ struct AttrDb
         return doSQLite([&]()
         {
             auto state(_state->lock());
+            state->modified.insert(key);
 
             if (context) {
                 std::string ctx;
@@ -186,6 +467,7 @@ struct AttrDb
         return doSQLite([&]()
         {
             auto state(_state->lock());
+            state->modified.insert(key);
 
             state->insertAttribute.use()
                 (key.first)
@@ -204,6 +486,7 @@ struct AttrDb
         return doSQLite([&]()
         {
             auto state(_state->lock());
+            state->modified.insert(key);
 
             state->insertAttribute.use()
                 (key.first)
@@ -222,6 +505,7 @@ struct AttrDb
         return doSQLite([&]()
         {
             auto state(_state->lock());
+            state->modified.insert(key);
 
             state->insertAttribute.use()
                 (key.first)
@@ -238,6 +522,7 @@ struct AttrDb
         return doSQLite([&]()
         {
             auto state(_state->lock());
+            state->modified.insert(key);
 
             state->insertAttribute.use()
                 (key.first)
@@ -254,6 +539,7 @@ struct AttrDb
         return doSQLite([&]()
         {
             auto state(_state->lock());
+            state->modified.insert(key);
 
             state->insertAttribute.use()
                 (key.first)
@@ -270,6 +556,7 @@ struct AttrDb
         return doSQLite([&]()
         {
             auto state(_state->lock());
+            state->modified.insert(key);
 
             state->insertAttribute.use()
                 (key.first)
@@ -286,6 +573,7 @@ struct AttrDb
         return doSQLite([&]()
         {
             auto state(_state->lock());
+            state->modified.insert(key);
 
             state->insertAttribute.use()
                 (key.first)
@@ -297,10 +585,66 @@ struct AttrDb
         });
     }
 
+    /**
+     * Return the value of `r`, or `std::nullopt` if the snapshot turns
+     * out to be corrupt.
+     */
+    std::optional<std::pair<AttrId, AttrValue>> getFrozenAttr(const FrozenAttrDb::Record & r)
+    {
+        if (!frozen->valid(r)) return std::nullopt;
+
+        switch (r.type) {
+            case AttrType::Placeholder:
+                return {{r.rowId, placeholder_t()}};
+            case AttrType::FullAttrs: {
+                std::vector<Symbol> attrs;
+                for (auto & child : frozen->children(r.rowId)) {
+                    if (!frozen->valid(child)) return std::nullopt;
+                    attrs.emplace_back(symbols.create(frozen->getString(child.name, child.nameLen)));
+                }
+                return {{r.rowId, attrs}};
+            }
+            case AttrType::String: {
+                NixStringContext context;
+                if (r.contextLen)
+                    for (auto & s : tokenizeString<std::vector<std::string>>(frozen->getString(r.context, r.contextLen), ";"))
+                        context.insert(NixStringContextElem::parse(s));
+                return {{r.rowId, string_t{std::string(frozen->getString(r.value, r.valueLen)), context}}};
+            }
+            case AttrType::Bool:
+                return {{r.rowId, r.value != 0}};
+            case AttrType::Int:
+                return {{r.rowId, int_t{NixInt{(int64_t) r.value}}}};
+            case AttrType::ListOfStrings:
+                return {{r.rowId, tokenizeString<std::vector<std::string>>(frozen->getString(r.value, r.valueLen), "\t")}};
+            case AttrType::Missing:
+                return {{r.rowId, missing_t()}};
+            case AttrType::Misc:
+                return {{r.rowId, misc_t()}};
+            case AttrType::Failed:
+                return {{r.rowId, failed_t()}};
+            default:
+                return std::nullopt;
+        }
+    }
+
     std::optional<std::pair<AttrId, AttrValue>> getAttr(AttrKey key)
     {
         auto state(_state->lock());
 
+        if (frozen && !state->modified.count(key)) {
+            if (auto r = frozen->lookup(key.first, symbols[key.second])) {
+                if (auto attr = getFrozenAttr(*r))
+                    return attr;
+                debug("evaluation cache snapshot '%s' is corrupt, ignoring it", frozenPath);
+                frozen.reset();
+            }
+            /* The snapshot has all children of the attributes that
+               existed when it was taken. */
+            else if (key.first <= frozen->header->maxRowId)
+                return {};
+        }
+
         auto queryAttribute(state->queryAttribute.use()(key.first)(symbols[key.second]));
         if (!queryAttribute.next()) return {};
 
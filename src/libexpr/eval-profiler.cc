@@ -2,6 +2,11 @@
 #include "nix/expr/nixexpr.hh"
 #include "nix/expr/eval.hh"
 #include "nix/util/lru-cache.hh"
+#include "nix/util/compression.hh"
+
+#include <condition_variable>
+#include <ranges>
+#include <thread>
 
 namespace nix {
 
@@ -341,8 +346,289 @@ SampleStack::~SampleStack()
     }
 }
 
+/**
+ * Sampling profiler that writes its profile in the pprof format.
+ *
+ * Unlike `SampleStack`, this profiler doesn't read the clock on every
+ * function call. A timer thread sets `sampleDue` at the sampling
+ * frequency, and the hooks only record the stack when it is set. In
+ * addition, every `allocSampleInterval` allocated objects (values,
+ * environments and attribute sets), the current stack is charged with
+ * the allocations since the previous allocation sample.
+ */
+class PprofProfiler : public EvalProfiler
+{
+    static constexpr uint64_t allocSampleInterval = 4096;
+
+    enum struct FrameKind : uint8_t { lambda, primOp, other };
+
+    /** A frame of the evaluator's call stack. Cheap to construct; symbolized only when writing the profile. */
+    struct Frame
+    {
+        const void * fun;
+        PosIdx pos;
+        FrameKind kind;
+        auto operator<=>(const Frame & rhs) const = default;
+    };
+
+    struct Counts
+    {
+        uint64_t samples = 0;
+        uint64_t allocs = 0;
+    };
+
+    Hooks getNeededHooksImpl() const override
+    {
+        return Hooks().set(preFunctionCall).set(postFunctionCall);
+    }
+
+    EvalState & state;
+    std::filesystem::path profileFile;
+    std::chrono::nanoseconds period;
+    std::chrono::time_point<std::chrono::system_clock> startTime = std::chrono::system_clock::now();
+
+    std::vector<Frame> stack;
+    std::map<std::vector<Frame>, Counts> counts;
+
+    std::atomic<bool> sampleDue{false};
+    uint64_t lastAllocSample = 0;
+
+    std::mutex timerMutex;
+    std::condition_variable timerWakeup;
+    bool quit = false;
+    std::thread timer;
+
+    void maybeSample()
+    {
+        if (sampleDue.load(std::memory_order_relaxed)) [[unlikely]] {
+            if (period.count() != 0)
+                sampleDue.store(false, std::memory_order_relaxed);
+            counts[stack].samples++;
+        }
+
+        auto allocs = state.nrAllocations();
+        if (allocs - lastAllocSample >= allocSampleInterval) [[unlikely]] {
+            counts[stack].allocs += allocs - lastAllocSample;
+            lastAllocSample = allocs;
+        }
+    }
+
+    void writeProfile();
+
+public:
+
+    PprofProfiler(EvalState & state, std::filesystem::path profileFile, std::chrono::nanoseconds period)
+        : state(state)
+        , profileFile(std::move(profileFile))
+        , period(period)
+    {
+        /* Check early that the profile can be written. */
+        writeFile(this->profileFile.string(), "");
+
+        lastAllocSample = state.nrAllocations();
+
+        if (period.count() == 0)
+            sampleDue = true;
+        else
+            timer = std::thread([this]() {
+                std::unique_lock lock(timerMutex);
+                while (!timerWakeup.wait_for(lock, this->period, [&]() { return quit; }))
+                    sampleDue.store(true, std::memory_order_relaxed);
+            });
+    }
+
+    ~PprofProfiler()
+    {
+        {
+            std::lock_guard lock(timerMutex);
+            quit = true;
+        }
+        timerWakeup.notify_all();
+        if (timer.joinable())
+            timer.join();
+
+        try {
+            writeProfile();
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
+    [[gnu::noinline]] void
+    preFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override
+    {
+        if (v.isLambda())
+            stack.push_back({v.lambda().fun, pos, FrameKind::lambda});
+        else if (v.isPrimOp())
+            stack.push_back({v.primOp(), pos, FrameKind::primOp});
+        else if (v.isPrimOpApp())
+            stack.push_back({v.primOpAppPrimOp(), pos, FrameKind::primOp});
+        else
+            stack.push_back({nullptr, pos, FrameKind::other});
+
+        maybeSample();
+    }
+
+    [[gnu::noinline]] void
+    postFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override
+    {
+        maybeSample();
+
+        if (!stack.empty())
+            stack.pop_back();
+    }
+};
+
+/**
+ * Minimal protobuf encoder for writing pprof profiles.
+ */
+struct ProtoWriter
+{
+    std::string buf;
+
+    void varint(uint64_t n)
+    {
+        while (n >= 0x80) {
+            buf.push_back((char) (n | 0x80));
+            n >>= 7;
+        }
+        buf.push_back((char) n);
+    }
+
+    void field(uint32_t number, uint64_t n)
+    {
+        if (!n) return;
+        varint(number << 3);
+        varint(n);
+    }
+
+    void field(uint32_t number, std::string_view bytes)
+    {
+        varint((number << 3) | 2);
+        varint(bytes.size());
+        buf.append(bytes);
+    }
+
+    void packed(uint32_t number, const std::vector<uint64_t> & ns)
+    {
+        ProtoWriter sub;
+        for (auto n : ns)
+            sub.varint(n);
+        field(number, sub.buf);
+    }
+};
+
+void PprofProfiler::writeProfile()
+{
+    /* See https://github.com/google/pprof/blob/main/proto/profile.proto
+       for the meaning of the field numbers. */
+    ProtoWriter profile;
+
+    std::vector<std::string> strings{""};
+    std::map<std::string, uint64_t> stringIds{{"", 0}};
+    auto intern = [&](const std::string & s) {
+        auto [i, inserted] = stringIds.emplace(s, strings.size());
+        if (inserted)
+            strings.push_back(s);
+        return i->second;
+    };
+
+    auto valueType = [&](const std::string & type, const std::string & unit) {
+        ProtoWriter vt;
+        vt.field(1, intern(type));
+        vt.field(2, intern(unit));
+        return vt.buf;
+    };
+
+    profile.field(1, valueType("samples", "count"));
+    profile.field(1, valueType("cpu", "nanoseconds"));
+    profile.field(1, valueType("alloc_objects", "count"));
+
+    /* Functions and locations, keyed by name, file and line. Every
+       location has a single line, so the two have the same IDs. */
+    std::map<std::tuple<std::string, std::string, uint32_t>, uint64_t> locationIds;
+
+    auto getLocation = [&](const Frame & frame) {
+        std::string name;
+        Pos pos;
+        switch (frame.kind) {
+        case FrameKind::lambda: {
+            auto expr = (const ExprLambda *) frame.fun;
+            name = expr->name ? std::string(state.symbols[expr->name]) : "«lambda»";
+            pos = state.positions[expr->getPos()];
+            break;
+        }
+        case FrameKind::primOp: {
+            std::ostringstream os;
+            os << *(const PrimOp *) frame.fun;
+            name = os.str();
+            pos = state.positions[frame.pos];
+            break;
+        }
+        case FrameKind::other:
+            name = "«functor»";
+            pos = state.positions[frame.pos];
+            break;
+        }
+
+        auto path = pos.getSourcePath();
+        auto key = std::tuple{name, path ? path->to_string() : "«unknown»", pos.line};
+
+        auto [i, inserted] = locationIds.emplace(key, locationIds.size() + 1);
+        if (inserted) {
+            ProtoWriter function;
+            function.field(1, i->second);
+            function.field(2, intern(std::get<0>(key)));
+            function.field(4, intern(std::get<1>(key)));
+            function.field(5, pos.line);
+            profile.field(5, function.buf);
+
+            ProtoWriter line;
+            line.field(1, i->second);
+            line.field(2, pos.line);
+
+            ProtoWriter location;
+            location.field(1, i->second);
+            location.field(4, line.buf);
+            profile.field(4, location.buf);
+        }
+        return i->second;
+    };
+
+    for (auto & [stack, c] : counts) {
+        std::vector<uint64_t> locations;
+        /* pprof lists the leaf first. */
+        for (auto & frame : std::views::reverse(stack))
+            locations.push_back(getLocation(frame));
+
+        ProtoWriter sample;
+        sample.packed(1, locations);
+        sample.packed(2, {c.samples, c.samples * period.count(), c.allocs});
+        profile.field(2, sample.buf);
+    }
+
+    for (auto & s : strings)
+        profile.field(6, s);
+
+    auto now = std::chrono::system_clock::now();
+    profile.field(9, std::chrono::duration_cast<std::chrono::nanoseconds>(startTime.time_since_epoch()).count());
+    profile.field(10, std::chrono::duration_cast<std::chrono::nanoseconds>(now - startTime).count());
+    profile.field(11, valueType("cpu", "nanoseconds"));
+    profile.field(12, period.count());
+
+    writeFile(profileFile.string(), compress("gzip", profile.buf));
+}
+
 } // namespace
 
+ref<EvalProfiler> makePprofProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency)
+{
+    std::chrono::nanoseconds period = frequency == 0
+                                          ? std::chrono::nanoseconds{0}
+                                          : std::chrono::nanoseconds{std::nano::den / frequency / std::nano::num};
+    return make_ref<PprofProfiler>(state, profileFile, period);
+}
+
 ref<EvalProfiler> makeSampleStackProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency)
 {
     /* 0 is a special value for sampling stack after each call. */
@@ -23,6 +23,7 @@
 #include "nix/fetchers/input-cache.hh"
 
 #include "parser-tab.hh"
+#include "parse-cache.hh"
 
 #include <algorithm>
 #include <iostream>
@@ -126,7 +127,9 @@ std::string showType(const Value & v)
     #pragma GCC diagnostic push
     #pragma GCC diagnostic ignored "-Wswitch-enum"
     switch (v.getInternalType()) {
-        case tString: return v.context() ? "a string with context" : "a string";
+        case tString:
+        case tStringRope:
+            return v.context() ? "a string with context" : "a string";
         case tPrimOp:
             return fmt("the built-in function '%s'", std::string(v.primOp()->name));
         case tPrimOpApp:
@@ -313,6 +316,7 @@ EvalState::EvalState(
     , debugStop(false)
     , trylevel(0)
     , regexCache(makeRegexCache())
+    , replaceStringsCache(makeReplaceStringsCache())
 #if NIX_USE_BOEHMGC
     , valueAllocCache(std::allocate_shared<void *>(traceable_allocator<void *>(), nullptr))
     , env1AllocCache(std::allocate_shared<void *>(traceable_allocator<void *>(), nullptr))
@@ -379,6 +383,10 @@ EvalState::EvalState(
         profiler.addProfiler(makeSampleStackProfiler(
             *this, settings.evalProfileFile.get(), settings.evalProfilerFrequency));
         break;
+    case EvalProfilerMode::pprof:
+        profiler.addProfiler(makePprofProfiler(
+            *this, settings.evalProfileFile.get(), settings.evalProfilerFrequency));
+        break;
     case EvalProfilerMode::disabled:
         break;
     }
@@ -653,7 +661,7 @@ std::optional<EvalState::Doc> EvalState::getDoc(Value & v)
     }
     if (isFunctor(v)) {
         try {
-            Value & functor = *v.attrs()->find(sFunctor)->value;
+            Value & functor = *v.attrs()->get(sFunctor)->value;
             Value * vp[] = {&v};
             Value partiallyApplied;
             // The first parameter is not user-provided, and may be
@@ -917,6 +925,74 @@ void Value::mkStringMove(const char * s, const NixStringContext & context)
     mkString(s, encodeContext(context));
 }
 
+detail::ValueBase::StringWithContext detail::ValueBase::StringRope::doFlatten() const
+{
+    /* Collect the suffixes back to the nearest string that is already
+       flat. This is a loop rather than a recursion because a rope
+       built by folding over a list is as deep as the list is long. */
+    std::vector<const StringRope *> parts;
+    const StringRope * base = this;
+    const StringWithContext * baseFlat;
+    while (!(baseFlat = base->flat.load(std::memory_order_acquire))) {
+        auto next = base->prefix.load(std::memory_order_acquire);
+        /* `base` was flattened by another thread since we looked at
+           `flat`, so `flat` is set now. */
+        if (!next) continue;
+        parts.push_back(base);
+        base = next;
+    }
+
+    /* Each part's prefix is the next element of `parts`, or `base`
+       for the last one. Don't read `prefix` again, since another
+       thread may clear it. */
+    auto buf = allocString(length + 1);
+    memcpy(buf, baseFlat->c_str, base->length);
+    auto pos = base->length;
+    for (size_t i = parts.size(); i-- > 0; ) {
+        auto prefixLength = i + 1 < parts.size() ? parts[i + 1]->length : base->length;
+        auto len = parts[i]->length - prefixLength;
+        memcpy(buf + pos, parts[i]->suffix.c_str, len);
+        pos += len;
+    }
+    assert(pos == length);
+    buf[pos] = 0;
+
+    /* Merge the contexts of the parts, dropping duplicates. */
+    std::vector<const char *> context;
+    auto addContext = [&](const char ** ctx) {
+        if (ctx)
+            for (; *ctx; ++ctx)
+                context.push_back(*ctx);
+    };
+    addContext(baseFlat->context);
+    for (auto part : parts)
+        addContext(part->suffix.context);
+
+    const char ** ctx = nullptr;
+    if (!context.empty()) {
+        auto less = [](const char * a, const char * b) { return strcmp(a, b) < 0; };
+        std::sort(context.begin(), context.end(), less);
+        context.erase(
+            std::unique(context.begin(), context.end(), [](const char * a, const char * b) { return strcmp(a, b) == 0; }),
+            context.end());
+        ctx = (const char * *) allocBytes((context.size() + 1) * sizeof(char *));
+        std::copy(context.begin(), context.end(), ctx);
+        ctx[context.size()] = nullptr;
+    }
+
+    auto result = new (allocBytes(sizeof(StringWithContext))) StringWithContext{.c_str = buf, .context = ctx};
+
+    const StringWithContext * expected = nullptr;
+    if (!flat.compare_exchange_strong(expected, result, std::memory_order_acq_rel))
+        return *expected;
+
+    /* The parts are no longer needed, so let the GC reclaim them if
+       nothing else refers to them. This happens after publishing
+       `flat`, so a thread that sees the null prefix also sees `flat`. */
+    prefix.store(nullptr, std::memory_order_release);
+    return *result;
+}
+
 void Value::mkPath(const SourcePath & path)
 {
     mkPath(&*path.accessor, makeImmutableString(path.path.abs()));
@@ -1815,8 +1891,8 @@ void EvalState::autoCallFunction(const Bindings & args, Value & fun, Value & res
     forceValue(fun, pos);
 
     if (fun.type() == nAttrs) {
-        auto found = fun.attrs()->find(sFunctor);
-        if (found != fun.attrs()->end()) {
+        auto found = fun.attrs()->get(sFunctor);
+        if (found) {
             Value * v = allocValue();
             callFunction(*found->value, fun, *v, pos);
             forceValue(*v, pos);
@@ -1950,6 +2026,23 @@ void ExprOpUpdate::eval(EvalState & state, Env & env, Value & v)
     if (v1.attrs()->size() == 0) { v = v2; return; }
     if (v2.attrs()->size() == 0) { v = v1; return; }
 
+    auto & b1 = *v1.attrs(), & b2 = *v2.attrs();
+
+    /* If the right-hand side is much smaller than the left-hand side
+       (e.g. an overlay or `pkgs // { foo = ...; }`), copy only the
+       right-hand side and put it on top of the left-hand side. */
+    if (b1.size() >= Bindings::minLayeredSize
+        && b2.size() * 2 <= b1.size()
+        && b1.layers() < Bindings::maxLayers)
+    {
+        auto attrs = state.buildLayeredBindings(b2.size());
+        for (auto & i : b2)
+            attrs.insert(i);
+        v.mkAttrs(attrs.layeredOver(b1));
+        state.nrOpUpdateValuesCopied += b2.size();
+        return;
+    }
+
     auto attrs = state.buildBindings(v1.attrs()->size() + v2.attrs()->size());
 
     /* Merge the sets, preferring values from the second set.  Make
@@ -2028,6 +2121,11 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
     bool first = !forceString;
     ValueType firstType = nString;
 
+    /* If the result is a string that starts with a long string, that
+       string becomes the prefix of a rope instead of being copied (see
+       `StringRope`). */
+    Value * ropePrefix = nullptr;
+
     const auto str = [&] {
         std::string result;
         result.reserve(sSize);
@@ -2086,6 +2184,12 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
                 nf += vTmp.fpoint();
             } else
                 state.error<EvalError>("cannot add %1% to a float", showType(vTmp)).atPos(i_pos).withFrame(env, *this).debugThrow();
+        } else if (firstType == nString && &vTmp == values.data() && vTmp.type() == nString
+            && (vTmp.stringRope() || vTmp.string_view().size() >= Value::StringRope::minLength))
+        {
+            /* Its context is carried by the rope, so it doesn't need
+               to be copied into `context`. */
+            ropePrefix = &vTmp;
         } else {
             if (s.empty()) s.reserve(es->size());
             /* skip canonization of first path, which would only be not
@@ -2109,6 +2213,28 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
         if (!context.empty())
             state.error<EvalError>("a string that refers to a store path cannot be appended to a path").atPos(pos).withFrame(env, *this).debugThrow();
         v.mkPath(state.rootPath(CanonPath(str())));
+    } else if (ropePrefix) {
+        if (s.empty()) {
+            v = *ropePrefix;
+            return;
+        }
+        auto prefix = ropePrefix->stringRope();
+        if (!prefix) {
+            auto str = ropePrefix->string_view();
+            prefix = new (allocBytes(sizeof(Value::StringRope))) Value::StringRope{
+                .prefix = nullptr,
+                .suffix = {.c_str = ropePrefix->c_str(), .context = ropePrefix->context()},
+                .length = str.size(),
+                .flat = nullptr,
+            };
+            prefix->flat.store(&prefix->suffix, std::memory_order_relaxed);
+        }
+        v.mkStringRope(new (allocBytes(sizeof(Value::StringRope))) Value::StringRope{
+            .prefix = prefix,
+            .suffix = {.c_str = c_str(), .context = encodeContext(context)},
+            .length = prefix->length + sSize,
+            .flat = nullptr,
+        });
     } else
         v.mkStringMove(c_str(), context);
 }
@@ -2256,7 +2382,7 @@ Bindings::const_iterator EvalState::getAttr(Symbol attrSym, const Bindings * att
 
 bool EvalState::isFunctor(const Value & fun) const
 {
-    return fun.type() == nAttrs && fun.attrs()->find(sFunctor) != fun.attrs()->end();
+    return fun.type() == nAttrs && fun.attrs()->get(sFunctor);
 }
 
 
@@ -2335,8 +2461,8 @@ bool EvalState::isDerivation(Value & v)
 std::optional<std::string> EvalState::tryAttrsToString(const PosIdx pos, Value & v,
     NixStringContext & context, bool coerceMore, bool copyToStore)
 {
-    auto i = v.attrs()->find(sToString);
-    if (i != v.attrs()->end()) {
+    auto i = v.attrs()->get(sToString);
+    if (i) {
         Value v1;
         callFunction(*i->value, v, v1, pos);
         return coerceToString(pos, v1, context,
@@ -2378,8 +2504,8 @@ BackedStringView EvalState::coerceToString(
         auto maybeString = tryAttrsToString(pos, v, context, coerceMore, copyToStore);
         if (maybeString)
             return std::move(*maybeString);
-        auto i = v.attrs()->find(sOutPath);
-        if (i == v.attrs()->end()) {
+        auto i = v.attrs()->get(sOutPath);
+        if (!i) {
             error<TypeError>(
                 "cannot coerce %1% to a string: %2%",
                 showType(v),
@@ -2488,8 +2614,8 @@ SourcePath EvalState::coerceToPath(const PosIdx pos, Value & v, NixStringContext
     /* Similarly, handle __toString where the result may be a path
        value. */
     if (v.type() == nAttrs) {
-        auto i = v.attrs()->find(sToString);
-        if (i != v.attrs()->end()) {
+        auto i = v.attrs()->get(sToString);
+        if (i) {
             Value v1;
             callFunction(*i->value, v, v1, pos);
             return coerceToPath(pos, v1, context, errorCtx);
@@ -3209,12 +3335,30 @@ Expr * EvalState::parse(
     DocCommentMap tmpDocComments; // Only used when not origin is not a SourcePath
     DocCommentMap *docComments = &tmpDocComments;
 
-    if (auto sourcePath = std::get_if<SourcePath>(&origin)) {
+    auto sourcePath = std::get_if<SourcePath>(&origin);
+    if (sourcePath) {
         auto [it, _] = positionToDocComment.try_emplace(*sourcePath);
         docComments = &it->second;
     }
 
-    auto result = parseExprFromBuf(text, length, origin, basePath, symbols, settings, positions, *docComments, rootFS, exprSymbols);
+    auto posOrigin = positions.addOrigin(origin, length);
+
+    /* Only files are cached; strings and stdin are usually parsed
+       once. */
+    std::optional<Hash> cacheKey;
+    ParseCacheContext cacheContext{*this, posOrigin, basePath};
+    if (settings.parseCache && sourcePath) {
+        cacheKey = parseCacheKey(settings, {text, length}, basePath);
+        if (auto result = lookupParseCache(cacheContext, *cacheKey, *docComments)) {
+            result->bindVars(*this, staticEnv);
+            return result;
+        }
+    }
+
+    auto result = parseExprFromBuf(text, length, posOrigin, basePath, symbols, settings, positions, *docComments, rootFS, exprSymbols);
+
+    if (cacheKey)
+        storeParseCache(cacheContext, *cacheKey, result, *docComments, settings.parseCacheMaxSize);
 
     result->bindVars(*this, staticEnv);
 
@@ -5,6 +5,8 @@
 #include "nix/expr/symbol-table.hh"
 
 #include <algorithm>
+#include <atomic>
+#include <iterator>
 
 namespace nix {
 
@@ -43,6 +45,22 @@ static_assert(sizeof(Attr) == 2 * sizeof(uint32_t) + sizeof(Value *),
  * by its size and its capacity, the capacity being the number of Attr
  * elements allocated after this structure, while the size corresponds to
  * the number of elements already inserted in this structure.
+ *
+ * Lookups do a binary search over the sorted attributes. Large sets
+ * that are looked up repeatedly (such as `pkgs` or `lib`) get a hash
+ * index keyed on the symbol, which is built lazily and makes lookups
+ * constant-time. Small sets keep the plain sorted layout.
+ *
+ * The result of `//` with a small right-hand side is a *layered* set:
+ * its own attributes are only those of the right-hand side, on top of
+ * the left-hand side (`baseLayer`), which is shared rather than copied.
+ * Lookups try each layer from the top down. Iteration (which must see
+ * a single sorted sequence with overridden attributes removed) uses a
+ * flattened copy of all the layers that is built on first use.
+ *
+ * The state needed for the hash index and for layering lives in an
+ * `Extension` after the attributes, which only large and layered sets
+ * have, so that the vast majority of sets stay as small as possible.
  */
 class Bindings
 {
@@ -50,21 +68,265 @@ public:
     typedef uint32_t size_t;
     PosIdx pos;
 
+    /**
+     * Minimum number of attributes for a set to get a hash index.
+     * Below this, a binary search touches only a few cache lines.
+     */
+    static constexpr size_t hashIndexThreshold = 64;
+
+    /**
+     * Number of lookups in a large set before its hash index is
+     * built, so that sets which are only looked up once or twice
+     * (e.g. intermediate results of `//`) don't pay for it.
+     */
+    static constexpr uint32_t hashIndexMinLookups = 8;
+
+    /**
+     * Maximum number of layers in a layered set. Updating a set that
+     * has this many layers produces a flat set, which bounds the cost
+     * of a lookup.
+     */
+    static constexpr uint32_t maxLayers = 8;
+
+    /**
+     * Minimum number of attributes in the left-hand side of `//` for
+     * the result to be layered. Smaller sets are cheap to copy, and
+     * flat sets are faster to look up.
+     */
+    static constexpr size_t minLayeredSize = 32;
+
+    /**
+     * Iterator over the attributes of a set, in sorted order. This is
+     * a pointer into a contiguous array (either `attrs` or the
+     * flattened copy of a layered set) that becomes null when it
+     * reaches the end, so that `end()` is the same for every set and
+     * the result of `find()` can be compared with it.
+     */
+    class const_iterator
+    {
+        const Attr * cur = nullptr;
+        const Attr * last = nullptr;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Attr;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Attr *;
+        using reference = const Attr &;
+
+        const_iterator() = default;
+
+        const_iterator(const Attr * cur, const Attr * last = nullptr)
+            : cur(cur), last(last)
+        { }
+
+        reference operator *() const { return *cur; }
+
+        pointer operator ->() const { return cur; }
+
+        const_iterator & operator ++()
+        {
+            if (++cur == last) cur = nullptr;
+            return *this;
+        }
+
+        const_iterator operator ++(int)
+        {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        bool operator ==(const const_iterator & other) const
+        {
+            return cur == other.cur;
+        }
+
+        /**
+         * Whether this is not `end()`.
+         */
+        explicit operator bool() const
+        {
+            return cur;
+        }
+    };
+
 private:
+    /**
+     * Open-addressing hash table mapping symbols to their position in
+     * `attrs`. The symbol is stored in the slot, so a successful lookup
+     * usually touches one cache line of the index and one of `attrs`.
+     */
+    struct HashIndex
+    {
+        struct Slot
+        {
+            Symbol name;
+            size_t idx;
+        };
+
+        /**
+         * log2 of the number of slots.
+         */
+        unsigned int bits;
+        Slot slots[0];
+
+        static std::size_t slotOf(Symbol name, unsigned int bits)
+        {
+            /* Symbol ids are dense, so use Fibonacci hashing to spread
+               them over the table. */
+            return (std::hash<Symbol>{}(name) * 0x9e3779b97f4a7c15ULL) >> (64 - bits);
+        }
+
+        const Slot * get(Symbol name) const
+        {
+            const std::size_t mask = (std::size_t(1) << bits) - 1;
+            for (auto i = slotOf(name, bits); ; i = (i + 1) & mask) {
+                auto & slot = slots[i];
+                if (slot.name == name) return &slot;
+                if (!slot.name) return nullptr;
+            }
+        }
+    };
+
+    /**
+     * `size_` is the number of attributes stored in this set itself
+     * (i.e. in its top layer).
+     */
     size_t size_, capacity_;
+
+    /**
+     * Whether an `Extension` follows the attributes.
+     */
+    bool extended;
+
+    /**
+     * Whether this set has a base layer.
+     */
+    bool layered = false;
+
+    struct Extension
+    {
+        /**
+         * The number of distinct attributes in all layers.
+         */
+        size_t numAttrs = 0;
+        uint32_t numLayers = 1;
+
+        /* These are only updated on lookups of sets of at least
+           `hashIndexThreshold` attributes. They are atomic so that
+           concurrent lookups don't race; a lost update of `nrLookups`
+           is harmless. */
+        std::atomic<uint32_t> nrLookups{0};
+        std::atomic<const HashIndex *> hashIndex{nullptr};
+
+        /**
+         * The set that this set's attributes are layered on top of.
+         */
+        const Bindings * baseLayer = nullptr;
+
+        /**
+         * The attributes of all layers merged into one sorted array,
+         * built by `flatten()`.
+         */
+        std::atomic<const Attr *> flatAttrs{nullptr};
+    };
+
     Attr attrs[0];
 
-    Bindings(size_t capacity) : size_(0), capacity_(capacity) { }
+    Bindings(size_t capacity, bool extended = false)
+        : size_(0), capacity_(capacity), extended(extended)
+    {
+        if (extended) new (&attrs[capacity]) Extension;
+    }
+
     Bindings(const Bindings & bindings) = delete;
 
+    /**
+     * Whether a set of this capacity needs an `Extension`.
+     */
+    static bool needsExtension(size_t capacity, bool layered)
+    {
+        return layered || capacity >= hashIndexThreshold;
+    }
+
+    Extension & ext() const
+    {
+        assert(extended);
+        return *(Extension *) &attrs[capacity_];
+    }
+
+    const Bindings * baseLayer() const
+    {
+        return layered ? ext().baseLayer : nullptr;
+    }
+
+    /**
+     * Return the hash index of this set, building it if the set has
+     * been looked up often enough. Returns nullptr if the set should
+     * still be searched by binary search.
+     */
+    [[gnu::always_inline]]
+    const HashIndex * getHashIndex() const
+    {
+        auto & ext = this->ext();
+        if (auto index = ext.hashIndex.load(std::memory_order_acquire))
+            return index;
+        auto n = ext.nrLookups.load(std::memory_order_relaxed);
+        if (n < hashIndexMinLookups) {
+            ext.nrLookups.store(n + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return buildHashIndex();
+    }
+
+    [[gnu::noinline]]
+    const HashIndex * buildHashIndex() const;
+
+    /**
+     * Look up `name` in this set's own attributes only.
+     */
+    const Attr * getInLayer(Symbol name) const
+    {
+        if (size_ >= hashIndexThreshold) [[unlikely]] {
+            if (auto index = getHashIndex()) {
+                auto slot = index->get(name);
+                return slot ? &attrs[slot->idx] : nullptr;
+            }
+        }
+        Attr key(name, 0);
+        auto i = std::lower_bound(&attrs[0], &attrs[size_], key);
+        if (i != &attrs[size_] && i->name == name) return i;
+        return nullptr;
+    }
+
+    /**
+     * Return all attributes of this set as one sorted array of
+     * `size()` elements.
+     */
+    const Attr * data() const
+    {
+        if (!layered) [[likely]]
+            return attrs;
+        if (auto flat = ext().flatAttrs.load(std::memory_order_acquire))
+            return flat;
+        return flatten();
+    }
+
+    [[gnu::noinline]]
+    const Attr * flatten() const;
+
 public:
-    size_t size() const { return size_; }
+    size_t size() const { return layered ? ext().numAttrs : size_; }
 
-    bool empty() const { return !size_; }
+    bool empty() const { return !size(); }
 
-    typedef Attr * iterator;
+    /**
+     * Number of layers of this set (1 for a flat set).
+     */
+    uint32_t layers() const { return layered ? ext().numLayers : 1; }
 
-    typedef const Attr * const_iterator;
+    typedef Attr * iterator;
 
     void push_back(const Attr & attr)
     {
@@ -72,36 +334,58 @@ public:
         attrs[size_++] = attr;
     }
 
+    /**
+     * Return an iterator to the attribute `name`, or `end()`. For
+     * layered sets, this searches the flattened copy, so that the
+     * result can be incremented like any other iterator. Use `get()`
+     * for lookups that don't need to iterate.
+     */
     const_iterator find(Symbol name) const
     {
+        if (!layered) [[likely]] {
+            if (auto attr = getInLayer(name)) return {attr, &attrs[size_]};
+            return end();
+        }
+        auto p = data();
+        auto last = p + size();
         Attr key(name, 0);
-        const_iterator i = std::lower_bound(begin(), end(), key);
-        if (i != end() && i->name == name) return i;
+        auto i = std::lower_bound(p, last, key);
+        if (i != last && i->name == name) return {i, last};
         return end();
     }
 
     const Attr * get(Symbol name) const
     {
-        Attr key(name, 0);
-        const_iterator i = std::lower_bound(begin(), end(), key);
-        if (i != end() && i->name == name) return &*i;
+        for (auto layer = this; layer; layer = layer->baseLayer())
+            if (auto attr = layer->getInLayer(name)) return attr;
         return nullptr;
     }
 
-    iterator begin() { return &attrs[0]; }
-    iterator end() { return &attrs[size_]; }
+    /**
+     * Mutable iteration is only for sets that are still being built,
+     * which are never layered.
+     */
+    iterator begin() { assert(!layered); return &attrs[0]; }
+    iterator end() { assert(!layered); return &attrs[size_]; }
+
+    const_iterator begin() const
+    {
+        if (empty()) return end();
+        auto p = data();
+        return {p, p + size()};
+    }
 
-    const_iterator begin() const { return &attrs[0]; }
-    const_iterator end() const { return &attrs[size_]; }
+    const_iterator end() const { return {}; }
 
     Attr & operator[](size_t pos)
     {
+        assert(!layered);
         return attrs[pos];
     }
 
     const Attr & operator[](size_t pos) const
     {
-        return attrs[pos];
+        return data()[pos];
     }
 
     void sort();
@@ -114,9 +398,9 @@ public:
     std::vector<const Attr *> lexicographicOrder(const SymbolTable & symbols) const
     {
         std::vector<const Attr *> res;
-        res.reserve(size_);
-        for (size_t n = 0; n < size_; n++)
-            res.emplace_back(&attrs[n]);
+        res.reserve(size());
+        for (auto & attr : *this)
+            res.emplace_back(&attr);
         std::sort(res.begin(), res.end(), [&](const Attr * a, const Attr * b) {
             std::string_view sa = symbols[a->name], sb = symbols[b->name];
             return sa < sb;
@@ -125,8 +409,13 @@ public:
     }
 
     friend class EvalState;
+    friend class BindingsBuilder;
 };
 
+static_assert(sizeof(Bindings) == 4 * sizeof(uint32_t),
+    "every attribute set has a Bindings header, so keep it small. "
+    "state that only some sets need belongs in Bindings::Extension.");
+
 /**
  * A wrapper around Bindings that ensures that its always in sorted
  * order at the end. The only way to consume a BindingsBuilder is to
@@ -176,6 +465,15 @@ public:
         return bindings;
     }
 
+    /**
+     * Finish a set whose attributes (which must already be sorted)
+     * override those of `base`, by making `base` the next layer of
+     * the set rather than copying it. `base` must have fewer than
+     * `Bindings::maxLayers` layers, and the set must have been
+     * created by `EvalState::buildLayeredBindings()`.
+     */
+    Bindings * layeredOver(const Bindings & base);
+
     size_t capacity()
     {
         return bindings->capacity();
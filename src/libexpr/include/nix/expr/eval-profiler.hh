@@ -111,4 +111,10 @@ public:
 
 ref<EvalProfiler> makeSampleStackProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency);
 
+/**
+ * Make a sampling profiler that writes a gzipped pprof profile to
+ * `profileFile`, with CPU samples and allocation counts per stack.
+ */
+ref<EvalProfiler> makePprofProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency);
+
 }
@@ -209,6 +209,7 @@ struct EvalSettings : Config
           Enables evaluation profiling. The following modes are supported:
 
           * `flamegraph` stack sampling profiler. Outputs folded format, one line per stack (suitable for `flamegraph.pl` and compatible tools).
+          * `pprof` stack sampling profiler with lower overhead. Outputs a gzipped [pprof](https://github.com/google/pprof) profile with the number of samples and the number of allocated objects per stack.
 
           Use [`eval-profile-file`](#conf-eval-profile-file) to specify where the profile is saved.
 
@@ -234,6 +235,22 @@ struct EvalSettings : Config
             Intermediate results are not cached.
         )"};
 
+    Setting<bool> parseCache{this, false, "parse-cache",
+        R"(
+          Whether to cache the parsed syntax trees of Nix files on disk, keyed by the hash of their contents.
+          This lets subsequent invocations of Nix skip lexing and parsing of files that haven't changed.
+          The cache is stored in `$XDG_CACHE_HOME/nix/parse-cache-v2`.
+          Entries that haven't been used for 30 days are removed, as are the least recently used entries once the cache is larger than [`parse-cache-max-size`](#conf-parse-cache-max-size).
+
+          Warnings that are emitted while parsing a file are not repeated when the file is loaded from the cache.
+        )"};
+
+    Setting<uint64_t> parseCacheMaxSize{this, 256 * 1024 * 1024, "parse-cache-max-size",
+        R"(
+          The maximum size in bytes of the [parse cache](#conf-parse-cache).
+          The cache is pruned to this size at most once a day.
+        )"};
+
     Setting<bool> ignoreExceptionsDuringTry{this, false, "ignore-try",
         R"(
           If set to true, ignore exceptions inside 'tryEval' calls when evaluating Nix expressions in
@@ -177,6 +177,10 @@ struct RegexCache;
 
 std::shared_ptr<RegexCache> makeRegexCache();
 
+struct ReplaceStringsCache;
+
+std::shared_ptr<ReplaceStringsCache> makeReplaceStringsCache();
+
 struct DebugTrace {
     /* WARNING: Converting PosIdx -> Pos should be done with extra care. This is
        due to the fact that operator[] of PosTable is incredibly expensive. */
@@ -383,6 +387,11 @@ private:
      */
     std::shared_ptr<RegexCache> regexCache;
 
+    /**
+     * Cache used by prim_replaceStrings().
+     */
+    std::shared_ptr<ReplaceStringsCache> replaceStringsCache;
+
 #if NIX_USE_BOEHMGC
     /**
      * Allocation cache for GC'd Value objects.
@@ -758,13 +767,22 @@ public:
     inline Value * allocValue();
     inline Env & allocEnv(size_t size);
 
-    Bindings * allocBindings(size_t capacity);
+    /**
+     * @param layered Whether the set will be finished with
+     * `BindingsBuilder::layeredOver()`.
+     */
+    Bindings * allocBindings(size_t capacity, bool layered = false);
 
     BindingsBuilder buildBindings(size_t capacity)
     {
         return BindingsBuilder(*this, allocBindings(capacity));
     }
 
+    BindingsBuilder buildLayeredBindings(size_t capacity)
+    {
+        return BindingsBuilder(*this, allocBindings(capacity, true));
+    }
+
     ListBuilder buildList(size_t size)
     {
         return ListBuilder(*this, size);
@@ -869,6 +887,15 @@ public:
 
     DocComment getDocCommentForPos(PosIdx pos);
 
+    /**
+     * The number of values, environments and attribute sets allocated
+     * so far.
+     */
+    uint64_t nrAllocations() const
+    {
+        return nrValues + nrEnvs + nrAttrsets;
+    }
+
 private:
 
     /**
@@ -928,6 +955,7 @@ private:
     friend void prim_getAttr(EvalState & state, const PosIdx pos, Value * * args, Value & v);
     friend void prim_match(EvalState & state, const PosIdx pos, Value * * args, Value & v);
     friend void prim_split(EvalState & state, const PosIdx pos, Value * * args, Value & v);
+    friend void prim_replaceStrings(EvalState & state, const PosIdx pos, Value * * args, Value & v);
 
     friend struct Value;
     friend class ListBuilder;
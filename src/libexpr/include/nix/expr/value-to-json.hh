@@ -10,9 +10,26 @@
 
 namespace nix {
 
+class JSONWriter;
+
 nlohmann::json printValueAsJSON(EvalState & state, bool strict,
     Value & v, const PosIdx pos, NixStringContext & context, bool copyToStore = true);
 
+/**
+ * Serialise `v` to `out` as it is evaluated, without building a
+ * `nlohmann::json` first. The caller must flush `out`.
+ *
+ * If evaluation fails, part of the document may already have been
+ * written to the writer's sink. `nix eval --json` accepts this, since
+ * the command fails too; callers that must not emit truncated JSON
+ * should write to a `StringSink` or use the `std::ostream` overload.
+ */
+void printValueAsJSON(EvalState & state, bool strict,
+    Value & v, const PosIdx pos, JSONWriter & out, NixStringContext & context, bool copyToStore = true);
+
+/**
+ * Write `v` to `str` as JSON. Nothing is written if evaluation fails.
+ */
 void printValueAsJSON(EvalState & state, bool strict,
     Value & v, const PosIdx pos, std::ostream & str, NixStringContext & context, bool copyToStore = true);
 
@@ -1,6 +1,7 @@
 #pragma once
 ///@file
 
+#include <atomic>
 #include <cassert>
 #include <span>
 #include <type_traits>
@@ -38,6 +39,7 @@ typedef enum {
     tExternal,
     tPrimOp,
     tAttrs,
+    tStringRope,
     /* layout: Pair of pointers payload */
     tListSmall,
     tPrimOpApp,
@@ -221,6 +223,62 @@ struct ValueBase
         const char ** context; // must be in sorted order
     };
 
+    /**
+     * A string that is the concatenation of another string (`prefix`)
+     * and `suffix`. This is how `+` and string interpolation represent
+     * results that start with a long string, so that building a large
+     * string by repeated concatenation doesn't copy it every time.
+     *
+     * A rope is flattened into a contiguous string (which is cached)
+     * the first time its contents or context are needed. As with
+     * `Bindings::flatten()`, the result is published with an atomic
+     * compare-and-swap, so concurrent readers see either nothing or
+     * the complete result.
+     */
+    struct StringRope
+    {
+        /**
+         * Strings shorter than this are copied rather than used as the
+         * prefix of a rope.
+         */
+        static constexpr size_t minLength = 256;
+
+        /**
+         * The string that this one extends. Cleared by `flatten()`,
+         * after which it is no longer needed.
+         */
+        mutable std::atomic<const StringRope *> prefix;
+
+        StringWithContext suffix;
+
+        /**
+         * The length of the whole string.
+         */
+        size_t length;
+
+        /**
+         * The whole string, if it has been flattened. For a rope
+         * without a prefix, this points to `suffix`.
+         */
+        mutable std::atomic<const StringWithContext *> flat;
+
+        /**
+         * Return the whole string as a contiguous string, with the
+         * union of the contexts of its parts. This allocates the
+         * first time, so it may throw `std::bad_alloc`.
+         */
+        StringWithContext flatten() const
+        {
+            if (auto f = flat.load(std::memory_order_acquire)) [[likely]]
+                return *f;
+            return doFlatten();
+        }
+
+    private:
+        [[gnu::noinline]]
+        StringWithContext doFlatten() const;
+    };
+
     struct Path
     {
         SourceAccessor * accessor;
@@ -282,6 +340,7 @@ struct PayloadTypeToInternalType
     MACRO(ValueBase::Path, path, tPath)                             \
     MACRO(ValueBase::Null, null_, tNull)                            \
     MACRO(Bindings *, attrs, tAttrs)                                \
+    MACRO(ValueBase::StringRope *, rope, tStringRope)               \
     MACRO(ValueBase::List, bigList, tListN)                         \
     MACRO(ValueBase::SmallList, smallList, tListSmall)              \
     MACRO(ValueBase::ClosureThunk, thunk, tThunk)                   \
@@ -575,6 +634,11 @@ protected:
         attrs = std::bit_cast<Bindings *>(payload[1]);
     }
 
+    void getStorage(StringRope *& rope) const noexcept
+    {
+        rope = std::bit_cast<StringRope *>(payload[1]);
+    }
+
     void getStorage(List & list) const noexcept
     {
         list.elems = untagPointer<decltype(list.elems)>(payload[0]);
@@ -628,6 +692,11 @@ protected:
         setSingleDWordPayload<tAttrs>(std::bit_cast<PackedPointer>(bindings));
     }
 
+    void setStorage(StringRope * rope) noexcept
+    {
+        setSingleDWordPayload<tStringRope>(std::bit_cast<PackedPointer>(rope));
+    }
+
     void setStorage(List list) noexcept
     {
         setUntaggablePayload<pdListN>(list.elems, list.size);
@@ -847,6 +916,13 @@ struct Value : public ValueStorage<sizeof(void *)>
         return out;
     }
 
+    StringWithContext stringWithContext() const
+    {
+        if (isa<tStringRope>()) [[unlikely]]
+            return getStorage<StringRope *>()->flatten();
+        return getStorage<StringWithContext>();
+    }
+
 public:
 
     /**
@@ -902,6 +978,7 @@ public:
         case tBool:
             return nBool;
         case tString:
+        case tStringRope:
             return nString;
         case tPath:
             return nPath;
@@ -966,6 +1043,11 @@ public:
 
     void mkStringMove(const char * s, const NixStringContext & context);
 
+    inline void mkStringRope(StringRope * rope) noexcept
+    {
+        setStorage(rope);
+    }
+
     void mkPath(const SourcePath & path);
     void mkPath(std::string_view path);
 
@@ -1064,19 +1146,32 @@ public:
         return SourcePath(ref(pathAccessor()->shared_from_this()), CanonPath(CanonPath::unchecked_t(), pathStr()));
     }
 
-    std::string_view string_view() const noexcept
+    std::string_view string_view() const
     {
+        if (isa<tStringRope>()) [[unlikely]] {
+            auto rope = getStorage<StringRope *>();
+            return std::string_view(rope->flatten().c_str, rope->length);
+        }
         return std::string_view(getStorage<StringWithContext>().c_str);
     }
 
-    const char * c_str() const noexcept
+    const char * c_str() const
+    {
+        return stringWithContext().c_str;
+    }
+
+    const char ** context() const
     {
-        return getStorage<StringWithContext>().c_str;
+        return stringWithContext().context;
     }
 
-    const char ** context() const noexcept
+    /**
+     * The string as a rope, if it is one (see `StringRope`), or
+     * nullptr.
+     */
+    StringRope * stringRope() const noexcept
     {
-        return getStorage<StringWithContext>().context;
+        return isa<tStringRope>() ? getStorage<StringRope *>() : nullptr;
     }
 
     ExternalValueBase * external() const noexcept
@@ -1,7 +1,13 @@
 #include "nix/expr/json-to-value.hh"
 #include "nix/expr/value.hh"
 #include "nix/expr/eval.hh"
+#include "nix/util/json-utils.hh"
 
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
 #include <limits>
 #include <variant>
 #include <nlohmann/json.hpp>
@@ -171,12 +177,446 @@ public:
     }
 };
 
+/**
+ * A JSON parser that builds Nix values directly, without going
+ * through nlohmann's SAX interface. It is iterative, so deeply nested
+ * documents don't overflow the stack, and strings without escapes are
+ * copied straight from the input.
+ *
+ * On a syntax error it throws `SyntaxError`, and `parseJSON()` parses
+ * the document again with `JSONSax` to get nlohmann's error message.
+ * Errors about the values themselves (null bytes, unsigned integers
+ * that are too large) are thrown directly, in the same order as
+ * `JSONSax` would.
+ */
+class JSONParser
+{
+public:
+
+    struct SyntaxError { };
+
+private:
+
+    EvalState & state;
+    std::string_view s;
+    size_t pos = 0;
+
+    struct Frame
+    {
+        bool isObject;
+        size_t valuesStart;
+        size_t keysStart;
+    };
+
+    std::vector<Frame> frames;
+
+    /**
+     * The members of all open objects and arrays.
+     */
+    ValueVector values;
+
+    /**
+     * The keys of the members of all open objects. The key of
+     * `values[frame.valuesStart + i]` is `keys[frame.keysStart + i]`.
+     */
+    std::vector<Symbol> keys;
+
+    std::vector<std::pair<Symbol, size_t>> sortedKeys;
+
+    /**
+     * Unescaped string contents.
+     */
+    std::string buf;
+
+    /**
+     * Objects in a document usually have the same few keys, so avoid
+     * going through the symbol table for each of them.
+     */
+    struct CachedSymbol
+    {
+        std::string_view key;
+        Symbol symbol;
+    };
+
+    std::array<CachedSymbol, 256> symbolCache;
+
+    [[noreturn]] static void syntaxError()
+    {
+        throw SyntaxError();
+    }
+
+    static bool isDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    void skipWhitespace()
+    {
+        while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\n' || s[pos] == '\r' || s[pos] == '\t'))
+            pos++;
+    }
+
+    void expect(char c)
+    {
+        if (pos == s.size() || s[pos] != c) syntaxError();
+        pos++;
+    }
+
+    void expectLiteral(std::string_view lit)
+    {
+        if (s.substr(pos, lit.size()) != lit) syntaxError();
+        pos += lit.size();
+    }
+
+    unsigned int parseHex4()
+    {
+        if (s.size() - pos < 4) syntaxError();
+        unsigned int n = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            char c = s[pos++];
+            n <<= 4;
+            if (c >= '0' && c <= '9') n |= c - '0';
+            else if (c >= 'a' && c <= 'f') n |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') n |= c - 'A' + 10;
+            else syntaxError();
+        }
+        return n;
+    }
+
+    void appendUTF8(unsigned int cp)
+    {
+        if (cp < 0x80)
+            buf += (char) cp;
+        else if (cp < 0x800) {
+            buf += (char) (0xc0 | (cp >> 6));
+            buf += (char) (0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            buf += (char) (0xe0 | (cp >> 12));
+            buf += (char) (0x80 | ((cp >> 6) & 0x3f));
+            buf += (char) (0x80 | (cp & 0x3f));
+        } else {
+            buf += (char) (0xf0 | (cp >> 18));
+            buf += (char) (0x80 | ((cp >> 12) & 0x3f));
+            buf += (char) (0x80 | ((cp >> 6) & 0x3f));
+            buf += (char) (0x80 | (cp & 0x3f));
+        }
+    }
+
+    /**
+     * Parse a string, starting after the opening quote. The result
+     * points into the input if the string has no escapes, and into
+     * `buf` otherwise, so it is only valid until the next call.
+     */
+    std::string_view parseString(bool & escaped)
+    {
+        auto start = pos;
+        auto runStart = pos;
+        escaped = false;
+
+        while (true) {
+            pos = findJSONStringSpecial(s, pos);
+            if (pos == s.size()) syntaxError();
+
+            unsigned char c = s[pos];
+
+            if (c == '"') {
+                if (!escaped) return s.substr(start, pos++ - start);
+                buf.append(s.substr(runStart, pos++ - runStart));
+                return buf;
+            }
+
+            if (c >= 0x80) {
+                auto len = utf8SequenceLength(s.substr(pos));
+                if (!len) syntaxError();
+                pos += len;
+                continue;
+            }
+
+            /* A control character. */
+            if (c != '\\') syntaxError();
+
+            if (!escaped) {
+                buf.clear();
+                escaped = true;
+            }
+            buf.append(s.substr(runStart, pos - runStart));
+            pos++;
+            if (pos == s.size()) syntaxError();
+
+            switch (s[pos++]) {
+            case '"': buf += '"'; break;
+            case '\\': buf += '\\'; break;
+            case '/': buf += '/'; break;
+            case 'b': buf += '\b'; break;
+            case 'f': buf += '\f'; break;
+            case 'n': buf += '\n'; break;
+            case 'r': buf += '\r'; break;
+            case 't': buf += '\t'; break;
+            case 'u': {
+                auto cp = parseHex4();
+                if (cp >= 0xd800 && cp <= 0xdbff) {
+                    /* A high surrogate must be followed by a low one. */
+                    expectLiteral("\\u");
+                    auto low = parseHex4();
+                    if (low < 0xdc00 || low > 0xdfff) syntaxError();
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                } else if (cp >= 0xdc00 && cp <= 0xdfff)
+                    syntaxError();
+                appendUTF8(cp);
+                break;
+            }
+            default:
+                syntaxError();
+            }
+
+            runStart = pos;
+        }
+    }
+
+    /**
+     * Parse an object key and the following colon, and push the key
+     * onto `keys`.
+     */
+    void parseKey()
+    {
+        expect('"');
+        bool escaped;
+        auto key = parseString(escaped);
+        forceNoNullByte(key);
+
+        if (escaped)
+            keys.push_back(state.symbols.create(key));
+        else {
+            auto & cached = symbolCache[std::hash<std::string_view>()(key) % symbolCache.size()];
+            if (!cached.symbol || cached.key != key)
+                cached = {key, state.symbols.create(key)};
+            keys.push_back(cached.symbol);
+        }
+
+        skipWhitespace();
+        expect(':');
+    }
+
+    Value * parseNumber()
+    {
+        auto start = pos;
+        bool negative = s[pos] == '-';
+        if (negative) pos++;
+
+        auto skipDigits = [&]() {
+            if (pos == s.size() || !isDigit(s[pos])) syntaxError();
+            while (pos < s.size() && isDigit(s[pos])) pos++;
+        };
+
+        if (pos < s.size() && s[pos] == '0')
+            pos++;
+        else
+            skipDigits();
+
+        bool isFloat = false;
+        if (pos < s.size() && s[pos] == '.') {
+            pos++;
+            skipDigits();
+            isFloat = true;
+        }
+        if (pos < s.size() && (s[pos] == 'e' || s[pos] == 'E')) {
+            pos++;
+            if (pos < s.size() && (s[pos] == '+' || s[pos] == '-')) pos++;
+            skipDigits();
+            isFloat = true;
+        }
+
+        auto first = s.data() + start, last = s.data() + pos;
+        auto v = state.allocValue();
+
+        /* Integers that don't fit in 64 bits become floats, like in
+           nlohmann. */
+        if (!isFloat) {
+            if (negative) {
+                NixInt::Inner n;
+                if (std::from_chars(first, last, n).ec == std::errc()) {
+                    v->mkInt(n);
+                    return v;
+                }
+            } else {
+                uint64_t n;
+                if (std::from_chars(first, last, n).ec == std::errc()) {
+                    if (n > (uint64_t) std::numeric_limits<NixInt::Inner>::max())
+                        throw Error("unsigned json number %1% outside of Nix integer range", n);
+                    v->mkInt(n);
+                    return v;
+                }
+            }
+        }
+
+        double d;
+        if (std::from_chars(first, last, d).ec != std::errc())
+            /* Overflow or underflow; let strtod() round it the way
+               nlohmann does. */
+            d = std::strtod(std::string(first, last).c_str(), nullptr);
+        if (!std::isfinite(d)) syntaxError();
+        v->mkFloat(d);
+        return v;
+    }
+
+    Value * finishObject(const Frame & frame)
+    {
+        auto size = values.size() - frame.valuesStart;
+
+        /* Sort the keys, keeping the last of any duplicates. */
+        sortedKeys.clear();
+        for (size_t i = 0; i < size; ++i)
+            sortedKeys.emplace_back(keys[frame.keysStart + i], i);
+        std::sort(sortedKeys.begin(), sortedKeys.end());
+
+        size_t unique = 0;
+        for (size_t i = 0; i < size; ++i)
+            if (i + 1 == size || sortedKeys[i + 1].first != sortedKeys[i].first) unique++;
+
+        auto attrs = state.buildBindings(unique);
+        for (size_t i = 0; i < size; ++i)
+            if (i + 1 == size || sortedKeys[i + 1].first != sortedKeys[i].first)
+                attrs.insert(sortedKeys[i].first, values[frame.valuesStart + sortedKeys[i].second]);
+
+        values.resize(frame.valuesStart);
+        keys.resize(frame.keysStart);
+
+        auto v = state.allocValue();
+        v->mkAttrs(attrs.alreadySorted());
+        return v;
+    }
+
+    Value * finishList(const Frame & frame)
+    {
+        auto list = state.buildList(values.size() - frame.valuesStart);
+        for (const auto & [n, v2] : enumerate(list))
+            v2 = values[frame.valuesStart + n];
+
+        values.resize(frame.valuesStart);
+
+        auto v = state.allocValue();
+        v->mkList(list);
+        return v;
+    }
+
+public:
+
+    JSONParser(EvalState & state, std::string_view s)
+        : state(state), s(s)
+    {
+        symbolCache.fill({});
+    }
+
+    void parse(Value & v)
+    {
+        /* Skip the UTF-8 byte order mark. */
+        if (s.starts_with("\xef\xbb\xbf")) pos = 3;
+
+        while (true) {
+            skipWhitespace();
+            if (pos == s.size()) syntaxError();
+
+            Value * value;
+
+            switch (s[pos]) {
+
+            case '{':
+                pos++;
+                frames.push_back({true, values.size(), keys.size()});
+                skipWhitespace();
+                if (pos < s.size() && s[pos] == '}') {
+                    pos++;
+                    value = finishObject(frames.back());
+                    frames.pop_back();
+                    break;
+                }
+                parseKey();
+                continue;
+
+            case '[':
+                pos++;
+                frames.push_back({false, values.size(), keys.size()});
+                skipWhitespace();
+                if (pos < s.size() && s[pos] == ']') {
+                    pos++;
+                    value = finishList(frames.back());
+                    frames.pop_back();
+                    break;
+                }
+                continue;
+
+            case '"': {
+                pos++;
+                bool escaped;
+                auto str = parseString(escaped);
+                forceNoNullByte(str);
+                value = state.allocValue();
+                value->mkString(str);
+                break;
+            }
+
+            case 't':
+                expectLiteral("true");
+                value = state.getBool(true);
+                break;
+
+            case 'f':
+                expectLiteral("false");
+                value = state.getBool(false);
+                break;
+
+            case 'n':
+                expectLiteral("null");
+                value = &state.vNull;
+                break;
+
+            default:
+                if (s[pos] != '-' && !isDigit(s[pos])) syntaxError();
+                value = parseNumber();
+            }
+
+            /* Add the value to its parent, and finish every object or
+               array that ends after it. */
+            while (true) {
+                if (frames.empty()) {
+                    skipWhitespace();
+                    if (pos != s.size()) syntaxError();
+                    v = *value;
+                    return;
+                }
+
+                values.push_back(value);
+                skipWhitespace();
+
+                auto & frame = frames.back();
+                if (pos < s.size() && s[pos] == ',') {
+                    pos++;
+                    if (frame.isObject) {
+                        skipWhitespace();
+                        parseKey();
+                    }
+                    break;
+                }
+
+                expect(frame.isObject ? '}' : ']');
+                value = frame.isObject ? finishObject(frame) : finishList(frame);
+                frames.pop_back();
+            }
+        }
+    }
+};
+
 void parseJSON(EvalState & state, const std::string_view & s_, Value & v)
 {
-    JSONSax parser(state, v);
-    bool res = json::sax_parse(s_, &parser);
-    if (!res)
-        throw JSONParseError("Invalid JSON Value");
+    try {
+        JSONParser(state, s_).parse(v);
+    } catch (JSONParser::SyntaxError &) {
+        /* Parse the document again to get nlohmann's error message. */
+        JSONSax parser(state, v);
+        bool res = json::sax_parse(s_, &parser);
+        if (!res)
+            throw JSONParseError("Invalid JSON Value");
+    }
 }
 
 }
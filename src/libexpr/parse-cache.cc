@@ -0,0 +1,894 @@
+#include "parse-cache.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/util/users.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/experimental-features.hh"
+#include "nix/store/globals.hh"
+
+#include <typeinfo>
+
+namespace nix {
+
+/**
+ * Bump this whenever the serialisation format or the parser changes
+ * in a way that affects the resulting tree.
+ */
+static constexpr std::string_view parseCacheVersion = "nix-parse-cache-2";
+
+/**
+ * How often to prune the cache directory.
+ */
+static constexpr auto pruneInterval = std::chrono::hours(24);
+
+/**
+ * Entries that haven't been used for this long are removed when the
+ * cache is pruned. Since the key includes the Nix version, this also
+ * removes the entries of Nix versions that are no longer used.
+ */
+static constexpr auto maxUnusedAge = std::chrono::hours(24 * 30);
+
+namespace {
+
+enum class Tag : uint8_t {
+    Null,
+    Ref,
+    Int,
+    Float,
+    String,
+    Path,
+    Var,
+    InheritFrom,
+    Select,
+    OpHasAttr,
+    Attrs,
+    List,
+    Lambda,
+    Call,
+    Let,
+    With,
+    If,
+    Assert,
+    OpNot,
+    OpEq,
+    OpNEq,
+    OpAnd,
+    OpOr,
+    OpImpl,
+    OpUpdate,
+    OpConcatLists,
+    ConcatStrings,
+    Pos,
+};
+
+struct UnsupportedExpr : Error
+{
+    using Error::Error;
+};
+
+struct CorruptEntry : Error
+{
+    using Error::Error;
+};
+
+/**
+ * Serialises an expression tree. Numbers are written as LEB128 varints.
+ * Expressions that are reachable more than once are written once and
+ * referred to by their index afterwards.
+ */
+struct AstWriter
+{
+    const ParseCacheContext & ctx;
+    std::string out;
+
+    std::unordered_map<Symbol, uint64_t> symbolIds;
+    std::vector<Symbol> symbols;
+
+    std::unordered_map<const Expr *, uint64_t> exprIds;
+
+    void num(uint64_t n)
+    {
+        do {
+            uint8_t b = n & 0x7f;
+            n >>= 7;
+            out.push_back(char(n ? b | 0x80 : b));
+        } while (n);
+    }
+
+    void tag(Tag t)
+    {
+        out.push_back(char(t));
+    }
+
+    void str(std::string_view s)
+    {
+        num(s.size());
+        out.append(s);
+    }
+
+    void sym(Symbol s)
+    {
+        if (!s) {
+            num(0);
+            return;
+        }
+        auto [i, inserted] = symbolIds.try_emplace(s, symbols.size() + 1);
+        if (inserted)
+            symbols.push_back(s);
+        num(i->second);
+    }
+
+    void pos(PosIdx p)
+    {
+        if (!p) {
+            num(0);
+            return;
+        }
+        auto offset = ctx.origin.offsetOf(p);
+        if (offset > ctx.origin.size)
+            throw UnsupportedExpr("position outside of the parsed file");
+        num(1 + uint64_t(offset));
+    }
+
+    void attrPath(const AttrPath & attrPath)
+    {
+        num(attrPath.size());
+        for (auto & i : attrPath) {
+            if (i.expr) {
+                num(1);
+                expr(i.expr);
+            } else {
+                num(0);
+                sym(i.symbol);
+            }
+        }
+    }
+
+    void exprs(const std::vector<Expr *> & es)
+    {
+        num(es.size());
+        for (auto e : es)
+            expr(e);
+    }
+
+    template<typename T>
+    void binOp(Tag t, const Expr & e)
+    {
+        auto & e2 = static_cast<const T &>(e);
+        tag(t);
+        pos(e2.pos);
+        expr(e2.e1);
+        expr(e2.e2);
+    }
+
+    /* Each node is written as its tag followed by its contents.
+       Expressions are numbered in the order in which they are
+       completed, which is also the order in which the reader creates
+       them. */
+    void expr(const Expr * e)
+    {
+        if (!e) {
+            tag(Tag::Null);
+            return;
+        }
+
+        if (auto i = exprIds.find(e); i != exprIds.end()) {
+            tag(Tag::Ref);
+            num(i->second);
+            return;
+        }
+
+        auto & type = typeid(*e);
+
+        if (type == typeid(ExprInt)) {
+            tag(Tag::Int);
+            num(std::bit_cast<uint64_t>(static_cast<const ExprInt *>(e)->v.integer().value));
+        }
+
+        else if (type == typeid(ExprFloat)) {
+            tag(Tag::Float);
+            num(std::bit_cast<uint64_t>(static_cast<const ExprFloat *>(e)->v.fpoint()));
+        }
+
+        else if (type == typeid(ExprString)) {
+            tag(Tag::String);
+            str(static_cast<const ExprString *>(e)->s);
+        }
+
+        else if (type == typeid(ExprPath)) {
+            tag(Tag::Path);
+            auto e2 = static_cast<const ExprPath *>(e);
+            if (e2->accessor == ctx.state.rootFS)
+                num(0);
+            else if (e2->accessor == ctx.basePath.accessor)
+                num(1);
+            else
+                throw UnsupportedExpr("path literal with an unknown accessor");
+            str(e2->s);
+        }
+
+        else if (type == typeid(ExprVar)) {
+            tag(Tag::Var);
+            auto e2 = static_cast<const ExprVar *>(e);
+            pos(e2->pos);
+            sym(e2->name);
+        }
+
+        else if (type == typeid(ExprInheritFrom)) {
+            tag(Tag::InheritFrom);
+            auto e2 = static_cast<const ExprInheritFrom *>(e);
+            pos(e2->pos);
+            num(e2->displ);
+        }
+
+        else if (type == typeid(ExprSelect)) {
+            tag(Tag::Select);
+            auto e2 = static_cast<const ExprSelect *>(e);
+            pos(e2->pos);
+            expr(e2->e);
+            attrPath(e2->attrPath);
+            expr(e2->def);
+        }
+
+        else if (type == typeid(ExprOpHasAttr)) {
+            tag(Tag::OpHasAttr);
+            auto e2 = static_cast<const ExprOpHasAttr *>(e);
+            expr(e2->e);
+            attrPath(e2->attrPath);
+        }
+
+        else if (type == typeid(ExprAttrs)) {
+            tag(Tag::Attrs);
+            auto e2 = static_cast<const ExprAttrs *>(e);
+            num(e2->recursive);
+            pos(e2->pos);
+            num(e2->attrs.size());
+            for (auto & [name, def] : e2->attrs) {
+                sym(name);
+                num(uint64_t(def.kind));
+                expr(def.e);
+                pos(def.pos);
+                num(def.displ);
+            }
+            if (e2->inheritFromExprs) {
+                num(1);
+                exprs(*e2->inheritFromExprs);
+            } else
+                num(0);
+            num(e2->dynamicAttrs.size());
+            for (auto & i : e2->dynamicAttrs) {
+                expr(i.nameExpr);
+                expr(i.valueExpr);
+                pos(i.pos);
+            }
+        }
+
+        else if (type == typeid(ExprList)) {
+            tag(Tag::List);
+            exprs(static_cast<const ExprList *>(e)->elems);
+        }
+
+        else if (type == typeid(ExprLambda)) {
+            tag(Tag::Lambda);
+            auto e2 = static_cast<const ExprLambda *>(e);
+            pos(e2->pos);
+            sym(e2->name);
+            sym(e2->arg);
+            if (e2->formals) {
+                num(1);
+                num(e2->formals->formals.size());
+                for (auto & formal : e2->formals->formals) {
+                    pos(formal.pos);
+                    sym(formal.name);
+                    expr(formal.def);
+                }
+                num(e2->formals->ellipsis);
+            } else
+                num(0);
+            expr(e2->body);
+            pos(e2->docComment.begin);
+            pos(e2->docComment.end);
+        }
+
+        else if (type == typeid(ExprCall)) {
+            tag(Tag::Call);
+            auto e2 = static_cast<const ExprCall *>(e);
+            expr(e2->fun);
+            exprs(e2->args);
+            pos(e2->pos);
+            if (e2->cursedOrEndPos) {
+                num(1);
+                pos(*e2->cursedOrEndPos);
+            } else
+                num(0);
+        }
+
+        else if (type == typeid(ExprLet)) {
+            tag(Tag::Let);
+            auto e2 = static_cast<const ExprLet *>(e);
+            expr(e2->attrs);
+            expr(e2->body);
+        }
+
+        else if (type == typeid(ExprWith)) {
+            tag(Tag::With);
+            auto e2 = static_cast<const ExprWith *>(e);
+            pos(e2->pos);
+            expr(e2->attrs);
+            expr(e2->body);
+        }
+
+        else if (type == typeid(ExprIf)) {
+            tag(Tag::If);
+            auto e2 = static_cast<const ExprIf *>(e);
+            pos(e2->pos);
+            expr(e2->cond);
+            expr(e2->then);
+            expr(e2->else_);
+        }
+
+        else if (type == typeid(ExprAssert)) {
+            tag(Tag::Assert);
+            auto e2 = static_cast<const ExprAssert *>(e);
+            pos(e2->pos);
+            expr(e2->cond);
+            expr(e2->body);
+        }
+
+        else if (type == typeid(ExprOpNot)) {
+            tag(Tag::OpNot);
+            expr(static_cast<const ExprOpNot *>(e)->e);
+        }
+
+        else if (type == typeid(ExprOpEq)) binOp<ExprOpEq>(Tag::OpEq, *e);
+        else if (type == typeid(ExprOpNEq)) binOp<ExprOpNEq>(Tag::OpNEq, *e);
+        else if (type == typeid(ExprOpAnd)) binOp<ExprOpAnd>(Tag::OpAnd, *e);
+        else if (type == typeid(ExprOpOr)) binOp<ExprOpOr>(Tag::OpOr, *e);
+        else if (type == typeid(ExprOpImpl)) binOp<ExprOpImpl>(Tag::OpImpl, *e);
+        else if (type == typeid(ExprOpUpdate)) binOp<ExprOpUpdate>(Tag::OpUpdate, *e);
+        else if (type == typeid(ExprOpConcatLists)) binOp<ExprOpConcatLists>(Tag::OpConcatLists, *e);
+
+        else if (type == typeid(ExprConcatStrings)) {
+            tag(Tag::ConcatStrings);
+            auto e2 = static_cast<const ExprConcatStrings *>(e);
+            pos(e2->pos);
+            num(e2->forceString);
+            num(e2->es->size());
+            for (auto & [p, e3] : *e2->es) {
+                pos(p);
+                expr(e3);
+            }
+        }
+
+        else if (type == typeid(ExprPos)) {
+            tag(Tag::Pos);
+            pos(static_cast<const ExprPos *>(e)->pos);
+        }
+
+        else
+            throw UnsupportedExpr("cannot serialise expression of type '%s'", type.name());
+
+        exprIds.emplace(e, exprIds.size());
+    }
+};
+
+/**
+ * Deserialises an expression tree written by `AstWriter`.
+ */
+struct AstReader
+{
+    const ParseCacheContext & ctx;
+    std::string_view in;
+
+    std::vector<Symbol> symbols;
+    std::vector<Expr *> exprs;
+
+    [[noreturn]] void corrupt()
+    {
+        throw CorruptEntry("parse cache entry is corrupt");
+    }
+
+    uint8_t byte()
+    {
+        if (in.empty())
+            corrupt();
+        uint8_t b = in[0];
+        in.remove_prefix(1);
+        return b;
+    }
+
+    uint64_t num()
+    {
+        uint64_t n = 0;
+        for (unsigned int shift = 0; ; shift += 7) {
+            if (shift >= 64)
+                corrupt();
+            auto b = byte();
+            n |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return n;
+        }
+    }
+
+    std::string_view str()
+    {
+        auto len = num();
+        if (len > in.size())
+            corrupt();
+        auto s = in.substr(0, len);
+        in.remove_prefix(len);
+        return s;
+    }
+
+    Symbol sym()
+    {
+        auto i = num();
+        if (!i)
+            return {};
+        if (i > symbols.size())
+            corrupt();
+        return symbols[i - 1];
+    }
+
+    PosIdx pos()
+    {
+        auto n = num();
+        if (!n)
+            return noPos;
+        if (n - 1 > ctx.origin.size)
+            corrupt();
+        return ctx.state.positions.add(ctx.origin, n - 1);
+    }
+
+    AttrPath attrPath()
+    {
+        AttrPath res;
+        auto n = num();
+        for (uint64_t i = 0; i < n; ++i) {
+            if (num())
+                res.emplace_back(expr());
+            else
+                res.emplace_back(sym());
+        }
+        return res;
+    }
+
+    std::vector<Expr *> exprList()
+    {
+        std::vector<Expr *> res;
+        auto n = num();
+        for (uint64_t i = 0; i < n; ++i)
+            res.push_back(expr());
+        return res;
+    }
+
+    template<typename T>
+    Expr * binOp()
+    {
+        auto p = pos();
+        auto e1 = expr();
+        auto e2 = expr();
+        return new T(p, e1, e2);
+    }
+
+    /* Note that all operands are read into locals before constructing
+       a node, because the evaluation order of constructor arguments is
+       unspecified. */
+    Expr * expr()
+    {
+        auto t = byte();
+        if (t > uint8_t(Tag::Pos))
+            corrupt();
+
+        Expr * e = nullptr;
+
+        switch (Tag(t)) {
+
+        case Tag::Null:
+            return nullptr;
+
+        case Tag::Ref: {
+            auto i = num();
+            if (i >= exprs.size())
+                corrupt();
+            return exprs[i];
+        }
+
+        case Tag::Int:
+            e = new ExprInt(NixInt(std::bit_cast<int64_t>(num())));
+            break;
+
+        case Tag::Float:
+            e = new ExprFloat(std::bit_cast<NixFloat>(num()));
+            break;
+
+        case Tag::String:
+            e = new ExprString(std::string(str()));
+            break;
+
+        case Tag::Path: {
+            auto accessor = num();
+            if (accessor > 1)
+                corrupt();
+            auto s = std::string(str());
+            e = new ExprPath(accessor == 0 ? ctx.state.rootFS : ctx.basePath.accessor, std::move(s));
+            break;
+        }
+
+        case Tag::Var: {
+            auto p = pos();
+            auto name = sym();
+            e = new ExprVar(p, name);
+            break;
+        }
+
+        case Tag::InheritFrom: {
+            auto p = pos();
+            auto displ = num();
+            e = new ExprInheritFrom(p, displ);
+            break;
+        }
+
+        case Tag::Select: {
+            auto p = pos();
+            auto e2 = expr();
+            auto path = attrPath();
+            auto def = expr();
+            e = new ExprSelect(p, e2, std::move(path), def);
+            break;
+        }
+
+        case Tag::OpHasAttr: {
+            auto e2 = expr();
+            auto path = attrPath();
+            e = new ExprOpHasAttr(e2, std::move(path));
+            break;
+        }
+
+        case Tag::Attrs: {
+            auto recursive = num();
+            auto p = pos();
+            auto e2 = new ExprAttrs(p);
+            e2->recursive = recursive;
+            auto nrAttrs = num();
+            for (uint64_t i = 0; i < nrAttrs; ++i) {
+                auto name = sym();
+                auto kind = num();
+                if (kind > uint64_t(ExprAttrs::AttrDef::Kind::InheritedFrom))
+                    corrupt();
+                auto value = expr();
+                auto attrPos = pos();
+                ExprAttrs::AttrDef def(value, attrPos, ExprAttrs::AttrDef::Kind(kind));
+                def.displ = num();
+                e2->attrs.emplace(name, def);
+            }
+            if (num())
+                e2->inheritFromExprs = std::make_unique<std::vector<Expr *>>(exprList());
+            auto nrDynamicAttrs = num();
+            for (uint64_t i = 0; i < nrDynamicAttrs; ++i) {
+                auto nameExpr = expr();
+                auto valueExpr = expr();
+                auto attrPos = pos();
+                e2->dynamicAttrs.emplace_back(nameExpr, valueExpr, attrPos);
+            }
+            e = e2;
+            break;
+        }
+
+        case Tag::List: {
+            auto e2 = new ExprList;
+            e2->elems = exprList();
+            e = e2;
+            break;
+        }
+
+        case Tag::Lambda: {
+            auto p = pos();
+            auto name = sym();
+            auto arg = sym();
+            Formals * formals = nullptr;
+            if (num()) {
+                formals = new Formals;
+                auto nrFormals = num();
+                for (uint64_t i = 0; i < nrFormals; ++i) {
+                    auto formalPos = pos();
+                    auto formalName = sym();
+                    auto def = expr();
+                    formals->formals.push_back({formalPos, formalName, def});
+                }
+                formals->ellipsis = num();
+            }
+            auto body = expr();
+            auto docBegin = pos();
+            auto docEnd = pos();
+            auto e2 = new ExprLambda(p, arg, formals, body);
+            e2->name = name;
+            e2->docComment = {docBegin, docEnd};
+            e = e2;
+            break;
+        }
+
+        case Tag::Call: {
+            auto fun = expr();
+            auto args = exprList();
+            auto p = pos();
+            std::optional<PosIdx> cursedOrEndPos;
+            if (num())
+                cursedOrEndPos = pos();
+            auto e2 = new ExprCall(p, fun, std::move(args));
+            e2->cursedOrEndPos = cursedOrEndPos;
+            e = e2;
+            break;
+        }
+
+        case Tag::Let: {
+            auto attrs = dynamic_cast<ExprAttrs *>(expr());
+            if (!attrs)
+                corrupt();
+            auto body = expr();
+            e = new ExprLet(attrs, body);
+            break;
+        }
+
+        case Tag::With: {
+            auto p = pos();
+            auto attrs = expr();
+            auto body = expr();
+            e = new ExprWith(p, attrs, body);
+            break;
+        }
+
+        case Tag::If: {
+            auto p = pos();
+            auto cond = expr();
+            auto then = expr();
+            auto else_ = expr();
+            e = new ExprIf(p, cond, then, else_);
+            break;
+        }
+
+        case Tag::Assert: {
+            auto p = pos();
+            auto cond = expr();
+            auto body = expr();
+            e = new ExprAssert(p, cond, body);
+            break;
+        }
+
+        case Tag::OpNot:
+            e = new ExprOpNot(expr());
+            break;
+
+        case Tag::OpEq: e = binOp<ExprOpEq>(); break;
+        case Tag::OpNEq: e = binOp<ExprOpNEq>(); break;
+        case Tag::OpAnd: e = binOp<ExprOpAnd>(); break;
+        case Tag::OpOr: e = binOp<ExprOpOr>(); break;
+        case Tag::OpImpl: e = binOp<ExprOpImpl>(); break;
+        case Tag::OpUpdate: e = binOp<ExprOpUpdate>(); break;
+        case Tag::OpConcatLists: e = binOp<ExprOpConcatLists>(); break;
+
+        case Tag::ConcatStrings: {
+            auto p = pos();
+            auto forceString = num();
+            auto es = new std::vector<std::pair<PosIdx, Expr *>>;
+            auto n = num();
+            for (uint64_t i = 0; i < n; ++i) {
+                auto p2 = pos();
+                auto e2 = expr();
+                es->emplace_back(p2, e2);
+            }
+            e = new ExprConcatStrings(p, forceString, es);
+            break;
+        }
+
+        case Tag::Pos:
+            e = new ExprPos(pos());
+            break;
+        }
+
+        exprs.push_back(e);
+        return e;
+    }
+};
+
+}
+
+Hash parseCacheKey(const EvalSettings & settings, std::string_view text, const SourcePath & basePath)
+{
+    HashSink sink(HashAlgorithm::SHA256);
+    sink << parseCacheVersion;
+    /* Entries written by a different version of the parser may
+       differ, so don't share them. */
+    sink << nixVersion;
+    /* Paths are made absolute during parsing, `~/...` paths are
+       expanded, and some syntax depends on settings. */
+    sink << basePath.path.abs();
+    sink << getHome();
+    sink << (settings.pureEval ? 1 : 0);
+    sink << (experimentalFeatureSettings.isEnabled(Xp::PipeOperators) ? 1 : 0);
+    sink << (experimentalFeatureSettings.isEnabled(Xp::NoUrlLiterals) ? 1 : 0);
+    sink << text;
+    return sink.finish().first;
+}
+
+static Path parseCacheDir()
+{
+    return getCacheDir() + "/parse-cache-v2";
+}
+
+static Path parseCachePath(const Hash & key)
+{
+    return parseCacheDir() + "/" + key.to_string(HashFormat::Base16, false) + ".ast";
+}
+
+/**
+ * Remove entries that haven't been used for `maxUnusedAge`, and then
+ * the least recently used ones until the cache is at most
+ * `maxSize` bytes. This runs at most once per `pruneInterval`.
+ */
+static void pruneParseCache(uint64_t maxSize)
+{
+    namespace fs = std::filesystem;
+
+    auto dir = parseCacheDir();
+    auto stamp = dir + "/.last-prune";
+    auto now = fs::file_time_type::clock::now();
+
+    std::error_code ec;
+    if (auto last = fs::last_write_time(stamp, ec); !ec && now - last < pruneInterval)
+        return;
+    writeFile(stamp, "");
+
+    /* Entries of the previous format are never read. */
+    deletePath(getCacheDir() + "/parse-cache-v1");
+
+    struct Entry
+    {
+        fs::path path;
+        fs::file_time_type lastUsed;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+
+    for (auto & i : fs::directory_iterator(dir)) {
+        if (i.path().extension() != ".ast")
+            continue;
+        auto lastUsed = i.last_write_time(ec);
+        if (ec)
+            continue;
+        auto size = i.file_size(ec);
+        if (ec)
+            continue;
+        if (now - lastUsed > maxUnusedAge) {
+            fs::remove(i.path(), ec);
+            continue;
+        }
+        entries.push_back({i.path(), lastUsed, size});
+        totalSize += size;
+    }
+
+    if (totalSize <= maxSize)
+        return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry & a, const Entry & b) {
+        return a.lastUsed < b.lastUsed;
+    });
+
+    for (auto & entry : entries) {
+        if (totalSize <= maxSize)
+            break;
+        if (fs::remove(entry.path, ec))
+            totalSize -= entry.size;
+    }
+}
+
+Expr * lookupParseCache(const ParseCacheContext & ctx, const Hash & key, DocCommentMap & docComments)
+{
+    auto path = parseCachePath(key);
+
+    std::string data;
+    try {
+        data = readFile(path);
+    } catch (SysError &) {
+        return nullptr;
+    }
+
+    try {
+        AstReader reader{.ctx = ctx, .in = data};
+
+        if (reader.str() != parseCacheVersion)
+            reader.corrupt();
+
+        /* Check the whole entry before creating any symbols or
+           expressions, since the nodes of a partially decoded tree
+           can't be freed. */
+        auto checksum = reader.str();
+        if (checksum != hashString(HashAlgorithm::SHA256, reader.in).to_string(HashFormat::Base16, false))
+            reader.corrupt();
+
+        auto nrSymbols = reader.num();
+        reader.symbols.reserve(nrSymbols);
+        for (uint64_t i = 0; i < nrSymbols; ++i)
+            reader.symbols.push_back(ctx.state.symbols.create(reader.str()));
+
+        DocCommentMap fileDocComments;
+        auto nrDocComments = reader.num();
+        for (uint64_t i = 0; i < nrDocComments; ++i) {
+            auto p = reader.pos();
+            auto begin = reader.pos();
+            auto end = reader.pos();
+            fileDocComments.emplace(p, DocComment{begin, end});
+        }
+
+        auto e = reader.expr();
+        if (!e || !reader.in.empty())
+            reader.corrupt();
+
+        docComments.merge(fileDocComments);
+
+        /* Record that the entry is in use, so that pruning keeps it.
+           Only do this once a day to avoid a write on every lookup. */
+        std::error_code ec;
+        auto now = std::filesystem::file_time_type::clock::now();
+        if (auto lastUsed = std::filesystem::last_write_time(path, ec); !ec && now - lastUsed > pruneInterval)
+            std::filesystem::last_write_time(path, now, ec);
+
+        return e;
+    } catch (CorruptEntry & e) {
+        debug("ignoring parse cache entry '%s': %s", path, e.msg());
+        return nullptr;
+    }
+}
+
+void storeParseCache(const ParseCacheContext & ctx, const Hash & key, Expr * e, const DocCommentMap & docComments, uint64_t maxSize)
+{
+    try {
+        AstWriter body{.ctx = ctx};
+
+        /* Only record the doc comments of this file. The map may also
+           contain entries from earlier parses of the same path. */
+        size_t nrDocComments = 0;
+        for (auto & [p, doc] : docComments) {
+            if (ctx.origin.offsetOf(p) > ctx.origin.size)
+                continue;
+            body.pos(p);
+            body.pos(doc.begin);
+            body.pos(doc.end);
+            nrDocComments++;
+        }
+        auto docCommentData = std::move(body.out);
+        body.out.clear();
+
+        body.expr(e);
+
+        AstWriter contents{.ctx = ctx};
+        contents.num(body.symbols.size());
+        for (auto sym : body.symbols)
+            contents.str(ctx.state.symbols[sym]);
+        contents.num(nrDocComments);
+        contents.out += docCommentData;
+        contents.out += body.out;
+
+        AstWriter header{.ctx = ctx};
+        header.str(parseCacheVersion);
+        header.str(hashString(HashAlgorithm::SHA256, contents.out).to_string(HashFormat::Base16, false));
+        header.out += contents.out;
+
+        auto path = parseCachePath(key);
+        auto dir = dirOf(path);
+        createDirs(dir);
+        auto tmp = makeTempPath(dir, ".tmp");
+        writeFile(tmp, header.out);
+        std::filesystem::rename(tmp, path);
+
+        pruneParseCache(maxSize);
+    } catch (UnsupportedExpr & e) {
+        debug("not caching parse result: %s", e.msg());
+    } catch (Error & e) {
+        debug("cannot write parse cache entry: %s", e.msg());
+    } catch (std::filesystem::filesystem_error & e) {
+        debug("cannot write parse cache entry: %s", e.what());
+    }
+}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+///@file
+
+#include "nix/expr/eval.hh"
+#include "nix/util/hash.hh"
+
+namespace nix {
+
+/**
+ * On-disk cache of parsed (but not yet bound) expressions, keyed by a
+ * hash of the file contents and of everything else that influences
+ * the result of parsing it (see `parseCacheKey()`).
+ *
+ * The cache stores the `Expr` tree, the symbols it refers to and the
+ * file's doc comments. Positions are stored relative to the start of
+ * the file, so a cached tree can be loaded under a fresh
+ * `PosTable::Origin`.
+ */
+struct ParseCacheContext
+{
+    EvalState & state;
+    const PosTable::Origin & origin;
+    const SourcePath & basePath;
+};
+
+/**
+ * Compute the cache key for parsing `text` relative to `basePath`.
+ */
+Hash parseCacheKey(const EvalSettings & settings, std::string_view text, const SourcePath & basePath);
+
+/**
+ * Load the expression with cache key `key`, if present. Doc comments
+ * recorded for the file are added to `docComments`. Returns `nullptr`
+ * if there is no (valid) cache entry.
+ */
+Expr * lookupParseCache(const ParseCacheContext & ctx, const Hash & key, DocCommentMap & docComments);
+
+/**
+ * Store the freshly parsed expression `e` under `key`, and prune the
+ * cache to `maxSize` bytes if it hasn't been pruned recently. Failures
+ * are not fatal: they only mean that the file will be parsed again
+ * next time.
+ */
+void storeParseCache(const ParseCacheContext & ctx, const Hash & key, Expr * e, const DocCommentMap & docComments, uint64_t maxSize);
+
+}
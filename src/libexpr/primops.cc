@@ -14,7 +14,11 @@
 #include "nix/expr/value-to-xml.hh"
 #include "nix/expr/primops.hh"
 #include "nix/fetchers/fetch-to-store.hh"
+#include "nix/util/aho-corasick.hh"
+#include "nix/util/json-writer.hh"
+#include "nix/util/posix-regex.hh"
 #include "nix/util/sort.hh"
+#include "nix/util/std-hash.hh"
 
 #include <boost/container/small_vector.hpp>
 #include <nlohmann/json.hpp>
@@ -26,7 +30,6 @@
 #include <algorithm>
 #include <cstring>
 #include <sstream>
-#include <regex>
 
 #ifndef _WIN32
 # include <dlfcn.h>
@@ -41,10 +44,10 @@ namespace nix {
  * Miscellaneous
  *************************************************************/
 
-static inline Value * mkString(EvalState & state, const std::csub_match & match)
+static inline Value * mkString(EvalState & state, std::string_view s)
 {
     Value * v = state.allocValue();
-    v->mkString({match.first, match.second});
+    v->mkString(s);
     return v;
 }
 
@@ -2321,12 +2324,42 @@ static RegisterPrimOp primop_toXML({
 /* Convert the argument (which can be any Nix expression) to a JSON
    string.  Not all Nix expressions can be sensibly or completely
    represented (e.g., functions). */
+/* A sink that writes into a garbage-collected buffer, which becomes
+   the string value without being copied again. */
+struct GCStringSink : Sink
+{
+    char * buf = nullptr;
+    size_t size = 0, capacity = 0;
+
+    void operator () (std::string_view data) override
+    {
+        if (size + data.size() + 1 > capacity) {
+            capacity = std::max(size + data.size() + 1, capacity * 2);
+            auto newBuf = (char *) GC_MALLOC_ATOMIC(capacity);
+            if (!newBuf) throw std::bad_alloc();
+            if (size) memcpy(newBuf, buf, size);
+            buf = newBuf;
+        }
+        memcpy(buf + size, data.data(), data.size());
+        size += data.size();
+    }
+
+    const char * c_str()
+    {
+        if (!buf) return "";
+        buf[size] = 0;
+        return buf;
+    }
+};
+
 static void prim_toJSON(EvalState & state, const PosIdx pos, Value * * args, Value & v)
 {
-    std::ostringstream out;
+    GCStringSink sink;
+    JSONWriter out(sink);
     NixStringContext context;
     printValueAsJSON(state, true, *args[0], pos, out, context);
-    v.mkString(toView(out), context);
+    out.flush();
+    v.mkStringMove(sink.c_str(), context);
 }
 
 static RegisterPrimOp primop_toJSON({
@@ -4371,25 +4404,22 @@ struct RegexCache
 {
     struct State
     {
-        std::unordered_map<std::string, std::regex, StringViewHash, std::equal_to<>> cache;
+        std::unordered_map<std::string, std::shared_ptr<const PosixRegex>, StringViewHash, std::equal_to<>> cache;
     };
 
     Sync<State> state_;
 
-    std::regex get(std::string_view re)
+    /**
+     * Return the compiled form of `re`. This is shared by all callers,
+     * so that the DFA states it builds up are reused across calls.
+     */
+    std::shared_ptr<const PosixRegex> get(std::string_view re)
     {
         auto state(state_.lock());
         auto it = state->cache.find(re);
         if (it != state->cache.end())
             return it->second;
-        /* No std::regex constructor overload from std::string_view, but can be constructed
-           from a pointer + size or an iterator range. */
-        return state->cache
-            .emplace(
-                std::piecewise_construct,
-                std::forward_as_tuple(re),
-                std::forward_as_tuple(/*s=*/re.data(), /*count=*/re.size(), std::regex::extended))
-            .first->second;
+        return state->cache.emplace(re, std::make_shared<const PosixRegex>(re)).first->second;
     }
 };
 
@@ -4409,31 +4439,29 @@ void prim_match(EvalState & state, const PosIdx pos, Value * * args, Value & v)
         NixStringContext context;
         const auto str = state.forceString(*args[1], context, pos, "while evaluating the second argument passed to builtins.match");
 
-        std::cmatch match;
-        if (!std::regex_match(str.begin(), str.end(), match, regex)) {
+        RegexMatch match;
+        if (!regex->match(str, &match)) {
             v.mkNull();
             return;
         }
 
         // the first match is the whole string
-        auto list = state.buildList(match.size() - 1);
+        auto list = state.buildList(regex->groups());
         for (const auto & [i, v2] : enumerate(list))
-            if (!match[i + 1].matched)
+            if (!match.matched(i + 1))
                 v2 = &state.vNull;
             else
-                v2 = mkString(state, match[i + 1]);
+                v2 = mkString(state, match.str(str, i + 1));
         v.mkList(list);
 
-    } catch (std::regex_error & e) {
-        if (e.code() == std::regex_constants::error_space) {
-            // limit is _GLIBCXX_REGEX_STATE_LIMIT for libstdc++
-            state.error<EvalError>("memory limit exceeded by regular expression '%s'", re)
-                .atPos(pos)
-                .debugThrow();
-        } else
-            state.error<EvalError>("invalid regular expression '%s'", re)
-                .atPos(pos)
-                .debugThrow();
+    } catch (RegexSpaceError &) {
+        state.error<EvalError>("memory limit exceeded by regular expression '%s'", re)
+            .atPos(pos)
+            .debugThrow();
+    } catch (RegexError &) {
+        state.error<EvalError>("invalid regular expression '%s'", re)
+            .atPos(pos)
+            .debugThrow();
     }
 }
 
@@ -4486,11 +4514,11 @@ void prim_split(EvalState & state, const PosIdx pos, Value * * args, Value & v)
         NixStringContext context;
         const auto str = state.forceString(*args[1], context, pos, "while evaluating the second argument passed to builtins.split");
 
-        auto begin = std::cregex_iterator(str.begin(), str.end(), regex);
-        auto end = std::cregex_iterator();
+        std::vector<RegexMatch> matches;
+        regex->forEachMatch(str, [&](const RegexMatch & match) { matches.push_back(match); });
 
         // Any matches results are surrounded by non-matching results.
-        const size_t len = std::distance(begin, end);
+        const size_t len = matches.size();
         auto list = state.buildList(2 * len + 1);
         size_t idx = 0;
 
@@ -4500,46 +4528,46 @@ void prim_split(EvalState & state, const PosIdx pos, Value * * args, Value & v)
             return;
         }
 
-        for (auto i = begin; i != end; ++i) {
+        size_t prevEnd = 0;
+
+        for (const auto & match : matches) {
             assert(idx <= 2 * len + 1 - 3);
-            const auto & match = *i;
 
             // Add a string for non-matched characters.
-            list[idx++] = mkString(state, match.prefix());
+            list[idx++] = mkString(state, str.substr(prevEnd, match.start() - prevEnd));
+            prevEnd = match.end();
 
             // Add a list for matched substrings.
-            const size_t slen = match.size() - 1;
+            const size_t slen = regex->groups();
 
             // Start at 1, because the first match is the whole string.
             auto list2 = state.buildList(slen);
             for (const auto & [si, v2] : enumerate(list2)) {
-                if (!match[si + 1].matched)
+                if (!match.matched(si + 1))
                     v2 = &state.vNull;
                 else
-                    v2 = mkString(state, match[si + 1]);
+                    v2 = mkString(state, match.str(str, si + 1));
             }
 
             (list[idx++] = state.allocValue())->mkList(list2);
 
             // Add a string for non-matched suffix characters.
             if (idx == 2 * len)
-                list[idx++] = mkString(state, match.suffix());
+                list[idx++] = mkString(state, str.substr(prevEnd));
         }
 
         assert(idx == 2 * len + 1);
 
         v.mkList(list);
 
-    } catch (std::regex_error & e) {
-        if (e.code() == std::regex_constants::error_space) {
-            // limit is _GLIBCXX_REGEX_STATE_LIMIT for libstdc++
-            state.error<EvalError>("memory limit exceeded by regular expression '%s'", re)
-                .atPos(pos)
-                .debugThrow();
-        } else
-            state.error<EvalError>("invalid regular expression '%s'", re)
-                .atPos(pos)
-                .debugThrow();
+    } catch (RegexSpaceError &) {
+        state.error<EvalError>("memory limit exceeded by regular expression '%s'", re)
+            .atPos(pos)
+            .debugThrow();
+    } catch (RegexError &) {
+        state.error<EvalError>("invalid regular expression '%s'", re)
+            .atPos(pos)
+            .debugThrow();
     }
 }
 
@@ -4610,7 +4638,47 @@ static RegisterPrimOp primop_concatStringsSep({
     .fun = prim_concatStringsSep,
 });
 
-static void prim_replaceStrings(EvalState & state, const PosIdx pos, Value * * args, Value & v)
+struct ReplaceStringsCache
+{
+    /**
+     * Maximum number of cached automata. The cache is cleared when it
+     * is full, which only happens if `from` is computed dynamically.
+     */
+    static constexpr size_t maxSize = 4096;
+
+    struct State
+    {
+        std::unordered_multimap<size_t, std::shared_ptr<const AhoCorasick>> cache;
+    };
+
+    Sync<State> state_;
+
+    std::shared_ptr<const AhoCorasick> get(std::span<const std::string_view> patterns)
+    {
+        size_t hash = patterns.size();
+        for (auto & p : patterns)
+            hash_combine(hash, p);
+
+        auto state(state_.lock());
+        auto [begin, end] = state->cache.equal_range(hash);
+        for (auto i = begin; i != end; ++i)
+            if (std::ranges::equal(i->second->patterns(), patterns))
+                return i->second;
+
+        if (state->cache.size() >= maxSize)
+            state->cache.clear();
+        auto matcher = std::make_shared<const AhoCorasick>(std::vector<std::string>(patterns.begin(), patterns.end()));
+        state->cache.emplace(hash, matcher);
+        return matcher;
+    }
+};
+
+std::shared_ptr<ReplaceStringsCache> makeReplaceStringsCache()
+{
+    return std::make_shared<ReplaceStringsCache>();
+}
+
+void prim_replaceStrings(EvalState & state, const PosIdx pos, Value * * args, Value & v)
 {
     state.forceList(*args[0], pos, "while evaluating the first argument passed to builtins.replaceStrings");
     state.forceList(*args[1], pos, "while evaluating the second argument passed to builtins.replaceStrings");
@@ -4619,51 +4687,42 @@ static void prim_replaceStrings(EvalState & state, const PosIdx pos, Value * * a
             "'from' and 'to' arguments passed to builtins.replaceStrings have different lengths"
         ).atPos(pos).debugThrow();
 
-    std::vector<std::string_view> from;
-    from.reserve(args[0]->listSize());
+    boost::container::small_vector<std::string_view, 8> from;
     for (auto elem : args[0]->listView())
         from.emplace_back(state.forceString(*elem, pos, "while evaluating one of the strings to replace passed to builtins.replaceStrings"));
 
-    std::unordered_map<size_t, std::string_view> cache;
-    auto to = args[1]->listView();
+    auto matcher = state.replaceStringsCache->get({from.data(), from.size()});
 
     NixStringContext context;
     auto s = state.forceString(*args[2], context, pos, "while evaluating the third argument passed to builtins.replaceStrings");
 
+    auto matches = matcher->findMatches(s);
+
+    /* Nothing to replace, so the result is the original string. */
+    if (matches.empty()) {
+        v = *args[2];
+        return;
+    }
+
+    // The replacements are only forced when their pattern matches.
+    std::vector<std::optional<std::string_view>> cache(from.size());
+    auto to = args[1]->listView();
+
     std::string res;
-    // Loops one past last character to handle the case where 'from' contains an empty string.
-    for (size_t p = 0; p <= s.size(); ) {
-        bool found = false;
-        auto i = from.begin();
-        auto j = to.begin();
-        size_t j_index = 0;
-        for (; i != from.end(); ++i, ++j, ++j_index)
-            if (s.compare(p, i->size(), *i) == 0) {
-                found = true;
-                auto v = cache.find(j_index);
-                if (v == cache.end()) {
-                    NixStringContext ctx;
-                    auto ts = state.forceString(**j, ctx, pos, "while evaluating one of the replacement strings passed to builtins.replaceStrings");
-                    v = (cache.emplace(j_index, ts)).first;
-                    for (auto& path : ctx)
-                        context.insert(path);
-                }
-                res += v->second;
-                if (i->empty()) {
-                    if (p < s.size())
-                        res += s[p];
-                    p++;
-                } else {
-                    p += i->size();
-                }
-                break;
-            }
-        if (!found) {
-            if (p < s.size())
-                res += s[p];
-            p++;
+    size_t prevEnd = 0;
+    for (auto & match : matches) {
+        auto & replacement = cache[match.pattern];
+        if (!replacement) {
+            NixStringContext ctx;
+            replacement = state.forceString(*to[match.pattern], ctx, pos, "while evaluating one of the replacement strings passed to builtins.replaceStrings");
+            for (auto & path : ctx)
+                context.insert(path);
         }
+        res.append(s.substr(prevEnd, match.pos - prevEnd));
+        res += *replacement;
+        prevEnd = match.pos + from[match.pattern].size();
     }
+    res.append(s.substr(prevEnd));
 
     v.mkString(res, context);
 }
@@ -1,6 +1,7 @@
 #include "nix/expr/value-to-json.hh"
 #include "nix/expr/eval-inline.hh"
 #include "nix/store/store-api.hh"
+#include "nix/util/json-writer.hh"
 #include "nix/util/signals.hh"
 
 #include <cstdlib>
@@ -10,72 +11,123 @@
 
 namespace nix {
 using json = nlohmann::json;
-// TODO: rename. It doesn't print.
-json printValueAsJSON(EvalState & state, bool strict,
-    Value & v, const PosIdx pos, NixStringContext & context, bool copyToStore)
+
+/**
+ * A writer with the same interface as `JSONWriter` that builds a
+ * `nlohmann::json` value instead of serialising it.
+ */
+class JSONBuilder
+{
+    nlohmann::json root;
+
+    /**
+     * The objects and arrays that are being filled in. These are
+     * stable because a container doesn't change while one of its
+     * members is open.
+     */
+    std::vector<nlohmann::json *> stack;
+
+    std::string pendingKey;
+
+    nlohmann::json & add(nlohmann::json && j)
+    {
+        if (stack.empty())
+            return root = std::move(j);
+        auto & parent = *stack.back();
+        if (parent.is_object())
+            return parent.emplace(std::move(pendingKey), std::move(j)).first.value();
+        parent.push_back(std::move(j));
+        return parent.back();
+    }
+
+public:
+
+    nlohmann::json result() &&
+    {
+        return std::move(root);
+    }
+
+    void null() { add(nullptr); }
+    void boolean(bool b) { add(b); }
+    void integer(int64_t n) { add(n); }
+    void number(double d) { add(d); }
+    void string(std::string_view s) { add(std::string(s)); }
+    void json(nlohmann::json && j) { add(std::move(j)); }
+
+    void beginObject() { stack.push_back(&add(nlohmann::json::object())); }
+    void key(std::string_view k) { pendingKey = k; }
+    void endObject() { stack.pop_back(); }
+
+    void beginArray() { stack.push_back(&add(nlohmann::json::array())); }
+    void endArray() { stack.pop_back(); }
+};
+
+template<typename Writer>
+static void writeValueAsJSON(EvalState & state, bool strict,
+    Value & v, const PosIdx pos, Writer & out, NixStringContext & context, bool copyToStore)
 {
     checkInterrupt();
 
     if (strict) state.forceValue(v, pos);
 
-    json out;
-
     switch (v.type()) {
 
         case nInt:
-            out = v.integer().value;
+            out.integer(v.integer().value);
             break;
 
         case nBool:
-            out = v.boolean();
+            out.boolean(v.boolean());
             break;
 
         case nString:
             copyContext(v, context);
-            out = v.c_str();
+            out.string(v.string_view());
             break;
 
         case nPath:
             if (copyToStore)
-                out = state.store->printStorePath(
-                    state.copyPathToStore(context, v.path()));
+                out.string(state.store->printStorePath(
+                    state.copyPathToStore(context, v.path())));
             else
-                out = v.path().path.abs();
+                out.string(v.path().path.abs());
             break;
 
         case nNull:
-            // already initialized as null
+            out.null();
             break;
 
         case nAttrs: {
             auto maybeString = state.tryAttrsToString(pos, v, context, false, false);
             if (maybeString) {
-                out = *maybeString;
+                out.string(*maybeString);
                 break;
             }
             if (auto i = v.attrs()->get(state.sOutPath))
-                return printValueAsJSON(state, strict, *i->value, i->pos, context, copyToStore);
+                return writeValueAsJSON(state, strict, *i->value, i->pos, out, context, copyToStore);
             else {
-                out = json::object();
+                out.beginObject();
                 for (auto & a : v.attrs()->lexicographicOrder(state.symbols)) {
+                    out.key(state.symbols[a->name]);
                     try {
-                        out.emplace(state.symbols[a->name], printValueAsJSON(state, strict, *a->value, a->pos, context, copyToStore));
+                        writeValueAsJSON(state, strict, *a->value, a->pos, out, context, copyToStore);
                     } catch (Error & e) {
                         e.addTrace(state.positions[a->pos],
                             HintFmt("while evaluating attribute '%1%'", state.symbols[a->name]));
                         throw;
                     }
                 }
+                out.endObject();
             }
             break;
         }
 
         case nList: {
-            out = json::array();
+            out.beginArray();
             int i = 0;
             for (auto elem : v.listView()) {
                 try {
-                    out.push_back(printValueAsJSON(state, strict, *elem, pos, context, copyToStore));
+                    writeValueAsJSON(state, strict, *elem, pos, out, context, copyToStore);
                 } catch (Error & e) {
                     e.addTrace(state.positions[pos],
                         HintFmt("while evaluating list element at index %1%", i));
@@ -83,15 +135,16 @@ json printValueAsJSON(EvalState & state, bool strict,
                 }
                 i++;
             }
+            out.endArray();
             break;
         }
 
         case nExternal:
-            return v.external()->printValueAsJSON(state, strict, context, copyToStore);
+            out.json(v.external()->printValueAsJSON(state, strict, context, copyToStore));
             break;
 
         case nFloat:
-            out = v.fpoint();
+            out.number(v.fpoint());
             break;
 
         case nThunk:
@@ -103,19 +156,37 @@ json printValueAsJSON(EvalState & state, bool strict,
             .atPos(v.determinePos(pos))
             .debugThrow();
     }
-    return out;
+}
+
+// TODO: rename. It doesn't print.
+json printValueAsJSON(EvalState & state, bool strict,
+    Value & v, const PosIdx pos, NixStringContext & context, bool copyToStore)
+{
+    JSONBuilder out;
+    writeValueAsJSON(state, strict, v, pos, out, context, copyToStore);
+    return std::move(out).result();
 }
 
 void printValueAsJSON(EvalState & state, bool strict,
-    Value & v, const PosIdx pos, std::ostream & str, NixStringContext & context, bool copyToStore)
+    Value & v, const PosIdx pos, JSONWriter & out, NixStringContext & context, bool copyToStore)
 {
     try {
-        str << printValueAsJSON(state, strict, v, pos, context, copyToStore);
+        writeValueAsJSON(state, strict, v, pos, out, context, copyToStore);
     } catch (nlohmann::json::exception & e) {
         throw JSONSerializationError("JSON serialization error: %s", e.what());
     }
 }
 
+void printValueAsJSON(EvalState & state, bool strict,
+    Value & v, const PosIdx pos, std::ostream & str, NixStringContext & context, bool copyToStore)
+{
+    StringSink sink;
+    JSONWriter out(sink);
+    printValueAsJSON(state, strict, v, pos, out, context, copyToStore);
+    out.flush();
+    str << sink.s;
+}
+
 json ExternalValueBase::printValueAsJSON(EvalState & state, bool strict,
     NixStringContext & context, bool copyToStore) const
 {
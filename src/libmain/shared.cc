@@ -3,6 +3,7 @@
 #include "nix/main/shared.hh"
 #include "nix/store/store-api.hh"
 #include "nix/store/gc-store.hh"
+#include "nix/store/drv-hash-cache.hh"
 #include "nix/main/loggers.hh"
 #include "nix/main/progress-bar.hh"
 #include "nix/util/signals.hh"
@@ -24,6 +25,7 @@
 
 #include "nix/util/exit.hh"
 #include "nix/util/strings.hh"
+#include "nix/util/finally.hh"
 
 #include "main-config-private.hh"
 #include "nix/expr/config.hh"
@@ -316,6 +318,7 @@ int handleExceptions(const std::string & programName, std::function<void()> fun)
     try {
         try {
             try {
+                Finally flushHashes([]() { flushDrvHashCache(); });
                 fun();
             } catch (...) {
                 /* Subtle: we have to make sure that any `interrupted'
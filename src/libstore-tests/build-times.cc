@@ -0,0 +1,115 @@
+#include "nix/store/build/build-times.hh"
+#include "nix/util/file-system.hh"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <vector>
+
+namespace nix {
+
+TEST(BuildTimes, recordAndLookup)
+{
+    Path tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    Path dbPath(tmpDir + "/build-times.sqlite");
+
+    {
+        BuildTimes buildTimes(dbPath);
+
+        ASSERT_EQ(buildTimes.lookup("hello-2.12"), std::nullopt);
+
+        buildTimes.record("hello-2.12", 100);
+        ASSERT_EQ(buildTimes.lookup("hello-2.12"), 100);
+
+        // Other versions share the history.
+        ASSERT_EQ(buildTimes.lookup("hello-2.13"), 100);
+        ASSERT_EQ(buildTimes.lookup("hello"), 100);
+        ASSERT_EQ(buildTimes.lookup("goodbye-2.12"), std::nullopt);
+
+        // Estimates follow new measurements.
+        buildTimes.record("hello-2.13", 200);
+        ASSERT_EQ(buildTimes.lookup("hello-2.13"), 150);
+    }
+
+    // The history is persistent.
+    BuildTimes buildTimes(dbPath);
+    ASSERT_EQ(buildTimes.lookup("hello-2.14"), 150);
+}
+
+/**
+ * A graph of nodes, where `waiters[n]` are the nodes waiting on `n`.
+ */
+struct TestGraph
+{
+    std::map<int, std::vector<int>> waiters;
+    std::map<int, uint64_t> costs;
+
+    uint64_t length(int node, std::map<int, uint64_t> & memo) const
+    {
+        return criticalPathLength(
+            node,
+            memo,
+            [&](int n) {
+                auto i = waiters.find(n);
+                return i == waiters.end() ? std::vector<int>{} : i->second;
+            },
+            [&](int n) { return costs.at(n); });
+    }
+};
+
+TEST(CriticalPath, chainsAndDiamonds)
+{
+    /* 1 and 2 are dependencies of 3, which is a dependency of 4 and
+       5. 6 is independent. */
+    TestGraph graph{
+        .waiters = {{1, {3}}, {2, {3}}, {3, {4, 5}}},
+        .costs = {{1, 10}, {2, 1}, {3, 5}, {4, 100}, {5, 20}, {6, 60}},
+    };
+
+    std::map<int, uint64_t> memo;
+    ASSERT_EQ(graph.length(4, memo), 100);
+    ASSERT_EQ(graph.length(3, memo), 105);
+    ASSERT_EQ(graph.length(1, memo), 115);
+    ASSERT_EQ(graph.length(2, memo), 106);
+    ASSERT_EQ(graph.length(6, memo), 60);
+
+    /* So when 1, 2 and 6 are ready to build, 1 should start first and
+       the cheap 2 should come before 6, because 4 is waiting on it. */
+    std::vector<int> ready{6, 2, 1};
+    std::stable_sort(ready.begin(), ready.end(), [&](int a, int b) {
+        return graph.length(a, memo) > graph.length(b, memo);
+    });
+    ASSERT_EQ(ready, (std::vector<int>{1, 2, 6}));
+}
+
+TEST(CriticalPath, memoIsReused)
+{
+    TestGraph graph{
+        .waiters = {{1, {2}}},
+        .costs = {{1, 1}, {2, 2}},
+    };
+
+    std::map<int, uint64_t> memo;
+    ASSERT_EQ(graph.length(1, memo), 3);
+
+    /* Cached results are used until they are invalidated. */
+    graph.costs[2] = 10;
+    ASSERT_EQ(graph.length(1, memo), 3);
+    memo.erase(1);
+    memo.erase(2);
+    ASSERT_EQ(graph.length(1, memo), 11);
+}
+
+TEST(CriticalPath, cycle)
+{
+    TestGraph graph{
+        .waiters = {{1, {2}}, {2, {1}}},
+        .costs = {{1, 1}, {2, 2}},
+    };
+
+    std::map<int, uint64_t> memo;
+    ASSERT_EQ(graph.length(1, memo), 3);
+}
+
+}
@@ -235,6 +235,20 @@ TEST_ATERM(DerivationTest, simple,
     makeSimpleDrv(*store),
     "simple-derivation")
 
+TEST_F(DerivationTest, ATerm_escapes_roundTrip) {
+    auto drv = makeSimpleDrv(*store);
+    drv.args.push_back("say \"hi\"\n\tto C:\\ \r");
+    drv.env.insert_or_assign("", "");
+    drv.env.insert_or_assign("ESCAPES", "\\\"\n\r\t");
+
+    auto aterm = drv.unparse(*store, false);
+    ASSERT_NE(aterm.find(R"("say \"hi\"\n\tto C:\\ \r")"), std::string::npos);
+    ASSERT_NE(aterm.find(R"(("ESCAPES","\\\"\n\r\t"))"), std::string::npos);
+
+    auto got = parseDerivation(*store, std::move(aterm), drv.name, mockXpSettings);
+    ASSERT_EQ(got, drv);
+}
+
 Derivation makeDynDepDerivation(const Store & store) {
     Derivation drv;
     drv.name = "dyn-dep-derivation";
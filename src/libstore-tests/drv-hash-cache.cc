@@ -0,0 +1,68 @@
+#include "nix/store/drv-hash-cache.hh"
+#include "nix/store/tests/libstore.hh"
+#include "nix/util/file-system.hh"
+
+#include <gtest/gtest.h>
+
+namespace nix {
+
+class DrvHashCacheTest : public LibStoreTest
+{
+protected:
+    Path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir};
+    Path dbPath = tmpDir + "/drv-hashes.sqlite";
+
+    StorePath drvPath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo.drv"};
+
+    /* A derivation with a different input has a different store
+       path. */
+    StorePath changedDrvPath{"ah7hy3qg1w7hy3qg1w7hy3qg1w7hy3qg-foo.drv"};
+
+    DrvHash drvHash{
+        .hashes = {
+            {"out", hashString(HashAlgorithm::SHA256, "out")},
+            {"dev", hashString(HashAlgorithm::SHA256, "dev")},
+        },
+        .kind = DrvHash::Kind::Regular,
+    };
+};
+
+static void assertSameDrvHash(const std::optional<DrvHash> & actual, const DrvHash & expected)
+{
+    ASSERT_TRUE(actual);
+    ASSERT_EQ(actual->hashes, expected.hashes);
+    ASSERT_EQ(actual->kind, expected.kind);
+}
+
+TEST_F(DrvHashCacheTest, servedFromCache)
+{
+    {
+        DrvHashCache cache(dbPath);
+        ASSERT_EQ(cache.lookup(*store, drvPath), std::nullopt);
+        cache.upsert(*store, drvPath, drvHash);
+        // Pending entries are visible right away.
+        assertSameDrvHash(cache.lookup(*store, drvPath), drvHash);
+    }
+
+    // A new process gets the hash from the database.
+    DrvHashCache cache(dbPath);
+    assertSameDrvHash(cache.lookup(*store, drvPath), drvHash);
+    ASSERT_EQ(cache.lookup(*store, changedDrvPath), std::nullopt);
+}
+
+TEST_F(DrvHashCacheTest, deferred)
+{
+    drvHash.kind = DrvHash::Kind::Deferred;
+
+    {
+        DrvHashCache cache(dbPath);
+        cache.upsert(*store, drvPath, drvHash);
+        cache.flush();
+    }
+
+    DrvHashCache cache(dbPath);
+    assertSameDrvHash(cache.lookup(*store, drvPath), drvHash);
+}
+
+}
@@ -0,0 +1,105 @@
+#include "nix/store/local-store.hh"
+#include "nix/store/globals.hh"
+#include "nix/store/tests/libstore.hh"
+#include "nix/util/file-system.hh"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+namespace nix {
+
+class LocalStoreReadPoolTest : public LibStoreTest
+{
+protected:
+    Path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir};
+
+    ref<LocalStore> localStore = openStore(
+        "local",
+        {
+            {"store", tmpDir + "/store"},
+            {"state", tmpDir + "/state"},
+            {"log", tmpDir + "/log"},
+        }).cast<LocalStore>();
+
+    StorePath addText(std::string_view name, std::string_view text, const StorePathSet & references = {})
+    {
+        StringSource source(text);
+        return localStore->addToStoreFromDump(
+            source,
+            name,
+            FileSerialisationMethod::Flat,
+            ContentAddressMethod::Raw::Text,
+            HashAlgorithm::SHA256,
+            references,
+            NoRepair);
+    }
+};
+
+TEST_F(LocalStoreReadPoolTest, concurrentReadsAndWrites)
+{
+    if (!settings.useSQLiteWAL)
+        GTEST_SKIP() << "the read pool is only used in WAL mode";
+
+    auto base = addText("base", "base");
+    std::vector<StorePath> paths;
+    for (int i = 0; i < 10; ++i)
+        paths.push_back(addText("seed-" + std::to_string(i), std::to_string(i), {base}));
+
+    constexpr int nrWrites = 50;
+    std::atomic<bool> failed{false};
+
+    /* Add referrers of `base` while the readers run. */
+    std::thread writer([&]() {
+        try {
+            for (int i = 0; i < nrWrites; ++i)
+                addText("new-" + std::to_string(i), "new " + std::to_string(i), {base});
+        } catch (...) {
+            failed = true;
+        }
+    });
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t)
+        readers.emplace_back([&]() {
+            try {
+                size_t lastReferrers = 0;
+                for (int i = 0; i < 100; ++i) {
+                    for (auto & path : paths)
+                        if (!localStore->isValidPathUncached(path))
+                            failed = true;
+                    StorePathSet referrers;
+                    localStore->queryReferrers(base, referrers);
+                    /* Readers see committed writes, and never lose
+                       them again. */
+                    if (referrers.size() < lastReferrers || referrers.size() < paths.size())
+                        failed = true;
+                    lastReferrers = referrers.size();
+                }
+            } catch (...) {
+                failed = true;
+            }
+        });
+
+    writer.join();
+    for (auto & reader : readers)
+        reader.join();
+
+    ASSERT_FALSE(failed);
+
+    StorePathSet referrers;
+    localStore->queryReferrers(base, referrers);
+    ASSERT_EQ(referrers.size(), paths.size() + nrWrites);
+
+    /* Every connection went back to the pool, so sequential queries
+       reuse them rather than opening new ones. */
+    auto nrConnections = localStore->readConnections();
+    ASSERT_GE(nrConnections, 1u);
+    ASSERT_LE(nrConnections, std::max(1U, std::thread::hardware_concurrency()));
+    for (int i = 0; i < 10; ++i)
+        ASSERT_TRUE(localStore->isValidPathUncached(base));
+    ASSERT_EQ(localStore->readConnections(), nrConnections);
+}
+
+}
@@ -120,4 +120,35 @@ TEST(NarInfoDiskCacheImpl, create_and_read) {
     }
 }
 
+TEST(NarInfoDiskCacheImpl, upsert_many) {
+    Path tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    Path dbPath(tmpDir + "/test-narinfo-disk-cache.sqlite");
+
+    auto cache = getTestNarInfoDiskCache(dbPath);
+    cache->createCache("http://foo", "/nix/storedir", true, 10);
+
+    auto info = std::make_shared<NarInfo>(StorePath("g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo"), Hash::dummy);
+    info->url = "nar/foo.nar.xz";
+    info->compression = "xz";
+    info->narSize = 1234;
+
+    cache->upsertNarInfos("http://foo", {
+        {"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q", info},
+        {"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3r", nullptr},
+    });
+
+    {
+        auto [outcome, res] = cache->lookupNarInfo("http://foo", "g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q");
+        ASSERT_EQ(outcome, NarInfoDiskCache::oValid);
+        ASSERT_EQ(res->path, info->path);
+        ASSERT_EQ(res->url, info->url);
+        ASSERT_EQ(res->narHash, info->narHash);
+        ASSERT_EQ(res->narSize, info->narSize);
+    }
+
+    ASSERT_EQ(cache->lookupNarInfo("http://foo", "g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3r").first, NarInfoDiskCache::oInvalid);
+    ASSERT_EQ(cache->lookupNarInfo("http://foo", "g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3s").first, NarInfoDiskCache::oUnknown);
+}
+
 }
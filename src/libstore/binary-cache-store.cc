@@ -13,8 +13,11 @@
 #include "nix/util/callback.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/archive.hh"
+#include "nix/util/cdc.hh"
 
 #include <chrono>
+#include <deque>
+#include <filesystem>
 #include <future>
 #include <regex>
 #include <fstream>
@@ -114,6 +117,142 @@ std::optional<std::string> BinaryCacheStore::getFile(const std::string & path)
     return std::move(sink.s);
 }
 
+static std::string compressionExtension(const std::string & method)
+{
+    return
+        method == "xz" ? ".xz" :
+        method == "bzip2" ? ".bz2" :
+        method == "zstd" ? ".zst" :
+        method == "lzip" ? ".lzip" :
+        method == "lz4" ? ".lz4" :
+        method == "br" ? ".br" :
+        "";
+}
+
+static std::string chunkFileFor(const Hash & hash, const std::string & compression)
+{
+    return "chunks/" + hash.to_string(HashFormat::Nix32, false) + compressionExtension(compression);
+}
+
+/**
+ * Splits a NAR into content-defined chunks, uploads every chunk that
+ * the binary cache doesn't have yet, and writes the chunk list to
+ * `nextSink`. The chunk list consists of a `Compression` line
+ * followed by a `Chunk: <sha256> <size>` line for every chunk.
+ *
+ * New chunks are collected into batches, whose existence checks,
+ * compression and uploads run in parallel.
+ */
+struct ChunkUploadSink : CompressionSink
+{
+    BinaryCacheStore & store;
+    Sink & nextSink;
+    RepairFlag repair;
+    std::string compression;
+    std::string list;
+    ChunkingSink chunker;
+
+    /* How often each distinct chunk occurs in the NAR. */
+    std::map<Hash, uint64_t> occurrences;
+
+    /* Distinct chunks that haven't been handled yet. */
+    std::vector<std::pair<Hash, std::string>> batch;
+
+    static constexpr size_t maxBatchSize = 16;
+
+    struct State
+    {
+        /* The size of each distinct chunk in the binary cache. This
+           is the compressed size if we uploaded it, and the
+           uncompressed size (an upper bound) if it was already
+           there, so that we don't have to compress chunks that we
+           don't upload. */
+        std::map<Hash, uint64_t> storedSizes;
+
+        uint64_t nrUploaded = 0;
+    };
+
+    Sync<State> state_;
+
+    uint64_t nrChunks = 0;
+
+    /* Total size of the chunks that a client has to download,
+       available after `finish()`. */
+    uint64_t downloadSize = 0;
+
+    ChunkUploadSink(BinaryCacheStore & store, Sink & nextSink, RepairFlag repair)
+        : store(store)
+        , nextSink(nextSink)
+        , repair(repair)
+        , compression(store.config.compression)
+        , chunker([this](std::string_view chunk) { addChunk(chunk); })
+    {
+        list = "Compression: " + compression + "\n";
+    }
+
+    void writeUnbuffered(std::string_view data) override
+    {
+        chunker(data);
+    }
+
+    void finish() override
+    {
+        flush();
+        chunker.finish();
+        uploadBatch();
+
+        auto state(state_.lock());
+        for (auto & [hash, count] : occurrences)
+            downloadSize += count * state->storedSizes.at(hash);
+
+        nextSink(list);
+    }
+
+    void addChunk(std::string_view chunk)
+    {
+        auto hash = hashString(HashAlgorithm::SHA256, chunk);
+        list += fmt("Chunk: %s %d\n", hash.to_string(HashFormat::Nix32, false), chunk.size());
+        nrChunks++;
+
+        if (occurrences[hash]++) return;
+
+        batch.emplace_back(hash, chunk);
+        if (batch.size() >= maxBatchSize) uploadBatch();
+    }
+
+    void uploadBatch()
+    {
+        if (batch.empty()) return;
+
+        ThreadPool pool(batch.size());
+
+        for (auto & [hash, chunk] : batch)
+            pool.enqueue([&]() {
+                auto path = chunkFileFor(hash, compression);
+
+                if (!repair && store.fileExists(path)) {
+                    state_.lock()->storedSizes.insert_or_assign(hash, chunk.size());
+                    return;
+                }
+
+                auto compressed = compress(
+                    compression, chunk, store.config.parallelCompression, store.config.compressionLevel);
+
+                {
+                    auto state(state_.lock());
+                    state->storedSizes.insert_or_assign(hash, compressed.size());
+                    state->nrUploaded++;
+                }
+
+                store.upsertFile(path, std::move(compressed), "application/octet-stream");
+            });
+
+        pool.process();
+
+        batch.clear();
+    }
+};
+
 std::string BinaryCacheStore::narInfoFileFor(const StorePath & storePath)
 {
     return std::string(storePath.hashPart()) + ".narinfo";
@@ -152,14 +291,21 @@ ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
     HashSink fileHashSink { HashAlgorithm::SHA256 };
     std::shared_ptr<SourceAccessor> narAccessor;
     HashSink narHashSink { HashAlgorithm::SHA256 };
+    std::shared_ptr<ChunkUploadSink> chunkSink;
     {
     FdSink fileSink(fdTemp.get());
     TeeSink teeSinkCompressed { fileSink, fileHashSink };
-    auto compressionSink = makeCompressionSink(
-        config.compression,
-        teeSinkCompressed,
-        config.parallelCompression,
-        config.compressionLevel);
+    /* In chunked mode, the file written to disk is the chunk list;
+       the chunks themselves are uploaded as they're produced. */
+    if (config.chunkedNars)
+        chunkSink = std::make_shared<ChunkUploadSink>(*this, teeSinkCompressed, repair);
+    auto compressionSink = chunkSink
+        ? ref<CompressionSink>(chunkSink)
+        : makeCompressionSink(
+            config.compression,
+            teeSinkCompressed,
+            config.parallelCompression,
+            config.compressionLevel);
     TeeSink teeSinkUncompressed { *compressionSink, narHashSink };
     TeeSource teeSource { narSource, teeSinkUncompressed };
     narAccessor = makeNarAccessor(teeSource);
@@ -171,18 +317,16 @@ ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
 
     auto info = mkInfo(narHashSink.finish());
     auto narInfo = make_ref<NarInfo>(info);
-    narInfo->compression = config.compression;
+    narInfo->compression = chunkSink ? "chunked" : config.compression.get();
     auto [fileHash, fileSize] = fileHashSink.finish();
+    /* For chunked NARs, the file size is an upper bound on what a
+       client has to download. */
+    if (chunkSink)
+        fileSize += chunkSink->downloadSize;
     narInfo->fileHash = fileHash;
     narInfo->fileSize = fileSize;
-    narInfo->url = "nar/" + narInfo->fileHash->to_string(HashFormat::Nix32, false) + ".nar"
-                   + (config.compression == "xz" ? ".xz" :
-           config.compression == "bzip2" ? ".bz2" :
-           config.compression == "zstd" ? ".zst" :
-           config.compression == "lzip" ? ".lzip" :
-           config.compression == "lz4" ? ".lz4" :
-           config.compression == "br" ? ".br" :
-           "");
+    narInfo->url = "nar/" + narInfo->fileHash->to_string(HashFormat::Nix32, false)
+        + (chunkSink ? ".chunks" : ".nar" + compressionExtension(config.compression));
 
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now2 - now1).count();
     printMsg(lvlTalkative, "copying path '%1%' (%2% bytes, compressed %3$.1f%% in %4% ms) to binary cache",
@@ -190,6 +334,10 @@ ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
         ((1.0 - (double) fileSize / info.narSize) * 100.0),
         duration);
 
+    if (chunkSink)
+        debug("split '%s' into %d chunks, %d of which were new",
+            printStorePath(narInfo->path), chunkSink->nrChunks, chunkSink->state_.lock()->nrUploaded);
+
     /* Verify that all references are valid. This may do some .narinfo
        reads, but typically they'll already be cached. */
     for (auto & ref : info.references)
@@ -274,7 +422,7 @@ ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
         stats.narWrite++;
         upsertFile(narInfo->url,
             std::make_shared<std::fstream>(fnTemp, std::ios_base::in | std::ios_base::binary),
-            "application/x-nix-nar");
+            chunkSink ? "text/plain" : "application/x-nix-nar");
     } else
         stats.narWriteAverted++;
 
@@ -409,21 +557,184 @@ void BinaryCacheStore::narFromPath(const StorePath & storePath, Sink & sink)
     LengthSink narSize;
     TeeSink tee { sink, narSize };
 
-    auto decompressor = makeDecompressionSink(info->compression, tee);
+    if (info->compression == "chunked")
+        narFromChunks(*info, tee);
 
-    try {
-        getFile(info->url, *decompressor);
-    } catch (NoSuchBinaryCacheFile & e) {
-        throw SubstituteGone(std::move(e.info()));
-    }
+    else {
+        auto decompressor = makeDecompressionSink(info->compression, tee);
 
-    decompressor->finish();
+        try {
+            getFile(info->url, *decompressor);
+        } catch (NoSuchBinaryCacheFile & e) {
+            throw SubstituteGone(std::move(e.info()));
+        }
+
+        decompressor->finish();
+    }
 
     stats.narRead++;
     //stats.narReadCompressedBytes += nar->size(); // FIXME
     stats.narReadBytes += narSize.length;
 }
 
+/**
+ * Remove the least recently used files from the local chunk cache
+ * `dir` until its total size is at most `maxSize`. Chunks are touched
+ * when they are read from the cache, so their mtime is their last use.
+ */
+static void pruneChunkCache(const Path & dir, uint64_t maxSize)
+{
+    namespace fs = std::filesystem;
+
+    struct Entry
+    {
+        fs::path path;
+        fs::file_time_type lastUsed;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+
+    std::error_code ec;
+    for (auto & i : fs::directory_iterator(dir)) {
+        auto lastUsed = i.last_write_time(ec);
+        if (ec)
+            continue;
+        auto size = i.file_size(ec);
+        if (ec)
+            continue;
+        entries.push_back({i.path(), lastUsed, size});
+        totalSize += size;
+    }
+
+    if (totalSize <= maxSize)
+        return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry & a, const Entry & b) {
+        return a.lastUsed < b.lastUsed;
+    });
+
+    for (auto & entry : entries) {
+        if (totalSize <= maxSize)
+            break;
+        if (fs::remove(entry.path, ec))
+            totalSize -= entry.size;
+    }
+}
+
+void BinaryCacheStore::narFromChunks(const NarInfo & info, Sink & sink)
+{
+    auto list = getFile(info.url);
+    if (!list)
+        throw SubstituteGone("chunk list '%s' does not exist in binary cache '%s'", info.url, getUri());
+
+    std::string compression;
+    std::vector<Hash> chunks;
+
+    for (auto & line : tokenizeString<Strings>(*list, "\n")) {
+        size_t colon = line.find(": ");
+        if (colon == std::string::npos)
+            throw Error("chunk list '%s' in binary cache '%s' is corrupt", info.url, getUri());
+        auto name = line.substr(0, colon);
+        auto value = line.substr(colon + 2);
+        if (name == "Compression")
+            compression = value;
+        else if (name == "Chunk") {
+            auto fields = tokenizeString<std::vector<std::string>>(value, " ");
+            if (fields.empty())
+                throw Error("chunk list '%s' in binary cache '%s' is corrupt", info.url, getUri());
+            chunks.push_back(Hash::parseAny(fields[0], HashAlgorithm::SHA256));
+        }
+    }
+
+    Path cacheDir = config.localChunkCache;
+    if (cacheDir != "")
+        createDirs(cacheDir);
+
+    auto cacheFileFor = [&](const Hash & hash) {
+        return cacheDir + "/" + hash.to_string(HashFormat::Nix32, false);
+    };
+
+    /* Start fetching the chunk with the given hash, unless it's in
+       the local chunk cache. Chunks are fetched asynchronously if the
+       store supports it, so keep a window of them in flight. */
+    typedef std::future<std::optional<std::string>> ChunkFuture;
+
+    auto fetch = [&](const Hash & hash) -> ChunkFuture {
+        auto promise = std::make_shared<std::promise<std::optional<std::string>>>();
+        auto fut = promise->get_future();
+
+        if (cacheDir != "") {
+            auto cacheFile = cacheFileFor(hash);
+            if (pathExists(cacheFile)) {
+                auto data = readFile(cacheFile);
+                if (hashString(HashAlgorithm::SHA256, data) == hash) {
+                    std::error_code ec;
+                    std::filesystem::last_write_time(
+                        cacheFile, std::filesystem::file_time_type::clock::now(), ec);
+                    promise->set_value(std::move(data));
+                    return fut;
+                }
+                deletePath(cacheFile);
+            }
+        }
+
+        getFile(chunkFileFor(hash, compression),
+            {[promise, compression](std::future<std::optional<std::string>> result) {
+                try {
+                    auto data = result.get();
+                    promise->set_value(data ? std::optional(decompress(compression, *data)) : std::nullopt);
+                } catch (...) {
+                    promise->set_exception(std::current_exception());
+                }
+            }});
+
+        return fut;
+    };
+
+    const size_t maxInFlight = 16;
+    std::deque<ChunkFuture> inFlight;
+    size_t next = 0;
+    bool cacheGrew = false;
+
+    for (auto & hash : chunks) {
+        while (next < chunks.size() && inFlight.size() < maxInFlight)
+            inFlight.push_back(fetch(chunks[next++]));
+
+        checkInterrupt();
+
+        auto data = inFlight.front().get();
+        inFlight.pop_front();
+
+        if (!data)
+            throw SubstituteGone("chunk '%s' does not exist in binary cache '%s'",
+                chunkFileFor(hash, compression), getUri());
+
+        if (hashString(HashAlgorithm::SHA256, *data) != hash)
+            throw Error("chunk '%s' from binary cache '%s' has the wrong hash",
+                chunkFileFor(hash, compression), getUri());
+
+        if (cacheDir != "" && !pathExists(cacheFileFor(hash))) {
+            try {
+                writeFile(cacheFileFor(hash), *data);
+                cacheGrew = true;
+            } catch (...) {
+                ignoreExceptionExceptInterrupt();
+            }
+        }
+
+        sink(*data);
+    }
+
+    if (cacheGrew) {
+        try {
+            pruneChunkCache(cacheDir, config.localChunkCacheSize);
+        } catch (std::filesystem::filesystem_error & e) {
+            debug("cannot prune local chunk cache '%s': %s", cacheDir, e.what());
+        }
+    }
+}
+
 void BinaryCacheStore::queryPathInfoUncached(const StorePath & storePath,
     Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept
 {
@@ -0,0 +1,85 @@
+#include "nix/store/build/build-times.hh"
+#include "nix/store/names.hh"
+#include "nix/store/sqlite.hh"
+#include "nix/util/users.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+static const char * schema = R"sql(
+
+create table if not exists BuildTimes (
+    name      text primary key not null,
+    seconds   integer not null,
+    timestamp integer not null
+);
+
+)sql";
+
+struct BuildTimes::State
+{
+    SQLite db;
+    SQLiteStmt lookup, record;
+};
+
+/**
+ * Builds are identified by the name without the version.
+ */
+static std::string buildTimesKey(std::string_view drvName)
+{
+    return DrvName(drvName).name;
+}
+
+BuildTimes::BuildTimes(const Path & dbPath)
+    : _state(std::make_unique<Sync<State>>())
+{
+    auto state(_state->lock());
+
+    createDirs(dirOf(dbPath));
+
+    state->db = SQLite(dbPath);
+
+    state->db.isCache();
+
+    state->db.exec(schema);
+
+    state->lookup.create(state->db,
+        "select seconds from BuildTimes where name = ?");
+
+    /* Keep a moving average, so that estimates follow packages that
+       become faster or slower to build over time. */
+    state->record.create(state->db,
+        "insert into BuildTimes(name, seconds, timestamp) values (?1, ?2, ?3) "
+        "on conflict (name) do update set seconds = (seconds + ?2) / 2, timestamp = ?3");
+}
+
+BuildTimes::~BuildTimes() = default;
+
+std::optional<uint64_t> BuildTimes::lookup(std::string_view drvName)
+{
+    return retrySQLite<std::optional<uint64_t>>([&]() -> std::optional<uint64_t> {
+        auto state(_state->lock());
+        auto query(state->lookup.use()(buildTimesKey(drvName)));
+        if (!query.next()) return std::nullopt;
+        return query.getInt(0);
+    });
+}
+
+void BuildTimes::record(std::string_view drvName, uint64_t seconds)
+{
+    retrySQLite<void>([&]() {
+        auto state(_state->lock());
+        state->record.use()
+            (buildTimesKey(drvName))
+            ((int64_t) seconds)
+            (time(0)).exec();
+    });
+}
+
+BuildTimes & getBuildTimes()
+{
+    static BuildTimes buildTimes(getCacheDir() + "/build-times-v1.sqlite");
+    return buildTimes;
+}
+
+}
@@ -1,5 +1,6 @@
 #include "nix/store/build/derivation-building-goal.hh"
 #include "nix/store/build/derivation-trampoline-goal.hh"
+#include "nix/store/build/build-times.hh"
 #ifndef _WIN32 // TODO enable build hook on Windows
 #  include "nix/store/build/hook-instance.hh"
 #  include "nix/store/build/derivation-builder.hh"
@@ -1226,8 +1227,16 @@ Goal::Done DerivationBuildingGoal::done(
 
     if (buildResult.success()) {
         buildResult.builtOutputs = std::move(builtOutputs);
-        if (status == BuildResult::Built)
+        if (status == BuildResult::Built) {
             worker.doneBuilds++;
+            if (settings.criticalPathScheduling && buildResult.startTime && buildResult.stopTime >= buildResult.startTime) {
+                try {
+                    getBuildTimes().record(drv->name, buildResult.stopTime - buildResult.startTime);
+                } catch (Error & e) {
+                    logWarning(e.info());
+                }
+            }
+        }
     } else {
         if (status != BuildResult::DependencyFailed)
             worker.failedBuilds++;
@@ -108,6 +108,15 @@ void addToWeakGoals(WeakGoals & goals, GoalPtr p)
     goals.insert(p);
 }
 
+void Goal::invalidateCriticalPath()
+{
+    /* If this goal isn't cached, then neither is anything it waits
+       for, since computing those would have cached this goal. */
+    if (!worker.forgetCriticalPath(shared_from_this())) return;
+    for (auto & waitee : waitees)
+        waitee->invalidateCriticalPath();
+}
+
 Co Goal::await(Goals new_waitees)
 {
     assert(waitees.empty());
@@ -115,6 +124,7 @@ Co Goal::await(Goals new_waitees)
         waitees = std::move(new_waitees);
         for (auto waitee : waitees) {
             addToWeakGoals(waitee->waiters, shared_from_this());
+            waitee->invalidateCriticalPath();
         }
         co_await Suspend{};
         assert(waitees.empty());
@@ -157,6 +167,7 @@ Goal::Done Goal::amDone(ExitCode result, std::optional<Error> ex)
                    remaining waitees. */
                 for (auto & g : goal->waitees) {
                     g->waiters.extract(goal);
+                    g->invalidateCriticalPath();
                 }
                 goal->waitees.clear();
 
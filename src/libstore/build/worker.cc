@@ -6,10 +6,13 @@
 #include "nix/store/build/derivation-goal.hh"
 #include "nix/store/build/derivation-building-goal.hh"
 #include "nix/store/build/derivation-trampoline-goal.hh"
+#include "nix/store/build/build-times.hh"
 #ifndef _WIN32 // TODO Enable building on Windows
 #  include "nix/store/build/hook-instance.hh"
 #endif
+#include "nix/store/drv-hash-cache.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/finally.hh"
 
 namespace nix {
 
@@ -185,6 +188,8 @@ void Worker::removeGoal(GoalPtr goal)
     }
 
     waitingForAnyGoal.clear();
+
+    criticalPathLengths.erase(goal);
 }
 
 
@@ -195,6 +200,12 @@ void Worker::wakeUp(GoalPtr goal)
 }
 
 
+bool Worker::forgetCriticalPath(const GoalPtr & goal)
+{
+    return criticalPathLengths.erase(goal);
+}
+
+
 size_t Worker::getNrLocalBuilds()
 {
     return nrLocalBuilds;
@@ -303,6 +314,9 @@ void Worker::waitForAWhile(GoalPtr goal)
 
 void Worker::run(const Goals & _topGoals)
 {
+    /* Write the derivation hashes computed during this build. */
+    Finally flushHashes([]() { flushDrvHashCache(); });
+
     std::vector<nix::DerivedPath> topPaths;
 
     for (auto & i : _topGoals) {
@@ -331,7 +345,8 @@ void Worker::run(const Goals & _topGoals)
             localStore->autoGC(false);
 
         /* Call every wake goal (in the ordering established by
-           CompareGoalPtrs). */
+           CompareGoalPtrs, or by the length of the critical path
+           through the goal if `critical-path-scheduling` is set). */
         while (!awake.empty() && !topGoals.empty()) {
             Goals awake2;
             for (auto & i : awake) {
@@ -339,7 +354,19 @@ void Worker::run(const Goals & _topGoals)
                 if (goal) awake2.insert(goal);
             }
             awake.clear();
-            for (auto & goal : awake2) {
+            std::vector<GoalPtr> ordered(awake2.begin(), awake2.end());
+            if (settings.criticalPathScheduling && ordered.size() > 1) {
+                /* Goals that are waiting for a build slot are all
+                   woken up when a slot becomes free, so this decides
+                   which of them gets it. */
+                std::map<Goal *, uint64_t> lengths;
+                for (auto & goal : ordered)
+                    lengths[goal.get()] = criticalPathLength(goal);
+                std::stable_sort(ordered.begin(), ordered.end(), [&](const GoalPtr & a, const GoalPtr & b) {
+                    return lengths[a.get()] > lengths[b.get()];
+                });
+            }
+            for (auto & goal : ordered) {
                 checkInterrupt();
                 goal->work();
                 if (topGoals.empty()) break; // stuff may have been cancelled
@@ -373,6 +400,45 @@ void Worker::run(const Goals & _topGoals)
     assert(!settings.keepGoing || children.empty());
 }
 
+uint64_t Worker::expectedBuildTime(const Goal & goal)
+{
+    auto buildingGoal = dynamic_cast<const DerivationBuildingGoal *>(&goal);
+    if (!buildingGoal || !buildingGoal->drv) return 0;
+
+    auto & name = buildingGoal->drv->name;
+
+    auto i = expectedBuildTimes.find(name);
+    if (i != expectedBuildTimes.end()) return i->second;
+
+    /* Derivations we know nothing about are assumed to take a
+       minute. */
+    uint64_t seconds = 60;
+    try {
+        if (auto recorded = getBuildTimes().lookup(name))
+            seconds = *recorded;
+    } catch (Error & e) {
+        debug("cannot look up build time of '%s': %s", name, e.what());
+    }
+
+    expectedBuildTimes.emplace(name, seconds);
+    return seconds;
+}
+
+uint64_t Worker::criticalPathLength(const GoalPtr & goal)
+{
+    return nix::criticalPathLength(
+        goal,
+        criticalPathLengths,
+        [](const GoalPtr & goal) {
+            std::vector<GoalPtr> waiters;
+            for (auto & w : goal->waiters)
+                if (auto waiter = w.lock())
+                    waiters.push_back(waiter);
+            return waiters;
+        },
+        [&](const GoalPtr & goal) { return expectedBuildTime(*goal); });
+}
+
 void Worker::waitForInput()
 {
     printMsg(lvlVomit, "waiting for children");
@@ -13,6 +13,7 @@
 #include "nix/util/finally.hh"
 #include "nix/util/archive.hh"
 #include "nix/store/derivations.hh"
+#include "nix/store/drv-hash-cache.hh"
 #include "nix/util/args.hh"
 #include "nix/util/git.hh"
 #include "nix/util/logging.hh"
@@ -856,6 +857,23 @@ static void performOp(TunnelLogger * logger, ref<Store> store,
         break;
     }
 
+    case WorkerProto::Op::QueryPathInfos: {
+        auto paths = WorkerProto::Serialise<StorePathSet>::read(*store, rconn);
+        logger->startWork();
+        auto infos = store->queryPathInfos(paths);
+        logger->stopWork();
+        conn.to << infos.size();
+        for (auto & [path, info] : infos) {
+            WorkerProto::write(*store, wconn, path);
+            if (info) {
+                conn.to << 1;
+                WorkerProto::write(*store, wconn, static_cast<const UnkeyedValidPathInfo &>(*info));
+            } else
+                conn.to << 0;
+        }
+        break;
+    }
+
     case WorkerProto::Op::OptimiseStore:
         logger->startWork();
         store->optimiseStore();
@@ -1056,6 +1074,7 @@ void processConnection(
 
     Finally finally([&]() {
         setInterrupted(false);
+        flushDrvHashCache();
         printMsgUsing(prevLogger, lvlDebug, "%d operations", opCount);
     });
 
@@ -1,4 +1,5 @@
 #include "nix/store/derivations.hh"
+#include "nix/store/drv-hash-cache.hh"
 #include "nix/store/downstream-placeholder.hh"
 #include "nix/store/store-api.hh"
 #include "nix/store/globals.hh"
@@ -10,7 +11,6 @@
 #include "nix/util/strings-inline.hh"
 #include "nix/util/json-utils.hh"
 
-#include <boost/container/small_vector.hpp>
 #include <nlohmann/json.hpp>
 
 namespace nix {
@@ -260,12 +260,25 @@ static bool endOfList(StringViewStream & str)
 }
 
 
+/* Lists in derivations are sorted, so inserting at the end of the
+   container is usually right and avoids a search per element. */
+
 static StringSet parseStrings(StringViewStream & str, bool arePaths)
 {
     StringSet res;
     expect(str, "[");
     while (!endOfList(str))
-        res.insert((arePaths ? parsePath(str) : parseString(str)).toOwned());
+        res.insert(res.end(), (arePaths ? parsePath(str) : parseString(str)).toOwned());
+    return res;
+}
+
+
+static StorePathSet parseStorePaths(const StoreDirConfig & store, StringViewStream & str)
+{
+    StorePathSet res;
+    expect(str, "[");
+    while (!endOfList(str))
+        res.insert(res.end(), store.parseStorePath(*parsePath(str)));
     return res;
 }
 
@@ -376,7 +389,7 @@ static DerivedPathMap<StringSet>::ChildNode parseDerivedPathMapNode(
                 expect(str, "(");
                 auto outputName = parseString(str).toOwned();
                 expect(str, ",");
-                node.childMap.insert_or_assign(outputName, parseDerivedPathMapNode(store, str, version));
+                node.childMap.insert_or_assign(node.childMap.end(), outputName, parseDerivedPathMapNode(store, str, version));
                 expect(str, ")");
             }
             expect(str, ")");
@@ -430,7 +443,7 @@ Derivation parseDerivation(
     while (!endOfList(str)) {
         expect(str, "("); std::string id = parseString(str).toOwned();
         auto output = parseDerivationOutput(store, str, xpSettings);
-        drv.outputs.emplace(std::move(id), std::move(output));
+        drv.outputs.emplace_hint(drv.outputs.end(), std::move(id), std::move(output));
     }
 
     /* Parse the list of input derivations. */
@@ -439,11 +452,11 @@ Derivation parseDerivation(
         expect(str, "(");
         auto drvPath = parsePath(str);
         expect(str, ",");
-        drv.inputDrvs.map.insert_or_assign(store.parseStorePath(*drvPath), parseDerivedPathMapNode(store, str, version));
+        drv.inputDrvs.map.insert_or_assign(drv.inputDrvs.map.end(), store.parseStorePath(*drvPath), parseDerivedPathMapNode(store, str, version));
         expect(str, ")");
     }
 
-    expect(str, ","); drv.inputSrcs = store.parseStorePathSet(parseStrings(str, true));
+    expect(str, ","); drv.inputSrcs = parseStorePaths(store, str);
     expect(str, ","); drv.platform = parseString(str).toOwned();
     expect(str, ","); drv.builder = parseString(str).toOwned();
 
@@ -458,7 +471,7 @@ Derivation parseDerivation(
         expect(str, "("); auto name = parseString(str).toOwned();
         expect(str, ","); auto value = parseString(str).toOwned();
         expect(str, ")");
-        drv.env.insert_or_assign(std::move(name), std::move(value));
+        drv.env.insert_or_assign(drv.env.end(), std::move(name), std::move(value));
     }
 
     expect(str, ")");
@@ -477,19 +490,18 @@ Derivation parseDerivation(
  */
 static void printString(std::string & res, std::string_view s)
 {
-    boost::container::small_vector<char, 64 * 1024> buffer;
-    buffer.reserve(s.size() * 2 + 2);
-    char * buf = buffer.data();
-    char * p = buf;
-    *p++ = '"';
-    for (auto c : s)
-        if (c == '\"' || c == '\\') { *p++ = '\\'; *p++ = c; }
-        else if (c == '\n') { *p++ = '\\'; *p++ = 'n'; }
-        else if (c == '\r') { *p++ = '\\'; *p++ = 'r'; }
-        else if (c == '\t') { *p++ = '\\'; *p++ = 't'; }
-        else *p++ = c;
-    *p++ = '"';
-    res.append(buf, p - buf);
+    res += '"';
+    /* Copy runs of characters that don't need escaping in one go. */
+    while (true) {
+        auto i = s.find_first_of("\"\\\n\r\t");
+        res.append(s.substr(0, i));
+        if (i == s.npos) break;
+        auto c = s[i];
+        res += '\\';
+        res += c == '\n' ? 'n' : c == '\r' ? 'r' : c == '\t' ? 't' : c;
+        s.remove_prefix(i + 1);
+    }
+    res += '"';
 }
 
 
@@ -571,8 +583,18 @@ static bool hasDynamicDrvDep(const Derivation & drv)
 std::string Derivation::unparse(const StoreDirConfig & store, bool maskOutputs,
     DerivedPathMap<StringSet>::ChildNode::Map * actualInputs) const
 {
+    /* Reserve enough space up front for the strings of the
+       derivation, which are usually dominated by the environment, so
+       that `s` doesn't have to grow while printing them. */
+    size_t estimate = 1024 + builder.size();
+    for (auto & i : args)
+        estimate += i.size() + 3;
+    for (auto & [name, value] : env)
+        estimate += name.size() + value.size() + 8;
+    estimate += (outputs.size() + inputDrvs.map.size() + inputSrcs.size()) * 128;
+
     std::string s;
-    s.reserve(65536);
+    s.reserve(std::max<size_t>(estimate, 65536));
 
     /* Use older unversioned form if possible, for wider compat. Use
        newer form only if we need it, which we do for
@@ -796,12 +818,30 @@ static const DrvHash pathDerivationModulo(Store & store, const StorePath & drvPa
             return h->second;
         }
     }
+    auto cache = getDrvHashCache();
+    if (cache) {
+        try {
+            if (auto h = cache->lookup(store, drvPath)) {
+                drvHashes.lock()->insert_or_assign(drvPath, *h);
+                return *h;
+            }
+        } catch (Error & e) {
+            debug("cannot look up the hash of '%s' in the derivation hash cache: %s", store.printStorePath(drvPath), e.what());
+        }
+    }
     auto h = hashDerivationModulo(
         store,
         store.readInvalidDerivation(drvPath),
         false);
     // Cache it
     drvHashes.lock()->insert_or_assign(drvPath, h);
+    if (cache) {
+        try {
+            cache->upsert(store, drvPath, h);
+        } catch (Error & e) {
+            debug("cannot store the hash of '%s' in the derivation hash cache: %s", store.printStorePath(drvPath), e.what());
+        }
+    }
     return h;
 }
 
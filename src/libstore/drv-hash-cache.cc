@@ -0,0 +1,206 @@
+#include "nix/store/drv-hash-cache.hh"
+#include "nix/store/globals.hh"
+#include "nix/store/store-dir-config.hh"
+#include "nix/store/sqlite.hh"
+#include "nix/util/users.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+static const char * schema = R"sql(
+
+create table if not exists DrvHashes (
+    path      text primary key not null,
+    kind      integer not null,
+    hashes    text not null,
+    timestamp integer not null
+);
+
+create table if not exists LastPurge (
+    dummy     text primary key,
+    value     integer
+);
+
+)sql";
+
+/* How often to purge expired entries from the cache. */
+static constexpr time_t purgeInterval = 24 * 3600;
+
+/* How long to keep an entry. Entries never become wrong, but this
+   keeps the cache from growing without bound. */
+static constexpr time_t entryTtl = 30 * 24 * 3600;
+
+/* How many new entries to collect before writing them in a single
+   transaction. */
+static constexpr size_t maxPending = 1000;
+
+struct DrvHashCache::State
+{
+    SQLite db;
+    SQLiteStmt lookup, upsert;
+
+    /**
+     * Entries that haven't been written to the database yet, by
+     * store path.
+     */
+    std::map<std::string, DrvHash> pending;
+};
+
+DrvHashCache::DrvHashCache(const Path & dbPath)
+    : _state(std::make_unique<Sync<State>>())
+{
+    auto state(_state->lock());
+
+    createDirs(dirOf(dbPath));
+
+    state->db = SQLite(dbPath);
+
+    state->db.isCache();
+
+    state->db.exec(schema);
+
+    state->lookup.create(state->db,
+        "select kind, hashes from DrvHashes where path = ?");
+
+    state->upsert.create(state->db,
+        "insert or replace into DrvHashes(path, kind, hashes, timestamp) values (?, ?, ?, ?)");
+
+    /* Periodically purge expired entries from the database. */
+    retrySQLite<void>([&]() {
+        auto now = time(0);
+
+        SQLiteStmt queryLastPurge(state->db, "select value from LastPurge");
+        auto queryLastPurge_(queryLastPurge.use());
+
+        if (!queryLastPurge_.next() || queryLastPurge_.getInt(0) < now - purgeInterval) {
+            SQLiteStmt(state->db, "delete from DrvHashes where timestamp < ?")
+                .use()(now - entryTtl).exec();
+
+            SQLiteStmt(state->db,
+                "insert or replace into LastPurge(dummy, value) values ('', ?)")
+                .use()(now).exec();
+        }
+    });
+}
+
+DrvHashCache::~DrvHashCache()
+{
+    try {
+        flush();
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+}
+
+/* The hashes are stored as space-separated `<output>:<hash>` pairs.
+   Output names cannot contain spaces or colons. */
+
+std::optional<DrvHash> DrvHashCache::lookup(const StoreDirConfig & store, const StorePath & drvPath)
+{
+    auto path = store.printStorePath(drvPath);
+
+    return retrySQLite<std::optional<DrvHash>>([&]() -> std::optional<DrvHash> {
+        auto state(_state->lock());
+
+        auto i = state->pending.find(path);
+        if (i != state->pending.end()) return i->second;
+
+        auto query(state->lookup.use()(path));
+        if (!query.next()) return std::nullopt;
+
+        DrvHash drvHash{
+            .kind = query.getInt(0) ? DrvHash::Kind::Deferred : DrvHash::Kind::Regular,
+        };
+
+        for (auto & entry : tokenizeString<std::vector<std::string>>(query.getStr(1), " ")) {
+            auto colon = entry.find(':');
+            if (colon == entry.npos) return std::nullopt;
+            drvHash.hashes.insert_or_assign(
+                entry.substr(0, colon),
+                Hash::parseAnyPrefixed(std::string_view(entry).substr(colon + 1)));
+        }
+
+        return drvHash;
+    });
+}
+
+void DrvHashCache::upsert(const StoreDirConfig & store, const StorePath & drvPath, const DrvHash & drvHash)
+{
+    bool full;
+    {
+        auto state(_state->lock());
+        state->pending.insert_or_assign(store.printStorePath(drvPath), drvHash);
+        full = state->pending.size() >= maxPending;
+    }
+    if (full) flush();
+}
+
+void DrvHashCache::flush()
+{
+    retrySQLite<void>([&]() {
+        auto state(_state->lock());
+        if (state->pending.empty()) return;
+
+        auto now = time(0);
+
+        SQLiteTxn txn(state->db);
+
+        for (auto & [path, drvHash] : state->pending) {
+            std::string hashes;
+            for (auto & [outputName, hash] : drvHash.hashes) {
+                if (!hashes.empty()) hashes += ' ';
+                hashes += outputName;
+                hashes += ':';
+                hashes += hash.to_string(HashFormat::Base16, true);
+            }
+
+            state->upsert.use()
+                (path)
+                (drvHash.kind == DrvHash::Kind::Deferred ? 1 : 0)
+                (hashes)
+                (now).exec();
+        }
+
+        txn.commit();
+
+        state->pending.clear();
+    });
+}
+
+/* The cache opened by `getDrvHashCache()`, if any. */
+static std::atomic<DrvHashCache *> openedCache{nullptr};
+
+DrvHashCache * getDrvHashCache()
+{
+    if (!settings.useDrvHashCache) return nullptr;
+
+    /* This is never destroyed, so pending entries are only written by
+       `flushDrvHashCache()` or once `maxPending` is reached. */
+    static DrvHashCache * cache = []() -> DrvHashCache * {
+        try {
+            auto cache = new DrvHashCache(getCacheDir() + "/drv-hashes-v2.sqlite");
+            openedCache = cache;
+            return cache;
+        } catch (Error & e) {
+            warn("cannot open the derivation hash cache: %s", e.what());
+            return nullptr;
+        }
+    }();
+
+    return cache;
+}
+
+void flushDrvHashCache()
+{
+    auto cache = openedCache.load();
+    if (!cache) return;
+    /* This runs during unwinding, so it must not throw, not even
+       `Interrupted`. The entries are simply recomputed next time. */
+    try {
+        cache->flush();
+    } catch (BaseError & e) {
+        debug("cannot write the derivation hash cache: %s", e.what());
+    }
+}
+
+}
@@ -4,6 +4,7 @@
 #include "nix/util/finally.hh"
 #include "nix/util/unix-domain-socket.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/thread-pool.hh"
 #include "nix/store/posix-fs-canonicalise.hh"
 
 #include "store-config-private.hh"
@@ -38,6 +39,10 @@
 namespace nix {
 
 static std::string gcSocketPath = "/gc-socket/socket";
+
+/* Maximum number of dead paths to invalidate in a single database
+   transaction. */
+static constexpr size_t gcInvalidationBatchSize = 256;
 static std::string gcRootsDir = "gcroots";
 
 
@@ -466,9 +471,12 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         // ignore suffixes like '.lock', '.chroot' and '.check'.
         std::unordered_set<std::string> tempRoots;
 
-        // Hash part of the store path currently being deleted, if
-        // any.
-        std::optional<std::string> pending;
+        // Hash parts of the store paths that are currently being
+        // examined or deleted.
+        std::unordered_set<std::string> pending;
+
+        // Number of clients waiting for a pending path.
+        size_t waiters = 0;
     };
 
     Sync<Shared> _shared;
@@ -582,9 +590,11 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                                    done. FIXME: ideally we would use a
                                    FD for this so we don't block the
                                    poll loop. */
-                                while (shared->pending == hashPart) {
+                                while (shared->pending.count(hashPart)) {
                                     debug("synchronising with deletion of path '%s'", path);
+                                    shared->waiters++;
                                     shared.wait(wakeup);
+                                    shared->waiters--;
                                 }
                             } else
                                 printError("received garbage instead of a root from client");
@@ -631,8 +641,12 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
     if (auto p = getEnv("_NIX_TEST_GC_SYNC_2"))
         readFile(*p);
 
-    /* Helper function that deletes a path from the store and throws
-       GCLimitReached if we've deleted enough garbage. */
+    std::mutex resultsMutex;
+    std::atomic<bool> limitReached{false};
+
+    /* Helper function that deletes a path from the store and sets
+       `limitReached` if we've deleted enough garbage. This may be
+       called from multiple threads. */
     auto deleteFromStore = [&](std::string_view baseName)
     {
         Path path = storeDir + "/" + std::string(baseName);
@@ -651,21 +665,155 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
 
         printInfo("deleting '%1%'", path);
 
-        results.paths.insert(path);
-
         uint64_t bytesFreed;
         deleteStorePath(realPath, bytesFreed);
 
+        std::lock_guard lock(resultsMutex);
+
+        results.paths.insert(path);
         results.bytesFreed += bytesFreed;
 
-        if (results.bytesFreed > options.maxFreed) {
+        if (results.bytesFreed > options.maxFreed && !limitReached.exchange(true))
             printInfo("deleted more than %d bytes; stopping", options.maxFreed);
-            throw GCLimitReached();
+    };
+
+    /* Make sure that GC clients don't wait forever for paths that we
+       won't delete anymore (e.g. because of an exception). This must
+       run after the deletion pool has been shut down. */
+    Finally clearPending([&]() {
+        _shared.lock()->pending.clear();
+        wakeup.notify_all();
+    });
+
+    /* Deleting a store path is mostly waiting for the file system, so
+       if `gc-threads` is greater than 1, we let a pool of threads do
+       it while we continue determining which paths are dead. Note
+       that ThreadPool counts the thread that calls process() as one
+       of its threads. */
+    std::optional<ThreadPool> deletionPool;
+    if (shouldDelete && settings.gcThreads > 1)
+        deletionPool.emplace(settings.gcThreads + 1);
+
+    /* The number of deletions that have been handed to the pool but
+       haven't finished yet. We don't let this grow beyond a few per
+       thread, so that the traversal can't get far ahead of the
+       deletions (and of `options.maxFreed`). */
+    struct Deletions
+    {
+        size_t outstanding = 0;
+        bool failed = false;
+    };
+    Sync<Deletions> deletions_;
+    std::condition_variable deletionDone;
+    size_t maxOutstanding = 2 * settings.gcThreads;
+
+    /* Delete `baseName`, either right away or in the deletion pool,
+       and then wake up any client waiting for `hashPart`. */
+    auto scheduleDeletion = [&](std::string baseName, std::optional<std::string> hashPart)
+    {
+        auto work = [&, baseName, hashPart]() {
+            Finally release([&]() {
+                if (!hashPart) return;
+                _shared.lock()->pending.erase(*hashPart);
+                wakeup.notify_all();
+            });
+            /* Another thread may have freed enough in the meantime.
+               An invalidated path that we don't delete is removed by
+               the next GC. */
+            if (limitReached) return;
+            deleteFromStore(baseName);
+        };
+
+        if (!deletionPool)
+            return work();
+
+        {
+            auto deletions(deletions_.lock());
+            while (deletions->outstanding >= maxOutstanding && !deletions->failed)
+                deletions.wait(deletionDone);
+            deletions->outstanding++;
+        }
+
+        try {
+            deletionPool->enqueue([&, work]() {
+                Finally done([&]() {
+                    deletions_.lock()->outstanding--;
+                    deletionDone.notify_all();
+                });
+                try {
+                    work();
+                } catch (...) {
+                    /* The pool won't run any more work, so don't wait
+                       for it. */
+                    deletions_.lock()->failed = true;
+                    throw;
+                }
+            });
+        } catch (ThreadPoolShutDown &) {
+            /* A previous deletion failed, so rethrow its exception. */
+            deletionPool->process();
+            throw;
         }
     };
 
     std::unordered_map<StorePath, StorePathSet> referrersCache;
 
+    /* Dead paths that still have to be invalidated and deleted, in an
+       order where referrers come before the paths they refer to. The
+       hash parts of these paths stay in `pending` until they have
+       been deleted. */
+    std::vector<StorePath> invalidationBatch;
+
+    /* With a limit on the amount to free, we have to check it after
+       every path, so batching would make us overshoot. */
+    size_t batchSize =
+        options.maxFreed == std::numeric_limits<uint64_t>::max()
+        ? gcInvalidationBatchSize
+        : 1;
+
+    /* Invalidate the paths in `invalidationBatch` in a single
+       transaction and then delete them. If we've already freed
+       enough, drop them instead, keeping them valid. */
+    auto flushInvalidations = [&]() {
+        if (invalidationBatch.empty()) return;
+
+        if (limitReached) {
+            {
+                auto shared(_shared.lock());
+                for (auto & path : invalidationBatch)
+                    shared->pending.erase(std::string(path.hashPart()));
+            }
+            wakeup.notify_all();
+            invalidationBatch.clear();
+            return;
+        }
+
+        auto inUse = invalidatePathsChecked(invalidationBatch);
+
+        for (auto & path : invalidationBatch) {
+            auto hashPart = std::string(path.hashPart());
+            if (inUse.count(path)) {
+                // If we end up here, it's likely a new occurrence
+                // of https://github.com/NixOS/nix/issues/11923
+                printError("BUG: cannot delete path '%s' because it is in use", printStorePath(path));
+                _shared.lock()->pending.erase(hashPart);
+                wakeup.notify_all();
+            } else {
+                referrersCache.erase(path);
+                scheduleDeletion(std::string(path.to_string()), std::move(hashPart));
+            }
+        }
+
+        invalidationBatch.clear();
+    };
+
+    /* Delete the remaining dead paths and wait for all deletions to
+       finish. */
+    auto finishDeletions = [&]() {
+        flushInvalidations();
+        if (deletionPool) deletionPool->process();
+    };
+
     /* Helper function that visits all paths reachable from `start`
        via the referrers edges and optionally derivers and derivation
        output edges. If none of those paths are roots, then all
@@ -674,11 +822,16 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         StorePathSet visited;
         std::queue<StorePath> todo;
 
-        /* Wake up any GC client waiting for deletion of the paths in
-           'visited' to finish. */
+        /* Hash parts of the paths in 'visited' that we added to
+           `pending` and that are not going to be deleted. */
+        std::unordered_set<std::string> claimed;
+
+        /* Wake up any GC client waiting for those paths. */
         Finally releasePending([&]() {
+            if (claimed.empty()) return;
             auto shared(_shared.lock());
-            shared->pending.reset();
+            for (auto & hashPart : claimed)
+                shared->pending.erase(hashPart);
             wakeup.notify_all();
         });
 
@@ -733,7 +886,8 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                     debug("cannot delete '%s' because it's a temporary root", printStorePath(*path));
                     return markAlive();
                 }
-                shared->pending = hashPart;
+                shared->pending.insert(hashPart);
+                claimed.insert(std::move(hashPart));
             }
 
             if (isValidPath(*path)) {
@@ -768,19 +922,21 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
             }
         }
         for (auto & path : topoSortPaths(visited)) {
+            /* Paths we don't get to stay valid and are released by
+               `releasePending`. */
+            if (limitReached) break;
             if (!dead.insert(path).second) continue;
             if (shouldDelete) {
-                try {
-                    invalidatePathChecked(path);
-                    deleteFromStore(path.to_string());
-                    referrersCache.erase(path);
-                } catch (PathInUse &e) {
-                    // If we end up here, it's likely a new occurrence
-                    // of https://github.com/NixOS/nix/issues/11923
-                    printError("BUG: %s", e.what());
-                }
+                claimed.erase(std::string(path.hashPart()));
+                invalidationBatch.push_back(path);
+                if (invalidationBatch.size() >= batchSize)
+                    flushInvalidations();
             }
         }
+
+        /* Don't keep GC clients waiting for a full batch. */
+        if (_shared.lock()->waiters)
+            flushInvalidations();
     };
 
     /* Either delete all garbage paths, or just the specified
@@ -789,12 +945,14 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
 
         for (auto & i : options.pathsToDelete) {
             deleteReferrersClosure(i);
-            if (!dead.count(i))
+            if (!dead.count(i)) {
+                finishDeletions();
                 throw Error(
                     "Cannot delete path '%1%' since it is still alive. "
                     "To find out why, use: "
                     "nix-store --query --roots and nix-store --query --referrers",
                     printStorePath(i));
+            }
         }
 
     } else if (options.maxFreed > 0) {
@@ -822,13 +980,19 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                 if (auto storePath = maybeParseStorePath(storeDir + "/" + name))
                     deleteReferrersClosure(*storePath);
                 else
-                    deleteFromStore(name);
+                    scheduleDeletion(name, std::nullopt);
 
+                if (limitReached) throw GCLimitReached();
             }
         } catch (GCLimitReached & e) {
         }
     }
 
+    /* With a deletion pool, this may overshoot `options.maxFreed` by
+       the paths that were already being deleted when the limit was
+       reached. */
+    finishDeletions();
+
     if (options.action == GCOptions::gcReturnLive) {
         for (auto & i : alive)
             results.paths.insert(printStorePath(i));
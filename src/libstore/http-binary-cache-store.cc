@@ -3,6 +3,7 @@
 #include "nix/store/globals.hh"
 #include "nix/store/nar-info-disk-cache.hh"
 #include "nix/util/callback.hh"
+#include "nix/util/signals.hh"
 #include "nix/store/store-registration.hh"
 
 namespace nix {
@@ -203,6 +204,86 @@ protected:
         }
     }
 
+    /**
+     * Fetch the `.narinfo` files of `paths` concurrently. Rather than
+     * blocking a thread per request, keep a window of requests in
+     * flight in the file transfer thread, which multiplexes them over
+     * a few HTTP/2 connections. The window starts at
+     * `http-connections` and grows by one for every response, up to
+     * `max-narinfo-requests`.
+     */
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>> queryPathInfosUncached(const StorePathSet & paths) override
+    {
+        struct State
+        {
+            std::map<StorePath, std::shared_ptr<const ValidPathInfo>> infos;
+            size_t window;
+            size_t inFlight = 0;
+            std::exception_ptr exc;
+        };
+
+        auto maxWindow = std::max<size_t>(1, fileTransferSettings.maxNarInfoRequests);
+
+        Sync<State> state_(State{
+            .window = std::clamp<size_t>(fileTransferSettings.httpConnections, 1, maxWindow),
+        });
+
+        std::condition_variable wakeup;
+
+        auto next = paths.begin();
+
+        while (true) {
+            size_t toIssue;
+
+            {
+                auto state(state_.lock());
+                while (state->inFlight >= state->window
+                    || ((next == paths.end() || state->exc) && state->inFlight))
+                    state.wait(wakeup);
+                if (state->exc) std::rethrow_exception(state->exc);
+                if (next == paths.end()) break;
+                toIssue = state->window - state->inFlight;
+                state->inFlight += toIssue;
+            }
+
+            /* Issue the requests without holding the lock, since the
+               callback may be invoked synchronously. */
+            for (; toIssue; --toIssue) {
+                if (next == paths.end()) {
+                    state_.lock()->inFlight -= toIssue;
+                    break;
+                }
+                /* On interrupt, stop issuing requests but still wait
+                   for the ones in flight, since their callbacks refer
+                   to this stack frame. */
+                try {
+                    checkInterrupt();
+                } catch (...) {
+                    auto state(state_.lock());
+                    state->inFlight -= toIssue;
+                    if (!state->exc) state->exc = std::current_exception();
+                    break;
+                }
+                auto & path = *next++;
+                queryPathInfoUncached(path,
+                    {[path, maxWindow, &state_, &wakeup](std::future<std::shared_ptr<const ValidPathInfo>> fut) {
+                        auto state(state_.lock());
+                        try {
+                            state->infos.insert_or_assign(path, fut.get());
+                            state->window = std::min(maxWindow, state->window + 1);
+                        } catch (...) {
+                            if (!state->exc) state->exc = std::current_exception();
+                        }
+                        assert(state->inFlight);
+                        state->inFlight--;
+                        wakeup.notify_one();
+                    }});
+            }
+        }
+
+        return std::move(state_.lock()->infos);
+    }
+
     std::optional<std::string> getNixCacheInfo() override
     {
         try {
@@ -39,7 +39,11 @@ struct BinaryCacheStoreConfig : virtual StoreConfig
         "Path to a local cache of NARs fetched from this binary cache, used by commands such as `nix store cat`."};
 
     const Setting<bool> parallelCompression{this, false, "parallel-compression",
-        "Enable multi-threaded compression of NARs. This is currently only available for `xz` and `zstd`."};
+        R"(
+          Enable multi-threaded compression of NARs. This is currently only available for `xz` and `zstd`.
+
+          With `zstd`, the NAR is split into blocks that are compressed as independent frames on all available cores.
+        )"};
 
     const Setting<int> compressionLevel{this, -1, "compression-level",
         R"(
@@ -47,6 +51,28 @@ struct BinaryCacheStoreConfig : virtual StoreConfig
           The meaning and accepted values depend on the compression method selected.
           `-1` specifies that the default compression level should be used.
         )"};
+
+    const Setting<bool> chunkedNars{this, false, "chunked-nars",
+        R"(
+          Whether to split NARs into content-defined chunks when uploading them.
+          Every chunk is compressed with the method specified by `compression` and stored as `chunks/<hash>.<ext>`, where `<hash>` is the SHA-256 hash of the uncompressed chunk.
+          The NAR itself is described by a chunk list that the `.narinfo` file refers to.
+          Chunks that are already present in the binary cache are not uploaded again, so similar NARs (such as successive versions of a package) share most of their storage.
+
+          Chunked NARs can only be fetched by clients that support this format.
+        )"};
+
+    const Setting<Path> localChunkCache{this, "", "local-chunk-cache",
+        R"(
+          Path to a local cache of chunks fetched from this binary cache.
+          When fetching a chunked NAR, chunks that are already present in this directory are not downloaded again.
+        )"};
+
+    const Setting<uint64_t> localChunkCacheSize{this, 1024 * 1024 * 1024, "local-chunk-cache-size",
+        R"(
+          Maximum size in bytes of the [`local-chunk-cache`](#store-binary-cache-store-local-chunk-cache).
+          When it grows beyond this, the least recently used chunks are removed.
+        )"};
 };
 
 
@@ -128,6 +154,12 @@ private:
         Source & narSource, RepairFlag repair, CheckSigsFlag checkSigs,
         std::function<ValidPathInfo(HashResult)> mkInfo);
 
+    /**
+     * Write the NAR described by the chunk list `info.url` to `sink`,
+     * fetching the chunks that are not in the local chunk cache.
+     */
+    void narFromChunks(const NarInfo & info, Sink & sink);
+
 public:
 
     bool isValidPathUncached(const StorePath & path) override;
@@ -0,0 +1,75 @@
+#pragma once
+///@file
+
+#include "nix/util/types.hh"
+#include "nix/util/sync.hh"
+
+#include <algorithm>
+
+namespace nix {
+
+/**
+ * A local database of how long derivations took to build, used to
+ * estimate how long future builds will take.
+ *
+ * Builds are identified by the name of the derivation without its
+ * version (see `DrvName`), so that the history of a package carries
+ * over to its new versions.
+ */
+class BuildTimes
+{
+    struct State;
+
+    std::unique_ptr<Sync<State>> _state;
+
+public:
+
+    BuildTimes(const Path & dbPath);
+
+    ~BuildTimes();
+
+    /**
+     * Return the expected build time in seconds of a derivation
+     * named `drvName`, if there is any history for it.
+     */
+    std::optional<uint64_t> lookup(std::string_view drvName);
+
+    /**
+     * Record that a derivation named `drvName` took `seconds` to
+     * build.
+     */
+    void record(std::string_view drvName, uint64_t seconds);
+};
+
+/**
+ * Return the `BuildTimes` database in the user's cache directory.
+ */
+BuildTimes & getBuildTimes();
+
+/**
+ * Return the expected time until `node` and everything waiting
+ * (transitively) on it is done, i.e. `cost(node)` plus the largest
+ * such time of the nodes in `waiters(node)`.
+ *
+ * Results are cached in `memo`, which is a map from (something
+ * constructible from) `Node` to `uint64_t`. Entries stay valid until
+ * the waiters of the node or of any node waiting on it change.
+ */
+template<typename Node, typename Memo, typename Waiters, typename Cost>
+uint64_t criticalPathLength(const Node & node, Memo & memo, const Waiters & waiters, const Cost & cost)
+{
+    auto i = memo.find(node);
+    if (i != memo.end()) return i->second;
+
+    /* Guard against cycles, which shouldn't exist but would
+       otherwise recurse forever. */
+    memo[node] = 0;
+
+    uint64_t longestWaiter = 0;
+    for (auto & waiter : waiters(node))
+        longestWaiter = std::max(longestWaiter, criticalPathLength(waiter, memo, waiters, cost));
+
+    return memo[node] = cost(node) + longestWaiter;
+}
+
+}
@@ -70,6 +70,13 @@ private:
      */
     Goals waitees;
 
+    /**
+     * Forget the cached critical path lengths of this goal and of the
+     * goals it waits for, because the goals waiting on it have
+     * changed.
+     */
+    void invalidateCriticalPath();
+
 public:
     typedef enum {ecBusy, ecSuccess, ecFailed, ecNoSubstituters} ExitCode;
 
@@ -135,6 +135,31 @@ private:
      */
     std::map<StorePath, bool> pathContentsGoodCache;
 
+    /**
+     * Cache of expected build times of derivations, by derivation
+     * name. Used for `critical-path-scheduling`.
+     */
+    std::map<std::string, uint64_t, std::less<>> expectedBuildTimes;
+
+    /**
+     * Return the expected build time in seconds of `goal`, which is
+     * zero for anything but a derivation build.
+     */
+    uint64_t expectedBuildTime(const Goal & goal);
+
+    /**
+     * Cached results of `criticalPathLength()`. Kept across
+     * scheduling rounds and invalidated by
+     * `invalidateCriticalPath()`.
+     */
+    std::map<WeakGoalPtr, uint64_t, std::owner_less<WeakGoalPtr>> criticalPathLengths;
+
+    /**
+     * Return the expected time in seconds until all goals waiting
+     * (transitively) on `goal` are done, including `goal` itself.
+     */
+    uint64_t criticalPathLength(const GoalPtr & goal);
+
 public:
 
     const Activity act;
@@ -253,6 +278,12 @@ public:
      */
     void wakeUp(GoalPtr goal);
 
+    /**
+     * Forget the cached critical path length of `goal`. Return
+     * whether there was one.
+     */
+    bool forgetCriticalPath(const GoalPtr & goal);
+
     /**
      * Return the number of local build processes currently running (but not
      * remote builds via the build hook).
@@ -0,0 +1,60 @@
+#pragma once
+///@file
+
+#include "nix/store/derivations.hh"
+#include "nix/util/sync.hh"
+
+namespace nix {
+
+/**
+ * A persistent cache of the results of `hashDerivationModulo()` for
+ * derivations in the Nix store, so that a new process doesn't have
+ * to read and hash the entire graph of input derivations again.
+ *
+ * Entries are keyed by the full store path of the derivation. Since
+ * `.drv` files are content-addressed, entries never become stale, but
+ * they are purged after a month so that the cache doesn't grow
+ * without bound.
+ *
+ * New entries are kept in memory and written in a single transaction
+ * by `flush()`, which happens when enough of them have accumulated,
+ * when the cache is destroyed, and in `flushDrvHashCache()`.
+ */
+class DrvHashCache
+{
+    struct State;
+
+    std::unique_ptr<Sync<State>> _state;
+
+public:
+
+    DrvHashCache(const Path & dbPath);
+
+    ~DrvHashCache();
+
+    std::optional<DrvHash> lookup(const StoreDirConfig & store, const StorePath & drvPath);
+
+    void upsert(const StoreDirConfig & store, const StorePath & drvPath, const DrvHash & drvHash);
+
+    /**
+     * Write the pending entries to the database.
+     */
+    void flush();
+};
+
+/**
+ * Return the `DrvHashCache` in the user's cache directory, or
+ * `nullptr` if it is disabled (see the `drv-hash-cache` setting) or
+ * cannot be opened.
+ */
+DrvHashCache * getDrvHashCache();
+
+/**
+ * Write the pending entries of the cache returned by
+ * `getDrvHashCache()`, if it has been opened. This is called at the
+ * end of each build, daemon connection and command, since that cache
+ * is never destroyed. It does not throw.
+ */
+void flushDrvHashCache();
+
+}
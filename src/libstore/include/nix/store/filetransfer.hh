@@ -29,6 +29,18 @@ struct FileTransferSettings : Config
         )",
         {"binary-caches-parallel-connections"}};
 
+    Setting<size_t> maxNarInfoRequests{
+        this, 512, "max-narinfo-requests",
+        R"(
+          The maximum number of `.narinfo` files that Nix requests at the
+          same time from an HTTP binary cache when it needs information
+          about many store paths at once, for instance to determine what
+          to substitute. Nix starts with
+          [`http-connections`](#conf-http-connections) concurrent requests
+          and raises the number as responses arrive, up to this limit.
+          With HTTP/2 these requests share a small number of connections.
+        )"};
+
     Setting<unsigned long> connectTimeout{
         this, 5, "connect-timeout",
         R"(
@@ -151,6 +151,22 @@ public:
         )",
         {"substitution-max-jobs"}};
 
+    Setting<bool> criticalPathScheduling{
+        this, false, "critical-path-scheduling",
+        R"(
+          If set to `true`, Nix records how long each derivation takes to
+          build, and when more derivations are ready to build than there
+          are build slots (see [`max-jobs`](#conf-max-jobs)), it starts
+          the ones on the longest remaining chain of dependent builds
+          first. This reduces the total time of large builds whose
+          critical path goes through a few slow derivations.
+
+          Build times are kept in the user's cache directory and are
+          keyed by the derivation name without its version, so the
+          history of a package carries over to its new versions.
+          Derivations without any history are assumed to take one minute.
+        )"};
+
     Setting<unsigned int> buildCores{
         this,
         0,
@@ -404,6 +420,15 @@ public:
     Setting<bool> useSQLiteWAL{this, !isWSL1(), "use-sqlite-wal",
         "Whether SQLite should use WAL mode."};
 
+    Setting<bool> useDrvHashCache{this, true, "drv-hash-cache",
+        R"(
+          Whether to keep the hashes of derivations that Nix computes to
+          determine output paths (the "hash modulo" of a derivation) in a
+          persistent cache in the user's cache directory. This saves
+          reading and hashing the entire graph of input derivations again
+          in every Nix process. Entries are removed after 30 days.
+        )"};
+
 #ifndef _WIN32
     // FIXME: remove this option, `fsync-store-paths` is faster.
     Setting<bool> syncBeforeRegistering{this, false, "sync-before-registering",
@@ -1139,6 +1164,17 @@ public:
     Setting<uint64_t> minFreeCheckInterval{this, 5, "min-free-check-interval",
         "Number of seconds between checking free disk space."};
 
+    Setting<unsigned int> gcThreads{
+        this, 1, "gc-threads",
+        R"(
+          The number of threads the garbage collector uses to delete
+          dead store paths. With the default of `1`, each path is deleted
+          right after it has been found to be dead. Higher values let
+          deletions proceed in parallel with each other and with the
+          search for more garbage, which speeds up garbage collection on
+          storage that handles concurrent requests well.
+        )"};
+
     Setting<size_t> narBufferSize{this, 32 * 1024 * 1024, "nar-buffer-size",
         "Maximum size of NARs before spilling them to disk."};
 
@@ -7,6 +7,7 @@
 #include "nix/store/store-api.hh"
 #include "nix/store/indirect-root-store.hh"
 #include "nix/util/sync.hh"
+#include "nix/util/pool.hh"
 
 #include <chrono>
 #include <future>
@@ -32,6 +33,12 @@ struct OptimiseStats
 {
     unsigned long filesLinked = 0;
     uint64_t bytesFreed = 0;
+
+    /**
+     * Files that could have been linked but weren't, e.g. because
+     * the link count limit was reached. A later run may link them.
+     */
+    unsigned long filesSkipped = 0;
 };
 
 struct LocalBuildStoreConfig : virtual LocalFSStoreConfig
@@ -124,7 +131,10 @@ private:
      */
     AutoCloseFD globalLock;
 
-    struct State
+    /**
+     * A connection to the Nix database and its prepared statements.
+     */
+    struct DBState
     {
         /**
          * The SQLite database object.
@@ -133,6 +143,10 @@ private:
 
         struct Stmts;
         std::unique_ptr<Stmts> stmts;
+    };
+
+    struct State : DBState
+    {
 
         /**
          * The last time we checked whether to do an auto-GC, or an
@@ -160,6 +174,14 @@ private:
 
     Sync<State> _state;
 
+    /**
+     * Read-only connections to the database, used to answer metadata
+     * queries concurrently with each other and with writes through
+     * `_state`. Only set if the database is in WAL mode, since
+     * otherwise readers would block on the writer anyway.
+     */
+    std::unique_ptr<Pool<DBState>> readPool;
+
 public:
 
     const Path dbDir;
@@ -188,6 +210,15 @@ public:
 
     ~LocalStore();
 
+    /**
+     * The number of connections in the read pool, whether idle or in
+     * use, or 0 if there is no pool.
+     */
+    size_t readConnections()
+    {
+        return readPool ? readPool->count() : 0;
+    }
+
     /**
      * Implementations of abstract store API methods.
      */
@@ -396,7 +427,25 @@ private:
 
     void makeStoreWritable();
 
-    uint64_t queryValidPathId(State & state, const StorePath & path);
+    /**
+     * Open a read-only connection for `readPool`.
+     */
+    ref<DBState> openReadConnection();
+
+    /**
+     * Prepare the statements used by read-only queries.
+     */
+    void prepareReadStatements(DBState & state);
+
+    /**
+     * Run the read-only query `fun` on a connection from `readPool`,
+     * or on the main connection if there is no pool. Like the callers
+     * of `_state`, it retries if the database is busy.
+     */
+    template<typename T, typename F>
+    T readDB(F && fun);
+
+    uint64_t queryValidPathId(DBState & state, const StorePath & path);
 
     uint64_t addValidPath(State & state, const ValidPathInfo & info, bool checkOutputs = true);
 
@@ -407,7 +456,15 @@ private:
      */
     void invalidatePathChecked(const StorePath & path);
 
-    std::shared_ptr<const ValidPathInfo> queryPathInfoInternal(State & state, const StorePath & path);
+    /**
+     * Delete several paths from the Nix store in a single
+     * transaction. `paths` must be ordered such that referrers come
+     * before the paths they refer to. Paths that are still referenced
+     * by valid paths are left alone and returned.
+     */
+    StorePathSet invalidatePathsChecked(const std::vector<StorePath> & paths);
+
+    std::shared_ptr<const ValidPathInfo> queryPathInfoInternal(DBState & state, const StorePath & path);
 
     void updatePathInfo(State & state, const ValidPathInfo & info);
 
@@ -425,12 +482,20 @@ private:
     typedef std::unordered_set<ino_t> InodeHash;
 
     InodeHash loadInodeHash();
-    Strings readDirectoryIgnoringInodes(const Path & path, const InodeHash & inodeHash);
-    void optimisePath_(Activity * act, OptimiseStats & stats, const Path & path, InodeHash & inodeHash, RepairFlag repair);
+    Strings readDirectoryIgnoringInodes(const Path & path, SharedSync<InodeHash> & inodeHash);
+    void optimisePath_(Activity * act, OptimiseStats & stats, const Path & path, SharedSync<InodeHash> & inodeHash, RepairFlag repair);
+
+    /**
+     * Return the valid paths that have been fully optimised by
+     * `optimiseStore()`.
+     */
+    StorePathSet queryOptimisedPaths();
+
+    void markPathsOptimised(const std::vector<StorePath> & paths);
 
     // Internal versions that are not wrapped in retry_sqlite.
-    bool isValidPath_(State & state, const StorePath & path);
-    void queryReferrers(State & state, const StorePath & path, StorePathSet & referrers);
+    bool isValidPath_(DBState & state, const StorePath & path);
+    void queryReferrers(DBState & state, const StorePath & path, StorePathSet & referrers);
 
     void addBuildLog(const StorePath & drvPath, std::string_view log) override;
 
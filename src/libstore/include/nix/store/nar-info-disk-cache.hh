@@ -33,6 +33,15 @@ public:
         const std::string & uri, const std::string & hashPart,
         std::shared_ptr<const ValidPathInfo> info) = 0;
 
+    /**
+     * Like `upsertNarInfo()`, but for many paths at once, in a single
+     * transaction. Each entry is a hash part and the corresponding
+     * info, or `nullptr` if the path is known to be missing.
+     */
+    virtual void upsertNarInfos(
+        const std::string & uri,
+        const std::vector<std::pair<std::string, std::shared_ptr<const ValidPathInfo>>> & infos) = 0;
+
     virtual void upsertRealisation(
         const std::string & uri,
         const Realisation & realisation) = 0;
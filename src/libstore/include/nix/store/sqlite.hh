@@ -30,6 +30,12 @@ enum class SQLiteOpenMode {
      * Fails with an error if the database does not exist.
      */
     Immutable,
+    /**
+     * Open the database in read-only mode, while still taking part
+     * in locking, so that changes by other connections are seen.
+     * Fails with an error if the database does not exist.
+     */
+    ReadOnly,
 };
 
 /**
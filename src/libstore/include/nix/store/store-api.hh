@@ -328,6 +328,14 @@ public:
      */
     std::optional<std::shared_ptr<const ValidPathInfo>> queryPathInfoFromClientCache(const StorePath & path);
 
+    /**
+     * Query information about several paths at once. Paths that are
+     * not valid are mapped to `nullptr`. Like queryPathInfo(), this
+     * uses and updates the path info caches, so it can be used to
+     * prefetch the information about a set of paths.
+     */
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>> queryPathInfos(const StorePathSet & paths);
+
     /**
      * Query the information about a realisation.
      */
@@ -365,6 +373,13 @@ protected:
 
     virtual void queryPathInfoUncached(const StorePath & path,
         Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept = 0;
+
+    /**
+     * Batched version of queryPathInfoUncached(). The default
+     * implementation queries the paths in parallel; stores that can
+     * query many paths in a single request should override it.
+     */
+    virtual std::map<StorePath, std::shared_ptr<const ValidPathInfo>> queryPathInfosUncached(const StorePathSet & paths);
     virtual void queryRealisationUncached(const DrvOutput &,
         Callback<std::shared_ptr<const Realisation>> callback) noexcept = 0;
 
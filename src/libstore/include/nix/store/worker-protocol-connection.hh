@@ -111,6 +111,14 @@ struct WorkerProto::BasicClientConnection : WorkerProto::BasicConnection
 
     UnkeyedValidPathInfo queryPathInfo(const StoreDirConfig & store, bool * daemonException, const StorePath & path);
 
+    /**
+     * Query the info about several paths in a single request. Paths
+     * that are not valid are mapped to `nullptr`. Requires
+     * `WorkerProto::featureQueryPathInfos`.
+     */
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>> queryPathInfos(
+        const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths);
+
     void putBuildDerivationRequest(
         const StoreDirConfig & store,
         bool * daemonException,
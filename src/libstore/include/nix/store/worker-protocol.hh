@@ -138,6 +138,11 @@ struct WorkerProto
     using FeatureSet = std::set<Feature, std::less<>>;
 
     static const FeatureSet allFeatures;
+
+    /**
+     * The daemon supports `Op::QueryPathInfos`.
+     */
+    static constexpr std::string_view featureQueryPathInfos = "query-path-infos";
 };
 
 enum struct WorkerProto::Op : uint64_t
@@ -186,6 +191,7 @@ enum struct WorkerProto::Op : uint64_t
     AddBuildLog = 45,
     BuildPathsWithResults = 46,
     AddPermRoot = 47,
+    QueryPathInfos = 48, // requires WorkerProto::featureQueryPathInfos
 };
 
 struct WorkerProto::ClientHandshakeInfo
@@ -26,6 +26,7 @@
 
 #include <memory>
 #include <new>
+#include <thread>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -92,7 +93,7 @@ ref<Store> LocalStore::Config::openStore() const
     return make_ref<LocalStore>(ref{shared_from_this()});
 }
 
-struct LocalStore::State::Stmts {
+struct LocalStore::DBState::Stmts {
     /* Some precompiled SQLite statements. */
     SQLiteStmt RegisterValidPath;
     SQLiteStmt UpdatePathInfo;
@@ -112,6 +113,8 @@ struct LocalStore::State::Stmts {
     SQLiteStmt QueryValidPaths;
     SQLiteStmt QueryRealisationReferences;
     SQLiteStmt AddRealisationReference;
+    SQLiteStmt QueryOptimisedPaths;
+    SQLiteStmt MarkPathOptimised;
 };
 
 LocalStore::LocalStore(ref<const Config> config)
@@ -324,12 +327,7 @@ LocalStore::LocalStore(ref<const Config> config)
         "update ValidPaths set narSize = ?, hash = ?, ultimate = ?, sigs = ?, ca = ? where path = ?;");
     state->stmts->AddReference.create(state->db,
         "insert or replace into Refs (referrer, reference) values (?, ?);");
-    state->stmts->QueryPathInfo.create(state->db,
-        "select id, hash, registrationTime, deriver, narSize, ultimate, sigs, ca from ValidPaths where path = ?;");
-    state->stmts->QueryReferences.create(state->db,
-        "select path from Refs join ValidPaths on reference = id where referrer = ?;");
-    state->stmts->QueryReferrers.create(state->db,
-        "select path from Refs join ValidPaths on referrer = id where reference = (select id from ValidPaths where path = ?);");
+    prepareReadStatements(*state);
     state->stmts->InvalidatePath.create(state->db,
         "delete from ValidPaths where path = ?;");
     state->stmts->AddDerivationOutput.create(state->db,
@@ -343,6 +341,12 @@ LocalStore::LocalStore(ref<const Config> config)
     state->stmts->QueryPathFromHashPart.create(state->db,
         "select path from ValidPaths where path >= ? limit 1;");
     state->stmts->QueryValidPaths.create(state->db, "select path from ValidPaths");
+    if (!config->readOnly) {
+        state->stmts->QueryOptimisedPaths.create(state->db,
+            "select v.path from OptimisedPaths o join ValidPaths v on o.id = v.id;");
+        state->stmts->MarkPathOptimised.create(state->db,
+            "insert or ignore into OptimisedPaths (id) select id from ValidPaths where path = ?;");
+    }
     if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations)) {
         state->stmts->RegisterRealisedOutput.create(state->db,
             R"(
@@ -387,6 +391,49 @@ LocalStore::LocalStore(ref<const Config> config)
                     (select id from Realisations where drvPath = ? and outputName = ?));
             )");
     }
+
+    /* In WAL mode, readers don't block the writer or each other, so
+       answer metadata queries from a pool of read-only connections
+       rather than serialising them on the main connection. */
+    if (settings.useSQLiteWAL && !config->readOnly)
+        readPool = std::make_unique<Pool<DBState>>(
+            std::max(1U, std::thread::hardware_concurrency()),
+            [this]() { return openReadConnection(); });
+}
+
+
+void LocalStore::prepareReadStatements(DBState & state)
+{
+    state.stmts->QueryPathInfo.create(state.db,
+        "select id, hash, registrationTime, deriver, narSize, ultimate, sigs, ca from ValidPaths where path = ?;");
+    state.stmts->QueryReferences.create(state.db,
+        "select path from Refs join ValidPaths on reference = id where referrer = ?;");
+    state.stmts->QueryReferrers.create(state.db,
+        "select path from Refs join ValidPaths on referrer = id where reference = (select id from ValidPaths where path = ?);");
+}
+
+
+ref<LocalStore::DBState> LocalStore::openReadConnection()
+{
+    auto conn = make_ref<DBState>();
+    conn->db = SQLite(dbDir + "/db.sqlite", SQLiteOpenMode::ReadOnly);
+    conn->stmts = std::make_unique<DBState::Stmts>();
+    prepareReadStatements(*conn);
+    return conn;
+}
+
+
+template<typename T, typename F>
+T LocalStore::readDB(F && fun)
+{
+    return retrySQLite<T>([&]() {
+        if (readPool) {
+            auto conn(readPool->get());
+            return fun(*conn);
+        }
+        auto state(_state.lock());
+        return fun(*state);
+    });
 }
 
 
@@ -570,6 +617,13 @@ void LocalStore::upgradeDBSchema(State & state)
             "20220326-ca-derivations",
             #include "ca-specific-schema.sql.gen.hh"
             );
+
+    /* Paths that have been fully processed by optimiseStore(). */
+    if (!config->readOnly)
+        doUpgrade(
+            "20261018-optimised-paths",
+            "create table if not exists OptimisedPaths (id integer primary key not null, "
+            "foreign key (id) references ValidPaths(id) on delete cascade)");
 }
 
 
@@ -726,16 +780,15 @@ void LocalStore::queryPathInfoUncached(const StorePath & path,
     Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept
 {
     try {
-        callback(retrySQLite<std::shared_ptr<const ValidPathInfo>>([&]() {
-            auto state(_state.lock());
-            return queryPathInfoInternal(*state, path);
+        callback(readDB<std::shared_ptr<const ValidPathInfo>>([&](DBState & state) {
+            return queryPathInfoInternal(state, path);
         }));
 
     } catch (...) { callback.rethrow(); }
 }
 
 
-std::shared_ptr<const ValidPathInfo> LocalStore::queryPathInfoInternal(State & state, const StorePath & path)
+std::shared_ptr<const ValidPathInfo> LocalStore::queryPathInfoInternal(DBState & state, const StorePath & path)
 {
     /* Get the path info. */
     auto useQueryPathInfo(state.stmts->QueryPathInfo.use()(printStorePath(path)));
@@ -796,7 +849,7 @@ void LocalStore::updatePathInfo(State & state, const ValidPathInfo & info)
 }
 
 
-uint64_t LocalStore::queryValidPathId(State & state, const StorePath & path)
+uint64_t LocalStore::queryValidPathId(DBState & state, const StorePath & path)
 {
     auto use(state.stmts->QueryPathInfo.use()(printStorePath(path)));
     if (!use.next())
@@ -805,7 +858,7 @@ uint64_t LocalStore::queryValidPathId(State & state, const StorePath & path)
 }
 
 
-bool LocalStore::isValidPath_(State & state, const StorePath & path)
+bool LocalStore::isValidPath_(DBState & state, const StorePath & path)
 {
     return state.stmts->QueryPathInfo.use()(printStorePath(path)).next();
 }
@@ -813,9 +866,8 @@ bool LocalStore::isValidPath_(State & state, const StorePath & path)
 
 bool LocalStore::isValidPathUncached(const StorePath & path)
 {
-    return retrySQLite<bool>([&]() {
-        auto state(_state.lock());
-        return isValidPath_(*state, path);
+    return readDB<bool>([&](DBState & state) {
+        return isValidPath_(state, path);
     });
 }
 
@@ -841,7 +893,31 @@ StorePathSet LocalStore::queryAllValidPaths()
 }
 
 
-void LocalStore::queryReferrers(State & state, const StorePath & path, StorePathSet & referrers)
+StorePathSet LocalStore::queryOptimisedPaths()
+{
+    return retrySQLite<StorePathSet>([&]() {
+        auto state(_state.lock());
+        auto use(state->stmts->QueryOptimisedPaths.use());
+        StorePathSet res;
+        while (use.next()) res.insert(parseStorePath(use.getStr(0)));
+        return res;
+    });
+}
+
+
+void LocalStore::markPathsOptimised(const std::vector<StorePath> & paths)
+{
+    retrySQLite<void>([&]() {
+        auto state(_state.lock());
+        SQLiteTxn txn(state->db);
+        for (auto & path : paths)
+            state->stmts->MarkPathOptimised.use()(printStorePath(path)).exec();
+        txn.commit();
+    });
+}
+
+
+void LocalStore::queryReferrers(DBState & state, const StorePath & path, StorePathSet & referrers)
 {
     auto useQueryReferrers(state.stmts->QueryReferrers.use()(printStorePath(path)));
 
@@ -852,9 +928,8 @@ void LocalStore::queryReferrers(State & state, const StorePath & path, StorePath
 
 void LocalStore::queryReferrers(const StorePath & path, StorePathSet & referrers)
 {
-    return retrySQLite<void>([&]() {
-        auto state(_state.lock());
-        queryReferrers(*state, path, referrers);
+    return readDB<void>([&](DBState & state) {
+        queryReferrers(state, path, referrers);
     });
 }
 
@@ -1372,6 +1447,35 @@ void LocalStore::invalidatePathChecked(const StorePath & path)
 }
 
 
+StorePathSet LocalStore::invalidatePathsChecked(const std::vector<StorePath> & paths)
+{
+    return retrySQLite<StorePathSet>([&]() {
+        auto state(_state.lock());
+
+        SQLiteTxn txn(state->db);
+
+        StorePathSet inUse;
+
+        for (auto & path : paths) {
+            if (!isValidPath_(*state, path)) continue;
+            StorePathSet referrers; queryReferrers(*state, path, referrers);
+            referrers.erase(path); /* ignore self-references */
+            if (!referrers.empty()) {
+                debug("cannot delete path '%s' because it is in use by %s",
+                    printStorePath(path), showPaths(referrers));
+                inUse.insert(path);
+                continue;
+            }
+            invalidatePath(*state, path);
+        }
+
+        txn.commit();
+
+        return inUse;
+    });
+}
+
+
 bool LocalStore::verifyStore(bool checkContents, RepairFlag repair)
 {
     printInfo("reading the Nix store...");
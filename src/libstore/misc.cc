@@ -290,6 +290,22 @@ MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets)
                 state->res.narSize += info->second.narSize;
             }
 
+            /* Query the substituters about all references at once
+               rather than one at a time as they are processed, so
+               that their info is fetched concurrently. */
+            StorePathCAMap refs;
+            {
+                auto state(state_.lock());
+                for (auto & ref : info->second.references)
+                    if (!state->done.contains(DerivedPath(DerivedPath::Opaque { ref }).to_string(*this)))
+                        refs.emplace(ref, std::nullopt);
+            }
+            std::erase_if(refs, [&](auto & ref) { return isValidPath(ref.first); });
+            if (refs.size() > 1) {
+                SubstitutablePathInfos refInfos;
+                querySubstitutablePathInfos(refs, refInfos);
+            }
+
             for (auto & ref : info->second.references)
                 pool.enqueue(std::bind(doPath, DerivedPath::Opaque { ref }));
           },
@@ -314,43 +314,67 @@ public:
         });
     }
 
+    void insertNarInfo(
+        State & state, const Cache & cache, const std::string & hashPart,
+        const std::shared_ptr<const ValidPathInfo> & info)
+    {
+        if (info) {
+
+            auto narInfo = std::dynamic_pointer_cast<const NarInfo>(info);
+
+            //assert(hashPart == storePathToHash(info->path));
+
+            state.insertNAR.use()
+                (cache.id)
+                (hashPart)
+                (std::string(info->path.name()))
+                (narInfo ? narInfo->url : "", narInfo != 0)
+                (narInfo ? narInfo->compression : "", narInfo != 0)
+                (narInfo && narInfo->fileHash ? narInfo->fileHash->to_string(HashFormat::Nix32, true) : "", narInfo && narInfo->fileHash)
+                (narInfo ? narInfo->fileSize : 0, narInfo != 0 && narInfo->fileSize)
+                (info->narHash.to_string(HashFormat::Nix32, true))
+                (info->narSize)
+                (concatStringsSep(" ", info->shortRefs()))
+                (info->deriver ? std::string(info->deriver->to_string()) : "", (bool) info->deriver)
+                (concatStringsSep(" ", info->sigs))
+                (renderContentAddress(info->ca))
+                (time(0)).exec();
+
+        } else {
+            state.insertMissingNAR.use()
+                (cache.id)
+                (hashPart)
+                (time(0)).exec();
+        }
+    }
+
     void upsertNarInfo(
         const std::string & uri, const std::string & hashPart,
         std::shared_ptr<const ValidPathInfo> info) override
     {
+        retrySQLite<void>([&]() {
+            auto state(_state.lock());
+            insertNarInfo(*state, getCache(*state, uri), hashPart, info);
+        });
+    }
+
+    void upsertNarInfos(
+        const std::string & uri,
+        const std::vector<std::pair<std::string, std::shared_ptr<const ValidPathInfo>>> & infos) override
+    {
+        if (infos.empty()) return;
+
         retrySQLite<void>([&]() {
             auto state(_state.lock());
 
             auto & cache(getCache(*state, uri));
 
-            if (info) {
-
-                auto narInfo = std::dynamic_pointer_cast<const NarInfo>(info);
-
-                //assert(hashPart == storePathToHash(info->path));
-
-                state->insertNAR.use()
-                    (cache.id)
-                    (hashPart)
-                    (std::string(info->path.name()))
-                    (narInfo ? narInfo->url : "", narInfo != 0)
-                    (narInfo ? narInfo->compression : "", narInfo != 0)
-                    (narInfo && narInfo->fileHash ? narInfo->fileHash->to_string(HashFormat::Nix32, true) : "", narInfo && narInfo->fileHash)
-                    (narInfo ? narInfo->fileSize : 0, narInfo != 0 && narInfo->fileSize)
-                    (info->narHash.to_string(HashFormat::Nix32, true))
-                    (info->narSize)
-                    (concatStringsSep(" ", info->shortRefs()))
-                    (info->deriver ? std::string(info->deriver->to_string()) : "", (bool) info->deriver)
-                    (concatStringsSep(" ", info->sigs))
-                    (renderContentAddress(info->ca))
-                    (time(0)).exec();
-
-            } else {
-                state->insertMissingNAR.use()
-                    (cache.id)
-                    (hashPart)
-                    (time(0)).exec();
-            }
+            SQLiteTxn txn(state->db);
+
+            for (auto & [hashPart, info] : infos)
+                insertNarInfo(*state, cache, hashPart, info);
+
+            txn.commit();
         });
     }
 
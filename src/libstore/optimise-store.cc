@@ -3,6 +3,7 @@
 #include "nix/util/signals.hh"
 #include "nix/store/posix-fs-canonicalise.hh"
 #include "nix/util/posix-source-accessor.hh"
+#include "nix/util/thread-pool.hh"
 
 #include <cstdlib>
 #include <cstring>
@@ -12,6 +13,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <regex>
+#include <atomic>
 
 #include "store-config-private.hh"
 
@@ -64,7 +66,7 @@ LocalStore::InodeHash LocalStore::loadInodeHash()
 }
 
 
-Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, const InodeHash & inodeHash)
+Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, SharedSync<InodeHash> & inodeHash)
 {
     Strings names;
 
@@ -75,7 +77,7 @@ Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, const InodeHa
     while (errno = 0, dirent = readdir(dir.get())) { /* sic */
         checkInterrupt();
 
-        if (inodeHash.count(dirent->d_ino)) {
+        if (inodeHash.readLock()->count(dirent->d_ino)) {
             debug("'%1%' is already linked", dirent->d_name);
             continue;
         }
@@ -91,7 +93,7 @@ Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, const InodeHa
 
 
 void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
-    const Path & path, InodeHash & inodeHash, RepairFlag repair)
+    const Path & path, SharedSync<InodeHash> & inodeHash, RepairFlag repair)
 {
     checkInterrupt();
 
@@ -131,11 +133,12 @@ void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
        those files.  FIXME: check the modification time. */
     if (S_ISREG(st.st_mode) && (st.st_mode & S_IWUSR)) {
         warn("skipping suspicious writable file '%1%'", path);
+        stats.filesSkipped++;
         return;
     }
 
     /* This can still happen on top-level files. */
-    if (st.st_nlink > 1 && inodeHash.count(st.st_ino)) {
+    if (st.st_nlink > 1 && inodeHash.readLock()->count(st.st_ino)) {
         debug("'%s' is already linked, with %d other file(s)", path, st.st_nlink - 2);
         return;
     }
@@ -181,7 +184,7 @@ void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
         /* Nope, create a hard link in the links directory. */
         try {
             std::filesystem::create_hard_link(path, linkPath);
-            inodeHash.insert(st.st_ino);
+            inodeHash.lock()->insert(st.st_ino);
         } catch (std::filesystem::filesystem_error & e) {
             if (e.code() == std::errc::file_exists) {
                 /* Fall through if another process created ‘linkPath’ before
@@ -194,6 +197,7 @@ void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
                    just effectively disable deduplication of this
                    file.  */
                 printInfo("cannot link '%s' to '%s': %s", linkPath, path, strerror(errno));
+                stats.filesSkipped++;
                 return;
             }
 
@@ -223,11 +227,14 @@ void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
        its timestamp back to 0. */
     MakeReadOnly makeReadOnly(mustToggle ? dirOfPath : "");
 
-    std::filesystem::path tempLink = fmt("%1%/.tmp-link-%2%-%3%", config->realStoreDir, getpid(), rand());
+    /* Use a counter rather than rand(), which is not thread-safe, to
+       make the name unique within this process. */
+    static std::atomic<uint64_t> tempLinkCounter{0};
+    std::filesystem::path tempLink = fmt("%1%/.tmp-link-%2%-%3%", config->realStoreDir, getpid(), tempLinkCounter++);
 
     try {
         std::filesystem::create_hard_link(linkPath, tempLink);
-        inodeHash.insert(st.st_ino);
+        inodeHash.lock()->insert(st.st_ino);
     } catch (std::filesystem::filesystem_error & e) {
         if (e.code() == std::errc::too_many_links) {
             /* Too many links to the same file (>= 32000 on most file
@@ -235,6 +242,7 @@ void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
                Just shrug and ignore. */
             if (st.st_size)
                 printInfo("'%1%' has maximum number of links", linkPath);
+            stats.filesSkipped++;
             return;
         }
         throw;
@@ -252,6 +260,7 @@ void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
                temporarily increases the st_nlink field before
                decreasing it again.) */
             debug("'%s' has reached maximum number of links", linkPath);
+            stats.filesSkipped++;
             return;
         }
         throw;
@@ -273,23 +282,78 @@ void LocalStore::optimiseStore(OptimiseStats & stats)
 {
     Activity act(*logger, actOptimiseStore);
 
+    /* Store paths are immutable, so paths that have been optimised by
+       a previous run don't have to be looked at again. Any files
+       added to the store since then that have the same contents are
+       linked when the new paths are optimised. */
     auto paths = queryAllValidPaths();
-    InodeHash inodeHash = loadInodeHash();
+    auto optimised = queryOptimisedPaths();
+    std::erase_if(paths, [&](const StorePath & path) { return optimised.count(path); });
+    debug("%d paths have already been optimised", optimised.size());
+
+    SharedSync<InodeHash> inodeHash(loadInodeHash());
 
     act.progress(0, paths.size());
 
-    uint64_t done = 0;
+    std::atomic<uint64_t> done = 0;
 
-    for (auto & i : paths) {
-        addTempRoot(i);
-        if (!isValidPath(i)) continue; /* path was GC'ed, probably */
+    struct State
+    {
+        OptimiseStats stats;
+        std::vector<StorePath> optimised;
+    };
+
+    Sync<State> state_;
+
+    /* Record the paths that we're done with. */
+    auto flushOptimised = [&](size_t threshold) {
+        std::vector<StorePath> batch;
         {
-            Activity act(*logger, lvlTalkative, actUnknown, fmt("optimising path '%s'", printStorePath(i)));
-            optimisePath_(&act, stats, config->realStoreDir + "/" + std::string(i.to_string()), inodeHash, NoRepair);
+            auto state(state_.lock());
+            if (state->optimised.size() < threshold) return;
+            std::swap(batch, state->optimised);
         }
-        done++;
-        act.progress(done, paths.size());
+        if (!batch.empty()) markPathsOptimised(batch);
+    };
+
+    /* Hashing files is CPU-bound, so process store paths in
+       parallel. Paths are processed independently; files in
+       different paths that have the same contents are coordinated
+       through the links directory. */
+    ThreadPool pool;
+
+    for (auto & i : paths) {
+        pool.enqueue([&, path(i)]() {
+            addTempRoot(path);
+            if (!isValidPath(path)) return; /* path was GC'ed, probably */
+            OptimiseStats pathStats;
+            {
+                Activity act(*logger, lvlTalkative, actUnknown, fmt("optimising path '%s'", printStorePath(path)));
+                optimisePath_(&act, pathStats, config->realStoreDir + "/" + std::string(path.to_string()), inodeHash, NoRepair);
+            }
+            {
+                auto state(state_.lock());
+                state->stats.filesLinked += pathStats.filesLinked;
+                state->stats.bytesFreed += pathStats.bytesFreed;
+                state->stats.filesSkipped += pathStats.filesSkipped;
+                /* Only remember the path if all its files were
+                   handled, so that a later run retries the others. */
+                if (!pathStats.filesSkipped)
+                    state->optimised.push_back(path);
+            }
+            flushOptimised(1000);
+            act.progress(++done, paths.size());
+        });
     }
+
+    pool.process();
+
+    flushOptimised(0);
+
+    auto state(state_.lock());
+    stats.filesLinked += state->stats.filesLinked;
+    stats.bytesFreed += state->stats.bytesFreed;
+    stats.filesSkipped += state->stats.filesSkipped;
 }
 
 void LocalStore::optimiseStore()
@@ -306,7 +370,7 @@ void LocalStore::optimiseStore()
 void LocalStore::optimisePath(const Path & path, RepairFlag repair)
 {
     OptimiseStats stats;
-    InodeHash inodeHash;
+    SharedSync<InodeHash> inodeHash;
 
     if (settings.autoOptimiseStore) optimisePath_(nullptr, stats, path, inodeHash, repair);
 }
@@ -287,6 +287,58 @@ void RemoteStore::queryPathInfoUncached(const StorePath & path,
 }
 
 
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>> RemoteStore::queryPathInfosUncached(const StorePathSet & paths)
+{
+    {
+        auto conn(getConnection());
+        if (conn->features.contains(WorkerProto::featureQueryPathInfos))
+            return conn->queryPathInfos(*this, &conn.daemonException, paths);
+    }
+    return Store::queryPathInfosUncached(paths);
+}
+
+
+void RemoteStore::computeFSClosure(const StorePathSet & startPaths,
+    StorePathSet & paths, bool flipDirection, bool includeOutputs, bool includeDerivers)
+{
+    /* If the daemon supports it, walk the references breadth-first,
+       querying each level of the closure in a single request. This
+       is much faster than one request per path over high-latency
+       connections. */
+    if (flipDirection || includeOutputs
+        || !getConnection()->features.contains(WorkerProto::featureQueryPathInfos))
+        return Store::computeFSClosure(startPaths, paths, flipDirection, includeOutputs, includeDerivers);
+
+    StorePathSet todo;
+    for (auto & path : startPaths)
+        if (paths.insert(path).second)
+            todo.insert(path);
+
+    while (!todo.empty()) {
+        checkInterrupt();
+
+        StorePathSet next;
+        StorePathSet derivers;
+
+        for (auto & [path, info] : queryPathInfos(todo)) {
+            if (!info)
+                throw InvalidPath("path '%s' is not valid", printStorePath(path));
+            for (auto & ref : info->references)
+                if (paths.insert(ref).second)
+                    next.insert(ref);
+            if (includeDerivers && info->deriver && !paths.contains(*info->deriver))
+                derivers.insert(*info->deriver);
+        }
+
+        for (auto & deriver : queryValidPaths(derivers))
+            if (paths.insert(deriver).second)
+                next.insert(deriver);
+
+        todo = std::move(next);
+    }
+}
+
+
 void RemoteStore::queryReferrers(const StorePath & path,
     StorePathSet & referrers)
 {
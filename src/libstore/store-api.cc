@@ -521,27 +521,52 @@ void Store::querySubstitutablePathInfos(const StorePathCAMap & paths, Substituta
 {
     if (!settings.useSubstitutes) return;
     for (auto & sub : getDefaultSubstituters()) {
-        for (auto & path : paths) {
-            if (infos.count(path.first))
-                // Choose first succeeding substituter.
-                continue;
-
-            auto subPath(path.first);
-
+        auto getSubPath = [&](const StorePathCAMap::value_type & path) -> std::optional<StorePath> {
             // Recompute store path so that we can use a different store root.
             if (path.second) {
-                subPath = makeFixedOutputPathFromCA(
+                auto subPath = makeFixedOutputPathFromCA(
                     path.first.name(),
                     ContentAddressWithReferences::withoutRefs(*path.second));
                 if (sub->storeDir == storeDir)
                     assert(subPath == path.first);
-                if (subPath != path.first)
-                    debug("replaced path '%s' with '%s' for substituter '%s'", printStorePath(path.first), sub->printStorePath(subPath), sub->getUri());
-            } else if (sub->storeDir != storeDir) continue;
+                return subPath;
+            } else if (sub->storeDir != storeDir)
+                return std::nullopt;
+            return path.first;
+        };
+
+        /* When asked about several paths, fetch their info from this
+           substituter all at once, so that the lookups below are
+           answered from the cache. Errors are reported by those
+           lookups. */
+        if (paths.size() > 1) {
+            StorePathSet subPaths;
+            for (auto & path : paths)
+                if (!infos.count(path.first))
+                    if (auto subPath = getSubPath(path))
+                        subPaths.insert(std::move(*subPath));
+            if (subPaths.size() > 1) {
+                try {
+                    sub->queryPathInfos(subPaths);
+                } catch (Error & e) {
+                    debug("cannot prefetch path info from substituter '%s': %s", sub->getUri(), e.what());
+                }
+            }
+        }
 
-            debug("checking substituter '%s' for path '%s'", sub->getUri(), sub->printStorePath(subPath));
+        for (auto & path : paths) {
+            if (infos.count(path.first))
+                // Choose first succeeding substituter.
+                continue;
+
+            auto subPath = getSubPath(path);
+            if (!subPath) continue;
+            if (*subPath != path.first)
+                debug("replaced path '%s' with '%s' for substituter '%s'", printStorePath(path.first), sub->printStorePath(*subPath), sub->getUri());
+
+            debug("checking substituter '%s' for path '%s'", sub->getUri(), sub->printStorePath(*subPath));
             try {
-                auto info = sub->queryPathInfo(subPath);
+                auto info = sub->queryPathInfo(*subPath);
 
                 if (sub->storeDir != storeDir && !(info->isContentAddressed(*sub) && info->references.empty()))
                     continue;
@@ -715,6 +740,90 @@ void Store::queryPathInfo(const StorePath & storePath,
         }});
 }
 
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>> Store::queryPathInfos(const StorePathSet & paths)
+{
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>> res;
+    StorePathSet uncached;
+
+    for (auto & path : paths) {
+        if (auto info = queryPathInfoFromClientCache(path))
+            res.insert_or_assign(path, std::move(*info));
+        else
+            uncached.insert(path);
+    }
+
+    if (uncached.empty()) return res;
+
+    auto infos = queryPathInfosUncached(uncached);
+
+    if (diskCache) {
+        std::vector<std::pair<std::string, std::shared_ptr<const ValidPathInfo>>> entries;
+        entries.reserve(infos.size());
+        for (auto & [path, info] : infos)
+            entries.emplace_back(std::string(path.hashPart()), info);
+        diskCache->upsertNarInfos(getUri(), entries);
+    }
+
+    for (auto & [path, info] : infos) {
+        {
+            auto state_(state.lock());
+            state_->pathInfoCache.upsert(path.to_string(), PathInfoCacheValue { .value = info });
+        }
+
+        if (!info || !goodStorePath(path, info->path)) {
+            stats.narInfoMissing++;
+            res.insert_or_assign(path, nullptr);
+        } else
+            res.insert_or_assign(path, info);
+    }
+
+    return res;
+}
+
+
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>> Store::queryPathInfosUncached(const StorePathSet & paths)
+{
+    struct State
+    {
+        size_t left;
+        std::map<StorePath, std::shared_ptr<const ValidPathInfo>> infos;
+        std::exception_ptr exc;
+    };
+
+    Sync<State> state_(State{paths.size(), {}});
+
+    std::condition_variable wakeup;
+    ThreadPool pool;
+
+    auto doQuery = [&](const StorePath & path) {
+        checkInterrupt();
+        queryPathInfoUncached(path, {[path, &state_, &wakeup](std::future<std::shared_ptr<const ValidPathInfo>> fut) {
+            auto state(state_.lock());
+
+            try {
+                state->infos.insert_or_assign(path, fut.get());
+            } catch (...) {
+                state->exc = std::current_exception();
+            }
+
+            assert(state->left);
+            if (!--state->left)
+                wakeup.notify_one();
+        }});
+    };
+
+    for (auto & path : paths)
+        pool.enqueue(std::bind(doQuery, path));
+
+    pool.process();
+
+    auto state(state_.lock());
+    while (state->left) state.wait(wakeup);
+    if (state->exc) std::rethrow_exception(state->exc);
+    return std::move(state->infos);
+}
+
+
 void Store::queryRealisation(const DrvOutput & id,
         Callback<std::shared_ptr<const Realisation>> callback) noexcept
 {
@@ -1077,6 +1186,10 @@ std::map<StorePath, StorePath> copyPaths(
 
     // In the general case, `addMultipleToStore` requires a sorted list of
     // store paths to add, so sort them right now
+    /* Fetch the info about all missing paths up front, which for
+       some stores is much faster than querying them one at a time. */
+    srcStore.queryPathInfos(missing);
+
     auto sortedMissing = srcStore.topoSortPaths(missing);
     std::reverse(sortedMissing.begin(), sortedMissing.end());
 
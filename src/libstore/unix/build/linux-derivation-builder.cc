@@ -16,103 +16,150 @@
 
 #  if HAVE_SECCOMP
 #    include <seccomp.h>
+#    include <sys/prctl.h>
+#    include <linux/filter.h>
+#    include <linux/seccomp.h>
 #  endif
 
 #  define pivot_root(new_root, put_old) (syscall(SYS_pivot_root, new_root, put_old))
 
 namespace nix {
 
-static void setupSeccomp()
-{
-    if (!settings.filterSyscalls)
-        return;
-
 #  if HAVE_SECCOMP
-    scmp_filter_ctx ctx;
-
-    if (!(ctx = seccomp_init(SCMP_ACT_ALLOW)))
-        throw SysError("unable to initialize seccomp mode 2");
-
-    Finally cleanup([&]() { seccomp_release(ctx); });
-
-    constexpr std::string_view nativeSystem = NIX_LOCAL_SYSTEM;
+/**
+ * Return the seccomp BPF program for builders. Generating it with
+ * libseccomp is relatively expensive, so it is done once per process.
+ * Call this in the parent before forking, so that the builder only
+ * has to load the program.
+ */
+static const std::string & getSeccompFilter()
+{
+    static const std::string filter = []() {
+        scmp_filter_ctx ctx;
+
+        if (!(ctx = seccomp_init(SCMP_ACT_ALLOW)))
+            throw SysError("unable to initialize seccomp mode 2");
+
+        Finally cleanup([&]() { seccomp_release(ctx); });
+
+        constexpr std::string_view nativeSystem = NIX_LOCAL_SYSTEM;
+
+        if (nativeSystem == "x86_64-linux" && seccomp_arch_add(ctx, SCMP_ARCH_X86) != 0)
+            throw SysError("unable to add 32-bit seccomp architecture");
+
+        if (nativeSystem == "x86_64-linux" && seccomp_arch_add(ctx, SCMP_ARCH_X32) != 0)
+            throw SysError("unable to add X32 seccomp architecture");
+
+        if (nativeSystem == "aarch64-linux" && seccomp_arch_add(ctx, SCMP_ARCH_ARM) != 0)
+            printError(
+                "unable to add ARM seccomp architecture; this may result in spurious build failures if running 32-bit ARM processes");
+
+        if (nativeSystem == "mips64-linux" && seccomp_arch_add(ctx, SCMP_ARCH_MIPS) != 0)
+            printError("unable to add mips seccomp architecture");
+
+        if (nativeSystem == "mips64-linux" && seccomp_arch_add(ctx, SCMP_ARCH_MIPS64N32) != 0)
+            printError("unable to add mips64-*abin32 seccomp architecture");
+
+        if (nativeSystem == "mips64el-linux" && seccomp_arch_add(ctx, SCMP_ARCH_MIPSEL) != 0)
+            printError("unable to add mipsel seccomp architecture");
+
+        if (nativeSystem == "mips64el-linux" && seccomp_arch_add(ctx, SCMP_ARCH_MIPSEL64N32) != 0)
+            printError("unable to add mips64el-*abin32 seccomp architecture");
+
+        /* Prevent builders from creating setuid/setgid binaries. */
+        for (int perm : {S_ISUID, S_ISGID}) {
+            if (seccomp_rule_add(
+                    ctx,
+                    SCMP_ACT_ERRNO(EPERM),
+                    SCMP_SYS(chmod),
+                    1,
+                    SCMP_A1(SCMP_CMP_MASKED_EQ, (scmp_datum_t) perm, (scmp_datum_t) perm))
+                != 0)
+                throw SysError("unable to add seccomp rule");
+
+            if (seccomp_rule_add(
+                    ctx,
+                    SCMP_ACT_ERRNO(EPERM),
+                    SCMP_SYS(fchmod),
+                    1,
+                    SCMP_A1(SCMP_CMP_MASKED_EQ, (scmp_datum_t) perm, (scmp_datum_t) perm))
+                != 0)
+                throw SysError("unable to add seccomp rule");
+
+            if (seccomp_rule_add(
+                    ctx,
+                    SCMP_ACT_ERRNO(EPERM),
+                    SCMP_SYS(fchmodat),
+                    1,
+                    SCMP_A2(SCMP_CMP_MASKED_EQ, (scmp_datum_t) perm, (scmp_datum_t) perm))
+                != 0)
+                throw SysError("unable to add seccomp rule");
+
+            if (seccomp_rule_add(
+                    ctx,
+                    SCMP_ACT_ERRNO(EPERM),
+                    NIX_SYSCALL_FCHMODAT2,
+                    1,
+                    SCMP_A2(SCMP_CMP_MASKED_EQ, (scmp_datum_t) perm, (scmp_datum_t) perm))
+                != 0)
+                throw SysError("unable to add seccomp rule");
+        }
 
-    if (nativeSystem == "x86_64-linux" && seccomp_arch_add(ctx, SCMP_ARCH_X86) != 0)
-        throw SysError("unable to add 32-bit seccomp architecture");
+        /* Prevent builders from using EAs or ACLs. Not all filesystems
+           support these, and they're not allowed in the Nix store because
+           they're not representable in the NAR serialisation. */
+        if (seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(getxattr), 0) != 0
+            || seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(lgetxattr), 0) != 0
+            || seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(fgetxattr), 0) != 0
+            || seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(setxattr), 0) != 0
+            || seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(lsetxattr), 0) != 0
+            || seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(fsetxattr), 0) != 0)
+            throw SysError("unable to add seccomp rule");
 
-    if (nativeSystem == "x86_64-linux" && seccomp_arch_add(ctx, SCMP_ARCH_X32) != 0)
-        throw SysError("unable to add X32 seccomp architecture");
+        AutoCloseFD fd = memfd_create("nix-seccomp-filter", MFD_CLOEXEC);
+        if (!fd)
+            throw SysError("creating memfd for the seccomp BPF program");
 
-    if (nativeSystem == "aarch64-linux" && seccomp_arch_add(ctx, SCMP_ARCH_ARM) != 0)
-        printError(
-            "unable to add ARM seccomp architecture; this may result in spurious build failures if running 32-bit ARM processes");
+        if (seccomp_export_bpf(ctx, fd.get()) != 0)
+            throw SysError("unable to export seccomp BPF program");
 
-    if (nativeSystem == "mips64-linux" && seccomp_arch_add(ctx, SCMP_ARCH_MIPS) != 0)
-        printError("unable to add mips seccomp architecture");
+        if (lseek(fd.get(), 0, SEEK_SET) == -1)
+            throw SysError("seeking in the seccomp BPF program");
 
-    if (nativeSystem == "mips64-linux" && seccomp_arch_add(ctx, SCMP_ARCH_MIPS64N32) != 0)
-        printError("unable to add mips64-*abin32 seccomp architecture");
+        return drainFD(fd.get());
+    }();
 
-    if (nativeSystem == "mips64el-linux" && seccomp_arch_add(ctx, SCMP_ARCH_MIPSEL) != 0)
-        printError("unable to add mipsel seccomp architecture");
+    return filter;
+}
+#  endif
 
-    if (nativeSystem == "mips64el-linux" && seccomp_arch_add(ctx, SCMP_ARCH_MIPSEL64N32) != 0)
-        printError("unable to add mips64el-*abin32 seccomp architecture");
+static void prepareSeccomp()
+{
+#  if HAVE_SECCOMP
+    if (settings.filterSyscalls)
+        getSeccompFilter();
+#  endif
+}
 
-    /* Prevent builders from creating setuid/setgid binaries. */
-    for (int perm : {S_ISUID, S_ISGID}) {
-        if (seccomp_rule_add(
-                ctx,
-                SCMP_ACT_ERRNO(EPERM),
-                SCMP_SYS(chmod),
-                1,
-                SCMP_A1(SCMP_CMP_MASKED_EQ, (scmp_datum_t) perm, (scmp_datum_t) perm))
-            != 0)
-            throw SysError("unable to add seccomp rule");
+static void setupSeccomp()
+{
+    if (!settings.filterSyscalls)
+        return;
 
-        if (seccomp_rule_add(
-                ctx,
-                SCMP_ACT_ERRNO(EPERM),
-                SCMP_SYS(fchmod),
-                1,
-                SCMP_A1(SCMP_CMP_MASKED_EQ, (scmp_datum_t) perm, (scmp_datum_t) perm))
-            != 0)
-            throw SysError("unable to add seccomp rule");
+#  if HAVE_SECCOMP
+    auto & filter = getSeccompFilter();
 
-        if (seccomp_rule_add(
-                ctx,
-                SCMP_ACT_ERRNO(EPERM),
-                SCMP_SYS(fchmodat),
-                1,
-                SCMP_A2(SCMP_CMP_MASKED_EQ, (scmp_datum_t) perm, (scmp_datum_t) perm))
-            != 0)
-            throw SysError("unable to add seccomp rule");
+    struct sock_fprog prog = {
+        .len = (unsigned short) (filter.size() / sizeof(struct sock_filter)),
+        .filter = (struct sock_filter *) filter.data(),
+    };
 
-        if (seccomp_rule_add(
-                ctx,
-                SCMP_ACT_ERRNO(EPERM),
-                NIX_SYSCALL_FCHMODAT2,
-                1,
-                SCMP_A2(SCMP_CMP_MASKED_EQ, (scmp_datum_t) perm, (scmp_datum_t) perm))
-            != 0)
-            throw SysError("unable to add seccomp rule");
-    }
+    /* This is what seccomp_load() does for the 'no new privileges'
+       attribute. */
+    if (!settings.allowNewPrivileges && prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1)
+        throw SysError("unable to set 'no new privileges'");
 
-    /* Prevent builders from using EAs or ACLs. Not all filesystems
-       support these, and they're not allowed in the Nix store because
-       they're not representable in the NAR serialisation. */
-    if (seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(getxattr), 0) != 0
-        || seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(lgetxattr), 0) != 0
-        || seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(fgetxattr), 0) != 0
-        || seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(setxattr), 0) != 0
-        || seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(lsetxattr), 0) != 0
-        || seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(fsetxattr), 0) != 0)
-        throw SysError("unable to add seccomp rule");
-
-    if (seccomp_attr_set(ctx, SCMP_FLTATR_CTL_NNP, settings.allowNewPrivileges ? 0 : 1) != 0)
-        throw SysError("unable to set 'no new privileges' seccomp attribute");
-
-    if (seccomp_load(ctx) != 0)
+    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == -1)
         throw SysError("unable to load seccomp BPF program");
 #  else
     throw Error(
@@ -157,6 +204,13 @@ struct LinuxDerivationBuilder : DerivationBuilderImpl
 {
     using DerivationBuilderImpl::DerivationBuilderImpl;
 
+    void startChild() override
+    {
+        prepareSeccomp();
+
+        DerivationBuilderImpl::startChild();
+    }
+
     void enterChroot() override
     {
         setupSeccomp();
@@ -448,6 +502,8 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
            us.
         */
 
+        prepareSeccomp();
+
         userNamespaceSync.create();
 
         usingUserNamespace = userNamespacesSupported();
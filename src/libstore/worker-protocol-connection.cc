@@ -5,7 +5,9 @@
 
 namespace nix {
 
-const WorkerProto::FeatureSet WorkerProto::allFeatures{};
+const WorkerProto::FeatureSet WorkerProto::allFeatures{
+    std::string(WorkerProto::featureQueryPathInfos),
+};
 
 WorkerProto::BasicClientConnection::~BasicClientConnection()
 {
@@ -265,6 +267,30 @@ UnkeyedValidPathInfo WorkerProto::BasicClientConnection::queryPathInfo(
     return WorkerProto::Serialise<UnkeyedValidPathInfo>::read(store, *this);
 }
 
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>> WorkerProto::BasicClientConnection::queryPathInfos(
+    const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths)
+{
+    assert(features.contains(WorkerProto::featureQueryPathInfos));
+    to << WorkerProto::Op::QueryPathInfos;
+    WorkerProto::write(store, *this, paths);
+    processStderr(daemonException);
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>> res;
+    auto count = readNum<size_t>(from);
+    while (count--) {
+        auto path = WorkerProto::Serialise<StorePath>::read(store, *this);
+        bool valid;
+        from >> valid;
+        if (valid) {
+            auto info = std::make_shared<ValidPathInfo>(
+                StorePath{path},
+                WorkerProto::Serialise<UnkeyedValidPathInfo>::read(store, *this));
+            res.insert_or_assign(std::move(path), std::move(info));
+        } else
+            res.insert_or_assign(std::move(path), nullptr);
+    }
+    return res;
+}
+
 StorePathSet WorkerProto::BasicClientConnection::queryValidPaths(
     const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths, SubstituteFlag maybeSubstitute)
 {
@@ -0,0 +1,93 @@
+#include "nix/util/aho-corasick.hh"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+namespace nix {
+
+/**
+ * The original implementation of `builtins.replaceStrings`: try every
+ * pattern at every position.
+ */
+static std::string replaceNaive(const std::vector<std::string> & from, std::string_view s)
+{
+    std::string res;
+    for (size_t p = 0; p <= s.size();) {
+        bool found = false;
+        for (size_t i = 0; i < from.size(); ++i)
+            if (s.compare(p, from[i].size(), from[i]) == 0) {
+                found = true;
+                res += "<" + std::to_string(i) + ">";
+                if (from[i].empty()) {
+                    if (p < s.size())
+                        res += s[p];
+                    p++;
+                } else
+                    p += from[i].size();
+                break;
+            }
+        if (!found) {
+            if (p < s.size())
+                res += s[p];
+            p++;
+        }
+    }
+    return res;
+}
+
+static std::string replace(const std::vector<std::string> & from, std::string_view s)
+{
+    std::string res;
+    size_t prevEnd = 0;
+    for (auto & match : AhoCorasick(from).findMatches(s)) {
+        res.append(s.substr(prevEnd, match.pos - prevEnd));
+        res += "<" + std::to_string(match.pattern) + ">";
+        prevEnd = match.pos + from[match.pattern].size();
+    }
+    res.append(s.substr(prevEnd));
+    return res;
+}
+
+TEST(AhoCorasick, noMatches)
+{
+    ASSERT_TRUE(AhoCorasick({"'", "\""}).findMatches("foo bar").empty());
+    ASSERT_TRUE(AhoCorasick({}).findMatches("foo").empty());
+    ASSERT_TRUE(AhoCorasick({"x"}).findMatches("").empty());
+}
+
+TEST(AhoCorasick, firstPatternWins)
+{
+    ASSERT_EQ(replace({"oo", "a"}, "foobar"), "f<0>b<1>r");
+    ASSERT_EQ(replace({"a", "ab"}, "abc"), "<0>bc");
+    ASSERT_EQ(replace({"ab", "a"}, "abc"), "<0>c");
+    /* The scan continues after a match, even if a later pattern
+       would have matched earlier inside it. */
+    ASSERT_EQ(replace({"bc", "abcd"}, "abcd"), "<1>");
+    ASSERT_EQ(replace({"aa"}, "aaa"), "<0>a");
+}
+
+TEST(AhoCorasick, emptyPattern)
+{
+    ASSERT_EQ(replace({""}, "ab"), "<0>a<0>b<0>");
+    ASSERT_EQ(replace({"a", ""}, "ab"), "<0><1>b<1>");
+    ASSERT_EQ(replace({"", "a"}, "ab"), "<0>a<0>b<0>");
+    ASSERT_EQ(replace({""}, ""), "<0>");
+}
+
+TEST(AhoCorasick, randomAgainstNaive)
+{
+    std::mt19937 gen(42);
+    for (int round = 0; round < 10000; ++round) {
+        std::vector<std::string> from(gen() % 6);
+        for (auto & p : from)
+            for (size_t i = gen() % (gen() % 8 ? 4 : 80); i > 0; --i)
+                p += "abc"[gen() % 3];
+        std::string s;
+        for (size_t i = gen() % (gen() % 10 ? 12 : 300); i > 0; --i)
+            s += "abcd"[gen() % 4];
+        ASSERT_EQ(replace(from, s), replaceNaive(from, s)) << s;
+    }
+}
+
+}
@@ -0,0 +1,82 @@
+#include "nix/util/cdc.hh"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+
+namespace nix {
+
+static std::string randomData(size_t size, unsigned int seed)
+{
+    std::mt19937_64 gen(seed);
+    std::string s;
+    s.reserve(size);
+    while (s.size() < size)
+        s.push_back((char) (gen() & 0xff));
+    return s;
+}
+
+static std::vector<std::string> chunk(std::string_view data, size_t writeSize)
+{
+    std::vector<std::string> chunks;
+    ChunkingSink sink([&](std::string_view c) { chunks.emplace_back(c); });
+    while (!data.empty()) {
+        auto n = std::min(writeSize, data.size());
+        sink(data.substr(0, n));
+        data.remove_prefix(n);
+    }
+    sink.finish();
+    return chunks;
+}
+
+TEST(findChunkBoundary, respectsLimits)
+{
+    ChunkingParams params;
+    auto data = randomData(8 * 1024 * 1024, 1);
+    std::string_view rest = data;
+    while (!rest.empty()) {
+        auto len = findChunkBoundary(rest, params);
+        ASSERT_LE(len, params.maxSize);
+        if (len < rest.size()) {
+            ASSERT_GE(len, params.minSize);
+        }
+        rest.remove_prefix(len);
+    }
+}
+
+TEST(findChunkBoundary, shortInputIsOneChunk)
+{
+    ASSERT_EQ(findChunkBoundary("hello"), 5);
+    ASSERT_EQ(findChunkBoundary(""), 0);
+}
+
+TEST(ChunkingSink, independentOfWriteSize)
+{
+    auto data = randomData(4 * 1024 * 1024 + 123, 2);
+    auto chunks1 = chunk(data, 1000);
+    auto chunks2 = chunk(data, 3 * 1024 * 1024);
+    ASSERT_EQ(chunks1, chunks2);
+
+    std::string joined;
+    for (auto & c : chunks1)
+        joined += c;
+    ASSERT_EQ(joined, data);
+}
+
+TEST(ChunkingSink, boundariesResynchronize)
+{
+    /* Inserting data at the start should only affect the first few
+       chunks. */
+    auto data = randomData(8 * 1024 * 1024, 3);
+    auto chunks1 = chunk(data, 65536);
+    auto chunks2 = chunk(randomData(1000, 4) + data, 65536);
+
+    std::set<std::string> set1(chunks1.begin(), chunks1.end());
+    size_t shared = 0;
+    for (auto & c : chunks2)
+        shared += set1.count(c);
+    ASSERT_GE(shared + 3, chunks2.size());
+}
+
+}
@@ -93,4 +93,24 @@ namespace nix {
         ASSERT_STREQ(strSink.s.c_str(), inputString);
     }
 
+    TEST(makeCompressionSink, parallelZstdRoundTrip) {
+        /* Large enough to be split into several independently
+           compressed frames. */
+        std::string inputString;
+        for (size_t i = 0; inputString.size() < 10 * 1024 * 1024; ++i)
+            inputString += std::to_string(i * 7919) + "\n";
+
+        auto compressed = compress("zstd", inputString, true);
+
+        // The output is a sequence of plain zstd frames.
+        ASSERT_GE(compressed.size(), 4u);
+        ASSERT_EQ(compressed.substr(0, 4), "\x28\xb5\x2f\xfd");
+
+        ASSERT_EQ(decompress("zstd", compressed), inputString);
+    }
+
+    TEST(makeCompressionSink, parallelZstdEmptyInput) {
+        ASSERT_EQ(decompress("zstd", compress("zstd", "", true)), "");
+    }
+
 }
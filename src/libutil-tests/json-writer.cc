@@ -0,0 +1,170 @@
+#include "nix/util/json-writer.hh"
+#include "nix/util/json-utils.hh"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+namespace nix {
+
+/**
+ * Write `j` with a `JSONWriter`, using its methods for each kind of
+ * value.
+ */
+static void writeJSON(JSONWriter & writer, const nlohmann::json & j)
+{
+    switch (j.type()) {
+    case nlohmann::json::value_t::null:
+        writer.null();
+        break;
+    case nlohmann::json::value_t::boolean:
+        writer.boolean(j.get<bool>());
+        break;
+    case nlohmann::json::value_t::number_integer:
+    case nlohmann::json::value_t::number_unsigned:
+        writer.integer(j.get<int64_t>());
+        break;
+    case nlohmann::json::value_t::number_float:
+        writer.number(j.get<double>());
+        break;
+    case nlohmann::json::value_t::string:
+        writer.string(j.get_ref<const std::string &>());
+        break;
+    case nlohmann::json::value_t::object:
+        writer.beginObject();
+        for (auto & [k, v] : j.items()) {
+            writer.key(k);
+            writeJSON(writer, v);
+        }
+        writer.endObject();
+        break;
+    case nlohmann::json::value_t::array:
+        writer.beginArray();
+        for (auto & v : j)
+            writeJSON(writer, v);
+        writer.endArray();
+        break;
+    case nlohmann::json::value_t::binary:
+        FAIL();
+    case nlohmann::json::value_t::discarded:
+        FAIL();
+    }
+}
+
+static std::string toJSON(const nlohmann::json & j, int indent)
+{
+    StringSink sink;
+    JSONWriter writer(sink, indent);
+    writeJSON(writer, j);
+    writer.flush();
+    return sink.s;
+}
+
+static void checkLikeDump(const nlohmann::json & j)
+{
+    for (int indent : {-1, 0, 2})
+        ASSERT_EQ(toJSON(j, indent), j.dump(indent)) << "indent " << indent;
+}
+
+TEST(JSONWriter, scalars)
+{
+    checkLikeDump(nullptr);
+    checkLikeDump(true);
+    checkLikeDump(false);
+    checkLikeDump(0);
+    checkLikeDump(-9223372036854775807LL - 1);
+    checkLikeDump(9223372036854775807LL);
+    checkLikeDump(1.5);
+    checkLikeDump(-0.0);
+    checkLikeDump(1e300);
+    checkLikeDump(0.1);
+}
+
+TEST(JSONWriter, strings)
+{
+    checkLikeDump("");
+    checkLikeDump("hello world, this is a longer string");
+    checkLikeDump("\"\\/\b\f\n\r\t\x01\x1f\x7f");
+    checkLikeDump(std::string("a\0b", 3));
+    checkLikeDump("héllo wörld ☃ 𝄞");
+}
+
+TEST(JSONWriter, invalidUTF8)
+{
+    for (auto s : {"\xff", "abc\xc3", "\xc0\x80", "\xed\xa0\x80", "\xf4\x90\x80\x80", "abcdefgh\xe2\x82"}) {
+        StringSink sink;
+        JSONWriter writer(sink);
+        ASSERT_THROW(writer.string(s), nlohmann::json::type_error) << s;
+        ASSERT_THROW(nlohmann::json(s).dump(), nlohmann::json::type_error) << s;
+    }
+}
+
+TEST(JSONWriter, containers)
+{
+    checkLikeDump(nlohmann::json::object());
+    checkLikeDump(nlohmann::json::array());
+    checkLikeDump(nlohmann::json::parse(R"({"a": [1, 2, {}, [], {"b": null}], "c": {"d": [[]]}, "e": "f"})"));
+    checkLikeDump(nlohmann::json::parse(R"([[[1]], {"x": {"y": {"z": true}}}])"));
+}
+
+TEST(JSONWriter, embeddedJSON)
+{
+    auto inner = nlohmann::json::parse(R"({"x": [1, {"y": 2}]})");
+    auto outer = nlohmann::json::object();
+    outer["a"] = nlohmann::json::array({inner, 3});
+
+    for (int indent : {-1, 0, 2, 4}) {
+        StringSink sink;
+        JSONWriter writer(sink, indent);
+        writer.beginObject();
+        writer.key("a");
+        writer.beginArray();
+        writer.json(inner);
+        writer.integer(3);
+        writer.endArray();
+        writer.endObject();
+        writer.flush();
+        ASSERT_EQ(sink.s, outer.dump(indent));
+    }
+}
+
+TEST(JSONWriter, randomStrings)
+{
+    std::mt19937 gen(42);
+    static constexpr std::string_view chars[] = {"a", "b", " ", "\"", "\\", "\n", "\x02", "é", "☃", "𝄞", "/"};
+    for (int round = 0; round < 2000; ++round) {
+        std::string s;
+        for (size_t i = gen() % 40; i > 0; --i)
+            s += chars[gen() % std::size(chars)];
+        ASSERT_EQ(toJSON(s, -1), nlohmann::json(s).dump());
+    }
+}
+
+TEST(JSONUtils, utf8SequenceLength)
+{
+    ASSERT_EQ(utf8SequenceLength("a"), 1);
+    ASSERT_EQ(utf8SequenceLength("é"), 2);
+    ASSERT_EQ(utf8SequenceLength("☃"), 3);
+    ASSERT_EQ(utf8SequenceLength("𝄞"), 4);
+    ASSERT_EQ(utf8SequenceLength(""), 0);
+    ASSERT_EQ(utf8SequenceLength("\x80"), 0);
+    ASSERT_EQ(utf8SequenceLength("\xc1\xbf"), 0);
+    ASSERT_EQ(utf8SequenceLength("\xe0\x9f\xbf"), 0);
+    ASSERT_EQ(utf8SequenceLength("\xed\xa0\x80"), 0);
+    ASSERT_EQ(utf8SequenceLength("\xf4\x90\x80\x80"), 0);
+    ASSERT_EQ(utf8SequenceLength("\xe2\x98"), 0);
+}
+
+TEST(JSONUtils, findJSONStringSpecial)
+{
+    ASSERT_EQ(findJSONStringSpecial("", 0), 0);
+    ASSERT_EQ(findJSONStringSpecial("abcdefghijklmnop", 0), 16);
+    ASSERT_EQ(findJSONStringSpecial("abcdefghijklm\"op", 0), 13);
+    ASSERT_EQ(findJSONStringSpecial("abcdefghij\\lmnop", 3), 10);
+    ASSERT_EQ(findJSONStringSpecial("abcdefghijklmno\x7f", 0), 16);
+    ASSERT_EQ(findJSONStringSpecial("abcdefghijklmno\x1f", 0), 15);
+    ASSERT_EQ(findJSONStringSpecial("abcdefghij\xc3\xa9", 0), 10);
+    ASSERT_EQ(findJSONStringSpecial("\"bcdefghij", 1), 10);
+}
+
+}
@@ -0,0 +1,203 @@
+#include "nix/util/posix-regex.hh"
+
+#include <gtest/gtest.h>
+
+#include <regex>
+
+namespace nix {
+
+static std::vector<std::vector<std::string>> allMatches(std::string_view pattern, std::string_view subject)
+{
+    std::vector<std::vector<std::string>> res;
+    PosixRegex(pattern).forEachMatch(subject, [&](const RegexMatch & m) {
+        std::vector<std::string> groups;
+        for (size_t i = 0; i < m.offsets.size() / 2; ++i)
+            groups.push_back(m.matched(i) ? std::string(m.str(subject, i)) : "<unmatched>");
+        res.push_back(groups);
+    });
+    return res;
+}
+
+/**
+ * The matches that `std::cregex_iterator` finds, in the same form as
+ * `allMatches()`.
+ */
+static std::vector<std::vector<std::string>> stdRegexMatches(const std::string & pattern, std::string_view subject)
+{
+    std::vector<std::vector<std::string>> res;
+    std::regex re(pattern, std::regex::extended);
+    for (auto i = std::cregex_iterator(subject.data(), subject.data() + subject.size(), re);
+         i != std::cregex_iterator();
+         ++i) {
+        std::vector<std::string> groups;
+        for (auto & group : *i)
+            groups.push_back(group.matched ? group.str() : "<unmatched>");
+        res.push_back(groups);
+    }
+    return res;
+}
+
+TEST(PosixRegex, matchWholeString)
+{
+    PosixRegex re("[a-z]+-[0-9.]+");
+    ASSERT_TRUE(re.match("hello-1.2.3"));
+    ASSERT_FALSE(re.match("hello-1.2.3-"));
+    ASSERT_FALSE(re.match("xhello"));
+    ASSERT_FALSE(re.match(""));
+    ASSERT_TRUE(PosixRegex("").match(""));
+    ASSERT_TRUE(PosixRegex("a*").match(""));
+}
+
+TEST(PosixRegex, matchGroups)
+{
+    PosixRegex re("([^-]*)-(.*)(x)?");
+    ASSERT_EQ(re.groups(), 3);
+    RegexMatch m;
+    std::string_view s = "foo-bar-baz";
+    ASSERT_TRUE(re.match(s, &m));
+    ASSERT_EQ(m.str(s, 1), "foo");
+    ASSERT_EQ(m.str(s, 2), "bar-baz");
+    ASSERT_FALSE(m.matched(3));
+}
+
+TEST(PosixRegex, groupsPreferEarlierAlternatives)
+{
+    PosixRegex re("(a|ab)(c|bcd)(d*)");
+    RegexMatch m;
+    std::string_view s = "abcd";
+    ASSERT_TRUE(re.match(s, &m));
+    ASSERT_EQ(m.str(s, 1), "a");
+    ASSERT_EQ(m.str(s, 2), "bcd");
+    ASSERT_EQ(m.str(s, 3), "");
+}
+
+TEST(PosixRegex, groupsInEmptyLastIteration)
+{
+    PosixRegex re("(.?)*");
+    RegexMatch m;
+    std::string_view s = "ab";
+    ASSERT_TRUE(re.match(s, &m));
+    ASSERT_EQ(m.start(1), 2);
+    ASSERT_EQ(m.end(1), 2);
+}
+
+TEST(PosixRegex, anchors)
+{
+    ASSERT_TRUE(PosixRegex("^a$").match("a"));
+    ASSERT_FALSE(PosixRegex("a^").match("a"));
+    ASSERT_EQ(allMatches("^a", "aaa").size(), 1);
+    ASSERT_EQ(allMatches("a$", "aaa").size(), 1);
+}
+
+TEST(PosixRegex, bracketExpressions)
+{
+    ASSERT_TRUE(PosixRegex("[]a]+").match("]a]"));
+    ASSERT_TRUE(PosixRegex("[^]a]").match("b"));
+    ASSERT_FALSE(PosixRegex("[^]a]").match("]"));
+    ASSERT_TRUE(PosixRegex("[a-]+").match("a-"));
+    ASSERT_TRUE(PosixRegex("[\\]+").match("\\\\"));
+    ASSERT_TRUE(PosixRegex("[[:digit:][:space:]]+").match("1 2\t3"));
+    ASSERT_TRUE(PosixRegex("[[:w:]]+").match("a_1"));
+    ASSERT_TRUE(PosixRegex("[[=a=]]").match("A"));
+    ASSERT_TRUE(PosixRegex("[[.-.]]").match("-"));
+}
+
+TEST(PosixRegex, splitLeftmostLongest)
+{
+    ASSERT_EQ(allMatches("(a|b)+", "xaaxab"), (std::vector<std::vector<std::string>>{{"aa", "a"}, {"ab", "b"}}));
+    ASSERT_EQ(allMatches("(a|ab)", "ab"), (std::vector<std::vector<std::string>>{{"ab", "ab"}}));
+}
+
+TEST(PosixRegex, splitEmptyMatches)
+{
+    /* Same as `std::cregex_iterator`: an empty match can't follow
+       an empty match at the same position. */
+    ASSERT_EQ(
+        allMatches("a*", "baaac"),
+        (std::vector<std::vector<std::string>>{{""}, {"aaa"}, {""}, {""}}));
+    ASSERT_EQ(allMatches("", "ab"), (std::vector<std::vector<std::string>>{{""}, {""}, {""}}));
+    ASSERT_EQ(allMatches("x*", ""), (std::vector<std::vector<std::string>>{{""}}));
+    ASSERT_EQ(allMatches("$", "ab"), (std::vector<std::vector<std::string>>{{""}}));
+}
+
+TEST(PosixRegex, splitSameAsStdRegex)
+{
+    /* libstdc++ stops at a shorter match for some of these, e.g. `a`
+       rather than `ab` at offset 4 of `baxbab` for the first pattern.
+       `builtins.split` must keep returning the same results. */
+    for (auto [pattern, subject] : std::initializer_list<std::pair<std::string, std::string_view>>{
+             {"(a*)(ab|a)?", "baxbab"},
+             {"(a?(ab|a)?)+", "baxbab"},
+             {"a?x*(ab|a)?", "ab"},
+             {"(a|b)+", "xaaxab"},
+             {"(a|ab)(c|bcd)(d*)", "abcdxabcd"},
+             {"([^-]*)-([0-9]+)", "foo-1-bar-22"},
+             {"(.?)*", "ab"},
+             {"[[:space:]]+", " a  b\tc "},
+             {"x*", "axxb"},
+         })
+        ASSERT_EQ(allMatches(pattern, subject), stdRegexMatches(pattern, subject)) << pattern << " on " << subject;
+
+    ASSERT_EQ(allMatches("(a*)(ab|a)?", "baxbab")[4], (std::vector<std::string>{"a", "a", "<unmatched>"}));
+}
+
+TEST(PosixRegex, splitBacktrackingLimit)
+{
+    /* libstdc++ takes exponential time on this. Its search is given up
+       and the leftmost-longest matches are returned instead. */
+    auto matches = allMatches(
+        "([ab]*(([ab]?){1,2}(a*a?a?)?)+)+(a?(.+a+|a{1,2}b?)$)a+|(a?)*", "bbxbbbbxa");
+    std::vector<std::string> whole;
+    for (auto & m : matches)
+        whole.push_back(m[0]);
+    ASSERT_EQ(whole, (std::vector<std::string>{"", "", "", "", "", "", "", "", "a", ""}));
+}
+
+TEST(PosixRegex, syntaxErrors)
+{
+    for (auto pattern :
+         {"(",
+          "a)",
+          "[a",
+          "[z-a]",
+          "[a-c-e]",
+          "[[:foo:]]",
+          "*a",
+          "a|*",
+          "(*)",
+          "^*",
+          "a{",
+          "a{,2}",
+          "a{2,1}",
+          "{1}",
+          "\\",
+          "\\n",
+          "\\]"})
+        ASSERT_THROW(PosixRegex{pattern}, RegexError) << pattern;
+}
+
+TEST(PosixRegex, tooLarge)
+{
+    ASSERT_THROW(PosixRegex("((a{1000}){1000}){1000}"), RegexSpaceError);
+    ASSERT_THROW(PosixRegex(std::string(10000, '(') + std::string(10000, ')')), RegexSpaceError);
+}
+
+TEST(PosixRegex, largeInput)
+{
+    /* libstdc++'s backtracking matcher overflows the stack on these. */
+    std::string s;
+    for (int i = 0; i < 100000; ++i)
+        s += "line " + std::to_string(i) + "\n";
+
+    RegexMatch m;
+    ASSERT_TRUE(PosixRegex("(.|\n)*line ([0-9]+)\n").match(s, &m));
+    ASSERT_EQ(m.str(s, 2), "99999");
+
+    size_t n = 0;
+    PosixRegex("\n").forEachMatch(s, [&](const RegexMatch &) { n++; });
+    ASSERT_EQ(n, 100000);
+
+    ASSERT_FALSE(PosixRegex("(a|aa)*b").match(std::string(100000, 'a')));
+}
+
+}
@@ -42,5 +42,39 @@ INSTANTIATE_TEST_CASE_P(
     )
 );
 
+TEST(RefScanSink, findsReferencesAcrossChunks) {
+    std::string h1 = "dc04vv14dak1c1r48qa0m23vr9jy8sm0";
+    std::string h2 = "0m3s6gb3h5j6x1hlm4j2wvnv3yi6m7pa";
+    std::string h3 = "ffd6vbxzbvr9m8r9ybwwdzs5r2vg1ld6";
+
+    RefScanSink sink(StringSet{h1, h2, h3});
+
+    std::string data =
+        "/nix/store/" + h1 + "-foo\n"
+        + std::string(100, 'x') + h2 + "-bar"
+        + "/nix/store/" + h2 + "-bar";
+
+    /* Feed the data in odd-sized chunks, so that some references
+       straddle chunk boundaries. */
+    for (size_t i = 0; i < data.size(); i += 7)
+        sink(std::string_view(data).substr(i, 7));
+
+    ASSERT_EQ(sink.getResult(), (StringSet{h1, h2}));
 }
 
+TEST(RefScanSink, rejectsNonBase32Characters) {
+    std::string h = "dc04vv14dak1c1r48qa0m23vr9jy8sm0";
+
+    for (unsigned int c = 0; c < 256; ++c) {
+        if (nix32Chars.find((char) c) != std::string::npos) continue;
+        for (size_t pos : {0, 15, 16, 31}) {
+            std::string candidate = h;
+            candidate[pos] = (char) c;
+            RefScanSink sink(StringSet{candidate});
+            sink(std::string(40, '-') + candidate + std::string(40, '-'));
+            ASSERT_TRUE(sink.getResult().empty()) << "character " << c << " at " << pos;
+        }
+    }
+}
+
+}
@@ -0,0 +1,138 @@
+#include "nix/util/aho-corasick.hh"
+
+#include <boost/container/small_vector.hpp>
+
+#include <queue>
+
+namespace nix {
+
+AhoCorasick::AhoCorasick(std::vector<std::string> patterns)
+    : patterns_(std::move(patterns))
+{
+    byteClass.fill(0);
+    nrByteClasses = 1;
+    for (auto & p : patterns_)
+        for (unsigned char c : p)
+            if (!byteClass[c]) byteClass[c] = nrByteClasses++;
+
+    states.emplace_back();
+    next.resize(nrByteClasses, none);
+
+    /* Build the trie. */
+    for (uint32_t i = 0; i < patterns_.size(); ++i) {
+        auto & p = patterns_[i];
+        if (p.empty()) {
+            if (emptyPattern == none) emptyPattern = i;
+            continue;
+        }
+        maxLength = std::max(maxLength, p.size());
+        uint32_t s = 0;
+        for (unsigned char c : p) {
+            auto & t = next[s * nrByteClasses + byteClass[c]];
+            if (t == none) {
+                t = states.size();
+                states.push_back({.depth = states[s].depth + 1});
+                next.resize(states.size() * nrByteClasses, none);
+            }
+            s = next[s * nrByteClasses + byteClass[c]];
+        }
+        if (states[s].pattern == none) states[s].pattern = i;
+    }
+
+    /* Compute the failure transitions in breadth-first order, turning
+       the trie into a DFA. */
+    std::vector<uint32_t> fail(states.size(), 0);
+    std::queue<uint32_t> todo;
+
+    for (size_t c = 0; c < nrByteClasses; ++c) {
+        auto & t = next[c];
+        if (t == none)
+            t = 0;
+        else
+            todo.push(t);
+    }
+
+    while (!todo.empty()) {
+        auto s = todo.front();
+        todo.pop();
+        auto f = fail[s];
+        states[s].outputLink = states[f].pattern != none ? f : states[f].outputLink;
+        for (size_t c = 0; c < nrByteClasses; ++c) {
+            auto & t = next[s * nrByteClasses + c];
+            if (t == none)
+                t = next[f * nrByteClasses + c];
+            else {
+                fail[t] = next[f * nrByteClasses + c];
+                todo.push(t);
+            }
+        }
+    }
+}
+
+std::vector<AhoCorasick::Match> AhoCorasick::findMatches(std::string_view s) const
+{
+    std::vector<Match> res;
+
+    if (maxLength == 0) {
+        if (emptyPattern != none)
+            for (size_t pos = 0; pos <= s.size(); ++pos)
+                res.push_back({pos, emptyPattern});
+        return res;
+    }
+
+    /* The first pattern found so far that starts at position `pos`,
+       for `pos` in [cursor, cursor + maxLength). */
+    boost::container::small_vector<uint32_t, 64> best(maxLength, none);
+
+    /* Everything before `cursor` has been decided. */
+    size_t cursor = 0;
+
+    /* Decide what happens at `cursor`. This requires that every
+       occurrence starting there has been seen. */
+    auto decide = [&]() {
+        auto pos = cursor;
+        uint32_t pattern = none;
+        if (pos < s.size()) {
+            pattern = best[pos % maxLength];
+            best[pos % maxLength] = none;
+        }
+        pattern = std::min(pattern, emptyPattern);
+        if (pattern == none) {
+            cursor++;
+            return;
+        }
+        res.push_back({pos, pattern});
+        auto len = patterns_[pattern].size();
+        for (size_t i = pos + 1; i < pos + len; ++i)
+            best[i % maxLength] = none;
+        cursor = pos + std::max(len, (size_t) 1);
+    };
+
+    uint32_t state = 0;
+
+    for (size_t end = 0; end < s.size(); ++end) {
+        state = next[state * nrByteClasses + byteClass[(unsigned char) s[end]]];
+
+        for (auto t = states[state].pattern != none ? state : states[state].outputLink; t != none;
+             t = states[t].outputLink)
+        {
+            auto start = end + 1 - states[t].depth;
+            if (start >= cursor) {
+                auto & b = best[start % maxLength];
+                b = std::min(b, states[t].pattern);
+            }
+        }
+
+        /* Occurrences starting at `cursor` end at `cursor + maxLength
+           - 1` at the latest. */
+        while (cursor + maxLength <= end + 1)
+            decide();
+    }
+
+    while (cursor <= s.size())
+        decide();
+
+    return res;
+}
+
+}
@@ -144,15 +144,30 @@ static void parseContents(CreateRegularFileSink & sink, Source & source)
     uint64_t left = size;
     std::array<char, 65536> buf;
 
-    while (left) {
-        checkInterrupt();
-        auto n = buf.size();
-        if ((uint64_t)n > left) n = left;
-        source(buf.data(), n);
-        sink({buf.data(), n});
+    auto forward = [&](uint64_t len) {
+        while (len) {
+            checkInterrupt();
+            auto n = buf.size();
+            if ((uint64_t)n > len) n = len;
+            source(buf.data(), n);
+            sink({buf.data(), n});
+            len -= n;
+            left -= n;
+        }
+    };
+
+    /* If we're reading from a file descriptor, let the sink copy large
+       files directly from it, after passing on whatever the source has
+       already buffered. */
+    if (auto fdSource = dynamic_cast<FdSource *>(&source); fdSource && size >= buf.size()) {
+        forward(std::min<uint64_t>(left, fdSource->bufPosIn - fdSource->bufPosOut));
+        auto n = sink.copyFromFd(fdSource->fd, left);
+        fdSource->read += n;
         left -= n;
     }
 
+    forward(left);
+
     readPadding(size, source);
 }
 
@@ -282,6 +297,7 @@ void restorePath(const std::filesystem::path & path, Source & source, bool start
     RestoreSink sink{startFsync};
     sink.dstPath = path;
     parseDump(sink, source);
+    sink.finish();
 }
 
 
@@ -0,0 +1,98 @@
+#include "nix/util/cdc.hh"
+
+#include <array>
+#include <bit>
+#include <cassert>
+
+namespace nix {
+
+/* The "gear" table maps every byte value to a random 64-bit number.
+   It is generated with splitmix64 from a fixed seed. It is part of
+   the chunk format: changing it changes all chunk boundaries. */
+static constexpr std::array<uint64_t, 256> gearTable = []() {
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0x6e69782d63646331; // "nix-cdc1"
+    for (auto & n : table) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        n = z ^ (z >> 31);
+    }
+    return table;
+}();
+
+/* A mask of the `bits` most significant bits. The rolling hash shifts
+   left, so the high bits depend on the most bytes. */
+static constexpr uint64_t highMask(unsigned int bits)
+{
+    return bits == 0 ? 0 : ~uint64_t(0) << (64 - bits);
+}
+
+size_t findChunkBoundary(std::string_view data, const ChunkingParams & params)
+{
+    assert(std::has_single_bit(params.avgSize));
+    assert(params.minSize <= params.avgSize && params.avgSize <= params.maxSize);
+
+    size_t n = data.size();
+    if (n <= params.minSize)
+        return n;
+    if (n > params.maxSize)
+        n = params.maxSize;
+    size_t normal = std::min(n, params.avgSize);
+
+    /* Normalized chunking: use a stricter mask before the average
+       size and a looser one after it, so that chunk sizes cluster
+       around the average. */
+    unsigned int bits = std::countr_zero(params.avgSize);
+    uint64_t maskS = highMask(bits + 2);
+    uint64_t maskL = highMask(bits > 2 ? bits - 2 : 1);
+
+    auto p = (const unsigned char *) data.data();
+    uint64_t fp = 0;
+    size_t i = params.minSize;
+
+    for (; i < normal; ++i) {
+        fp = (fp << 1) + gearTable[p[i]];
+        if (!(fp & maskS))
+            return i + 1;
+    }
+
+    for (; i < n; ++i) {
+        fp = (fp << 1) + gearTable[p[i]];
+        if (!(fp & maskL))
+            return i + 1;
+    }
+
+    return n;
+}
+
+void ChunkingSink::operator () (std::string_view data)
+{
+    buffer.append(data);
+    emitChunks(false);
+}
+
+void ChunkingSink::finish()
+{
+    emitChunks(true);
+}
+
+void ChunkingSink::emitChunks(bool final)
+{
+    size_t pos = 0;
+
+    while (pos < buffer.size()) {
+        std::string_view rest(buffer.data() + pos, buffer.size() - pos);
+        /* Without `maxSize` bytes of lookahead, the boundary might
+           still move once more data arrives. */
+        if (!final && rest.size() < params.maxSize)
+            break;
+        auto len = findChunkBoundary(rest, params);
+        callback(rest.substr(0, len));
+        pos += len;
+    }
+
+    buffer.erase(0, pos);
+}
+
+}
@@ -3,11 +3,16 @@
 #include "nix/util/tarfile.hh"
 #include "nix/util/finally.hh"
 #include "nix/util/logging.hh"
+#include "nix/util/sync.hh"
 
 #include <archive.h>
 #include <archive_entry.h>
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
+#include <map>
+#include <queue>
+#include <thread>
 
 #include <brotli/decode.h>
 #include <brotli/encode.h>
@@ -283,10 +288,156 @@ struct BrotliCompressionSink : ChunkedCompressionSink
     }
 };
 
+/**
+ * Multi-threaded zstd compression. The input is cut into fixed-size
+ * blocks that are compressed independently on a set of worker
+ * threads, and the resulting zstd frames are written out in order.
+ * Since every block is a self-contained frame, the output can be
+ * decompressed by any zstd decoder, and it's deterministic regardless
+ * of the number of threads.
+ */
+struct ParallelZstdCompressionSink : CompressionSink
+{
+    static constexpr size_t blockSize = 4 * 1024 * 1024;
+
+    Sink & nextSink;
+    int level;
+    size_t nrThreads;
+
+    /* The block that is currently being filled. */
+    std::string block;
+
+    struct State
+    {
+        std::queue<std::pair<uint64_t, std::string>> pending;
+        /* Compressed blocks that haven't been written yet. */
+        std::map<uint64_t, std::string> done;
+        std::exception_ptr exc;
+        bool quit = false;
+    };
+
+    Sync<State> state_;
+    std::condition_variable wakeup, produced;
+    std::vector<std::thread> workers;
+
+    uint64_t nextIn = 0, nextOut = 0;
+
+    ParallelZstdCompressionSink(Sink & nextSink, int level)
+        : nextSink(nextSink)
+        , level(level)
+        , nrThreads(std::max(1U, std::thread::hardware_concurrency()))
+    {
+    }
+
+    ~ParallelZstdCompressionSink() override
+    {
+        state_.lock()->quit = true;
+        wakeup.notify_all();
+        for (auto & thr : workers)
+            thr.join();
+    }
+
+    void writeUnbuffered(std::string_view data) override
+    {
+        while (!data.empty()) {
+            if (block.empty())
+                block.reserve(blockSize);
+            auto n = std::min(blockSize - block.size(), data.size());
+            block.append(data.substr(0, n));
+            data.remove_prefix(n);
+            if (block.size() == blockSize)
+                submit();
+        }
+    }
+
+    void finish() override
+    {
+        flush();
+
+        /* Always emit at least one frame, so that the output starts
+           with a zstd frame header even for empty input. */
+        if (!block.empty() || nextIn == 0)
+            submit();
+
+        while (nextOut < nextIn)
+            writeNext();
+    }
+
+private:
+
+    void submit()
+    {
+        /* Bound the amount of memory used by blocks that are queued
+           or waiting to be written. */
+        while (nextIn - nextOut >= 2 * nrThreads)
+            writeNext();
+
+        if (workers.size() < nrThreads && workers.size() < nextIn - nextOut + 1)
+            workers.emplace_back([this]() { work(); });
+
+        state_.lock()->pending.emplace(nextIn++, std::move(block));
+        block.clear();
+        wakeup.notify_one();
+    }
+
+    /* Wait for the next block in sequence to be compressed and write
+       it to `nextSink`. */
+    void writeNext()
+    {
+        std::string data;
+        {
+            auto state(state_.lock());
+            while (true) {
+                if (state->exc)
+                    std::rethrow_exception(state->exc);
+                auto i = state->done.find(nextOut);
+                if (i != state->done.end()) {
+                    data = std::move(i->second);
+                    state->done.erase(i);
+                    break;
+                }
+                state.wait(produced);
+            }
+        }
+
+        nextSink(data);
+        nextOut++;
+    }
+
+    void work()
+    {
+        while (true) {
+            std::pair<uint64_t, std::string> item;
+            {
+                auto state(state_.lock());
+                while (!state->quit && state->pending.empty())
+                    state.wait(wakeup);
+                if (state->quit)
+                    return;
+                item = std::move(state->pending.front());
+                state->pending.pop();
+            }
+
+            try {
+                auto compressed = compress("zstd", item.second, false, level);
+                state_.lock()->done.emplace(item.first, std::move(compressed));
+            } catch (...) {
+                auto state(state_.lock());
+                if (!state->exc)
+                    state->exc = std::current_exception();
+            }
+
+            produced.notify_all();
+        }
+    }
+};
+
 ref<CompressionSink> makeCompressionSink(const std::string & method, Sink & nextSink, const bool parallel, int level)
 {
     std::vector<std::string> la_supports = {
         "bzip2", "compress", "grzip", "gzip", "lrzip", "lz4", "lzip", "lzma", "lzop", "xz", "zstd"};
+    if (method == "zstd" && parallel)
+        return make_ref<ParallelZstdCompressionSink>(nextSink, level);
     if (std::find(la_supports.begin(), la_supports.end(), method) != la_supports.end()) {
         return make_ref<ArchiveCompressionSink>(nextSink, method, parallel, level);
     }
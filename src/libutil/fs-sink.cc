@@ -3,6 +3,8 @@
 #include "nix/util/error.hh"
 #include "nix/util/config-global.hh"
 #include "nix/util/fs-sink.hh"
+#include "nix/util/thread-pool.hh"
+#include "nix/util/signals.hh"
 
 #ifdef _WIN32
 # include <fileapi.h>
@@ -66,8 +68,28 @@ struct RestoreSinkSettings : Config
 {
     Setting<bool> preallocateContents{this, false, "preallocate-contents",
         "Whether to preallocate files when writing objects with known size."};
+
+    Setting<unsigned int> restoreThreads{this, 1, "restore-threads",
+        R"(
+          The number of threads used to write small files when unpacking
+          Nix archives, e.g. when substituting store paths. With the
+          default of `1`, files are written one at a time. Higher values
+          can speed up unpacking store paths that contain many small files.
+        )"};
 };
 
+/**
+ * Files larger than this are always written directly rather than by
+ * `RestoreSink::AsyncWriter`.
+ */
+static constexpr uint64_t maxDeferredFileSize = 64 * 1024;
+
+/**
+ * Maximum number of bytes buffered for files that are waiting to be
+ * written by `RestoreSink::AsyncWriter`.
+ */
+static constexpr uint64_t maxDeferredBytes = 64 * 1024 * 1024;
+
 static RestoreSinkSettings restoreSinkSettings;
 
 static GlobalConfig::Register r1(&restoreSinkSettings);
@@ -80,6 +102,37 @@ static std::filesystem::path append(const std::filesystem::path & src, const Can
     return dst;
 }
 
+struct RestoreSink::AsyncWriter
+{
+    ThreadPool pool;
+
+    /**
+     * Number of bytes of file contents in the queue.
+     */
+    std::atomic<uint64_t> pendingBytes = 0;
+
+    /* Note that ThreadPool counts the thread that calls process() as
+       one of its threads. */
+    AsyncWriter(size_t threads)
+        : pool(threads + 1)
+    { }
+};
+
+RestoreSink::RestoreSink(bool startFsync)
+    : startFsync{startFsync}
+{
+    if (restoreSinkSettings.restoreThreads > 1)
+        asyncWriter = std::make_unique<AsyncWriter>(restoreSinkSettings.restoreThreads);
+}
+
+RestoreSink::~RestoreSink() = default;
+
+void RestoreSink::finish()
+{
+    if (asyncWriter) asyncWriter->pool.process();
+    asyncWriter.reset();
+}
+
 void RestoreSink::createDirectory(const CanonPath & path)
 {
     auto p = append(dstPath, path);
@@ -104,23 +157,127 @@ struct RestoreRegularFile : CreateRegularFileSink {
     void operator () (std::string_view data) override;
     void isExecutable() override;
     void preallocateContents(uint64_t size) override;
+    uint64_t copyFromFd(Descriptor from, uint64_t size) override;
+
+    void create(const std::filesystem::path & p, bool startFsync);
 };
 
-void RestoreSink::createRegularFile(const CanonPath & path, std::function<void(CreateRegularFileSink &)> func)
+void RestoreRegularFile::create(const std::filesystem::path & p, bool startFsync)
 {
-    auto p = append(dstPath, path);
-
-    RestoreRegularFile crf;
-    crf.startFsync = startFsync;
-    crf.fd =
+    this->startFsync = startFsync;
+    fd =
 #ifdef _WIN32
         CreateFileW(p.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL)
 #else
         open(p.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0666)
 #endif
         ;
-    if (!crf.fd) throw NativeSysError("creating file '%1%'", p);
-    func(crf);
+    if (!fd) throw NativeSysError("creating file '%1%'", p);
+}
+
+/**
+ * A regular file whose contents are buffered so that it can be
+ * written by `RestoreSink::AsyncWriter`, unless it turns out to be
+ * large, in which case it is written directly.
+ */
+struct DeferredRegularFile : CreateRegularFileSink
+{
+    std::filesystem::path path;
+    bool startFsync;
+
+    bool executable = false;
+    std::string contents;
+
+    /**
+     * Set if the file is being written directly.
+     */
+    std::optional<RestoreRegularFile> direct;
+
+    DeferredRegularFile(std::filesystem::path path, bool startFsync)
+        : path(std::move(path)), startFsync(startFsync)
+    { }
+
+    void isExecutable() override
+    {
+        executable = true;
+    }
+
+    void preallocateContents(uint64_t size) override
+    {
+        if (size <= maxDeferredFileSize) {
+            contents.reserve(size);
+            return;
+        }
+        direct.emplace();
+        direct->create(path, startFsync);
+        if (executable) direct->isExecutable();
+        direct->preallocateContents(size);
+    }
+
+    void operator () (std::string_view data) override
+    {
+        if (direct)
+            (*direct)(data);
+        else
+            contents.append(data);
+    }
+
+    uint64_t copyFromFd(Descriptor from, uint64_t size) override
+    {
+        return direct ? direct->copyFromFd(from, size) : 0;
+    }
+
+    /**
+     * Write the buffered contents, if any.
+     */
+    void write()
+    {
+        if (direct) return;
+        RestoreRegularFile file;
+        file.create(path, startFsync);
+        if (executable) file.isExecutable();
+        file(contents);
+    }
+};
+
+void RestoreSink::createRegularFile(const CanonPath & path, std::function<void(CreateRegularFileSink &)> func)
+{
+    auto p = append(dstPath, path);
+
+    if (!asyncWriter) {
+        RestoreRegularFile crf;
+        crf.create(p, startFsync);
+        func(crf);
+        return;
+    }
+
+    /* Buffer small files and let the thread pool write them. Since
+       the parent directory has already been created, files can be
+       written in any order. */
+    auto crf = std::make_shared<DeferredRegularFile>(std::move(p), startFsync);
+    func(*crf);
+
+    if (crf->direct) return;
+
+    auto size = crf->contents.size();
+    if (asyncWriter->pendingBytes + size > maxDeferredBytes) {
+        /* Don't let the queue grow without bound. */
+        crf->write();
+        return;
+    }
+
+    asyncWriter->pendingBytes += size;
+
+    try {
+        asyncWriter->pool.enqueue([crf, size, writer(asyncWriter.get())]() {
+            crf->write();
+            writer->pendingBytes -= size;
+        });
+    } catch (ThreadPoolShutDown &) {
+        /* A previous write failed, so rethrow its exception. */
+        asyncWriter->pool.process();
+        throw;
+    }
 }
 
 void RestoreRegularFile::isExecutable()
@@ -159,6 +316,26 @@ void RestoreRegularFile::operator () (std::string_view data)
     writeFull(fd.get(), data);
 }
 
+uint64_t RestoreRegularFile::copyFromFd(Descriptor from, uint64_t size)
+{
+    uint64_t copied = 0;
+#if HAVE_COPY_FILE_RANGE
+    /* Note that on file systems that support it, this creates a
+       reflink rather than copying the data. */
+    while (copied < size) {
+        checkInterrupt();
+        auto n = copy_file_range(from, nullptr, fd.get(), nullptr, size - copied, 0);
+        if (n == -1 && errno == EINTR) continue;
+        /* copy_file_range() fails if e.g. `from` is a pipe or the
+           files are on different file systems on older kernels. Let
+           the caller copy the rest. */
+        if (n <= 0) break;
+        copied += n;
+    }
+#endif
+    return copied;
+}
+
 void RestoreSink::createSymlink(const CanonPath & path, const std::string & target)
 {
     auto p = append(dstPath, path);
@@ -0,0 +1,92 @@
+#pragma once
+///@file
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nix {
+
+/**
+ * An Aho-Corasick automaton for finding occurrences of a list of
+ * patterns in a string in a single pass, in time linear in the length
+ * of the string plus the number of occurrences.
+ */
+class AhoCorasick
+{
+public:
+
+    struct Match
+    {
+        size_t pos;
+        size_t pattern;
+    };
+
+    explicit AhoCorasick(std::vector<std::string> patterns);
+
+    const std::vector<std::string> & patterns() const
+    {
+        return patterns_;
+    }
+
+    /**
+     * Scan `s` from left to right. At each position where some
+     * pattern occurs, take the first such pattern in `patterns()` and
+     * continue after it. An empty pattern occurs at every position,
+     * including `s.size()`; after it, the scan continues at the next
+     * position. These are the semantics of `builtins.replaceStrings`.
+     *
+     * Does not allocate if there are no matches (and the longest
+     * pattern is not longer than 64 bytes).
+     */
+    std::vector<Match> findMatches(std::string_view s) const;
+
+private:
+
+    static constexpr uint32_t none = UINT32_MAX;
+
+    std::vector<std::string> patterns_;
+
+    /**
+     * The first empty pattern, or `none`.
+     */
+    uint32_t emptyPattern = none;
+
+    size_t maxLength = 0;
+
+    /**
+     * Bytes that don't occur in any pattern have class 0.
+     */
+    std::array<uint16_t, 256> byteClass;
+    size_t nrByteClasses;
+
+    /**
+     * The transition of state `s` on byte class `c` is at
+     * `s * nrByteClasses + c`. State 0 is the start state.
+     */
+    std::vector<uint32_t> next;
+
+    struct State
+    {
+        /**
+         * The length of the string this state represents.
+         */
+        uint32_t depth = 0;
+
+        /**
+         * The first pattern equal to this state's string, or `none`.
+         */
+        uint32_t pattern = none;
+
+        /**
+         * The state for the longest proper suffix of this state's
+         * string that is equal to a pattern, or `none`.
+         */
+        uint32_t outputLink = none;
+    };
+
+    std::vector<State> states;
+};
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+///@file
+
+#include "nix/util/serialise.hh"
+
+#include <functional>
+
+namespace nix {
+
+/**
+ * Size limits for content-defined chunking. Chunk boundaries depend
+ * only on the data and on these parameters, so changing them means
+ * that previously stored chunks will no longer be reused.
+ */
+struct ChunkingParams
+{
+    size_t minSize = 64 * 1024;
+    size_t avgSize = 256 * 1024;
+    size_t maxSize = 1024 * 1024;
+};
+
+/**
+ * Return the length of the first chunk of `data`, using the FastCDC
+ * algorithm with normalized chunking. The result is at most
+ * `params.maxSize`; it is equal to `data.size()` if `data` contains
+ * no boundary. `params.avgSize` must be a power of two.
+ */
+size_t findChunkBoundary(std::string_view data, const ChunkingParams & params = {});
+
+/**
+ * A sink that splits the data written to it into content-defined
+ * chunks and passes every chunk to `callback`. Since a boundary can
+ * only be determined once `maxSize` bytes are available, chunks are
+ * passed on with some delay; `finish()` flushes the remainder.
+ */
+struct ChunkingSink : FinishSink
+{
+    typedef std::function<void(std::string_view chunk)> callback_t;
+
+    ChunkingSink(callback_t callback, const ChunkingParams & params = {})
+        : callback(std::move(callback))
+        , params(params)
+    { }
+
+    void operator () (std::string_view data) override;
+
+    void finish() override;
+
+private:
+    callback_t callback;
+    ChunkingParams params;
+    std::string buffer;
+
+    void emitChunks(bool final);
+};
+
+}
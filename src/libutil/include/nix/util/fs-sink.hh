@@ -20,6 +20,14 @@ struct CreateRegularFileSink : Sink
      * An optimization. By default, do nothing.
      */
     virtual void preallocateContents(uint64_t size) { };
+
+    /**
+     * An optimization: copy up to `size` bytes of contents from the
+     * current offset of `fd` without passing them through userspace,
+     * and return how many bytes were copied. The caller must pass the
+     * remaining bytes in the usual way. By default, copy nothing.
+     */
+    virtual uint64_t copyFromFd(Descriptor fd, uint64_t size) { return 0; };
 };
 
 
@@ -80,9 +88,9 @@ struct RestoreSink : FileSystemObjectSink
     std::filesystem::path dstPath;
     bool startFsync = false;
 
-    explicit RestoreSink(bool startFsync)
-        : startFsync{startFsync}
-    { }
+    explicit RestoreSink(bool startFsync);
+
+    ~RestoreSink();
 
     void createDirectory(const CanonPath & path) override;
 
@@ -91,6 +99,19 @@ struct RestoreSink : FileSystemObjectSink
         std::function<void(CreateRegularFileSink &)>) override;
 
     void createSymlink(const CanonPath & path, const std::string & target) override;
+
+    /**
+     * Wait until all regular files have been written. Small files may
+     * be written in the background (see the `restore-threads`
+     * setting), so this must be called before using the result.
+     */
+    void finish();
+
+private:
+
+    struct AsyncWriter;
+
+    std::unique_ptr<AsyncWriter> asyncWriter;
 };
 
 /**
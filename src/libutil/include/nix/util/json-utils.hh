@@ -61,6 +61,22 @@ Strings getStringList(const nlohmann::json & value);
 StringMap getStringMap(const nlohmann::json & value);
 StringSet getStringSet(const nlohmann::json & value);
 
+/**
+ * Return the position of the first byte in `s` at or after `pos` that
+ * can't be copied verbatim into or out of a JSON string literal: a
+ * double quote, a backslash, a control character or a non-ASCII
+ * byte. Returns `s.size()` if there is none. This scans a word at a
+ * time.
+ */
+size_t findJSONStringSpecial(std::string_view s, size_t pos);
+
+/**
+ * Return the length of the well-formed UTF-8 sequence at the start
+ * of `s`, or 0 if `s` doesn't start with one. Overlong encodings,
+ * surrogates and code points above U+10FFFF are not well-formed.
+ */
+size_t utf8SequenceLength(std::string_view s);
+
 /**
  * For `adl_serializer<std::optional<T>>` below, we need to track what
  * types are not already using `null`. Only for them can we use `null`
@@ -0,0 +1,92 @@
+#pragma once
+///@file
+
+#include "nix/util/serialise.hh"
+
+#include <nlohmann/json_fwd.hpp>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace nix {
+
+
+/**
+ * A streaming JSON serialiser that writes to a `Sink` without
+ * building a `nlohmann::json` first. The output is byte-for-byte
+ * identical to `nlohmann::json::dump(indent)` of the equivalent
+ * document.
+ *
+ * Output is buffered; call `flush()` when done. The destructor does
+ * not flush, since the document is incomplete if it runs because of
+ * an exception.
+ */
+class JSONWriter
+{
+private:
+
+    Sink & sink;
+
+    /**
+     * The number of spaces per nesting level, or -1 for compact
+     * output.
+     */
+    int indent;
+
+    std::string buf;
+
+    /**
+     * For every open object or array, whether it has any members yet.
+     */
+    std::vector<bool> hasMembers;
+
+    /**
+     * Whether the next value is the value of an object member whose
+     * key has just been written.
+     */
+    bool afterKey = false;
+
+public:
+
+    JSONWriter(Sink & sink, int indent = -1);
+
+    void null();
+    void boolean(bool b);
+    void integer(int64_t n);
+    void number(double d);
+    void string(std::string_view s);
+
+    /**
+     * Write an already constructed JSON value.
+     */
+    void json(const nlohmann::json & j);
+
+    void beginObject();
+    void key(std::string_view k);
+    void endObject();
+
+    void beginArray();
+    void endArray();
+
+    void flush();
+
+private:
+
+    void beginValue();
+
+    void endContainer(char c);
+
+    void newline(size_t depth);
+
+    void writeString(std::string_view s);
+
+    void maybeFlush()
+    {
+        if (buf.size() >= 65536) flush();
+    }
+};
+
+
+}
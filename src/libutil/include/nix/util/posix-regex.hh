@@ -0,0 +1,139 @@
+#pragma once
+///@file
+
+#include "nix/util/error.hh"
+#include "nix/util/sync.hh"
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace nix {
+
+MakeError(RegexError, Error);
+
+/**
+ * Thrown if a regular expression is too large to compile.
+ */
+MakeError(RegexSpaceError, RegexError);
+
+/**
+ * The offsets of a match and of its groups in the subject string.
+ */
+struct RegexMatch
+{
+    /**
+     * The start and end offsets of group `n` are at `2 * n` and
+     * `2 * n + 1`, where group 0 is the whole match. Groups that did
+     * not participate in the match have `std::string_view::npos`.
+     */
+    std::vector<size_t> offsets;
+
+    bool matched(size_t group) const
+    {
+        return offsets[2 * group] != std::string_view::npos;
+    }
+
+    size_t start(size_t group = 0) const
+    {
+        return offsets[2 * group];
+    }
+
+    size_t end(size_t group = 0) const
+    {
+        return offsets[2 * group + 1];
+    }
+
+    std::string_view str(std::string_view subject, size_t group = 0) const
+    {
+        return subject.substr(start(group), end(group) - start(group));
+    }
+};
+
+/**
+ * A POSIX extended regular expression, with the same syntax as
+ * `std::regex` with `std::regex::extended`. Matches are
+ * leftmost-longest, and among matches of the same length, groups are
+ * assigned as a backtracking matcher trying alternatives from left to
+ * right and repetitions greedily would assign them. `match()` gives
+ * the same results as `std::regex_match()`.
+ *
+ * libstdc++'s search is not always leftmost-longest, however (see
+ * `forEachMatch()`).
+ *
+ * Unlike libstdc++'s backtracking implementation, matching takes time
+ * linear in the length of the subject. The pattern is compiled into
+ * an NFA. Whole-string matches run on a DFA that is built lazily from
+ * it (and cached in this object), so only capturing groups require
+ * simulating the NFA. If the DFA grows too large, matching falls back
+ * to the NFA.
+ *
+ * Characters are bytes; character classes use the "C" locale.
+ */
+class PosixRegex
+{
+public:
+    struct Program;
+
+    /**
+     * Compile `pattern`. Throws `RegexError` if it is not a valid
+     * regular expression and `RegexSpaceError` if it is too large.
+     */
+    explicit PosixRegex(std::string_view pattern);
+
+    ~PosixRegex();
+
+    /**
+     * The number of capturing groups.
+     */
+    size_t groups() const;
+
+    /**
+     * Return whether all of `subject` matches. If so and `match` is
+     * not null, store the offsets of the groups in it.
+     */
+    bool match(std::string_view subject, RegexMatch * match = nullptr) const;
+
+    /**
+     * Call `callback` for every match in `subject`, in the same order
+     * and with the same results as `std::cregex_iterator`. In
+     * particular, a match that immediately follows an empty match must
+     * be non-empty.
+     *
+     * libstdc++'s search can stop at a shorter match when a
+     * repetition could either iterate again or be left on the same
+     * byte, e.g. it finds `a` rather than `ab` for `(a*)(ab|a)?` in
+     * `bab`. For such patterns this tries `std::regex` itself first.
+     * If its backtracking takes too long, it gives up and returns the
+     * leftmost-longest matches instead, which may differ from what
+     * `std::regex` would eventually have returned. Otherwise, it runs
+     * in time linear in the length of the subject.
+     */
+    void forEachMatch(std::string_view subject, std::function<void(const RegexMatch &)> callback) const;
+
+private:
+    std::unique_ptr<const Program> program;
+
+    struct Dfa;
+    std::unique_ptr<Sync<Dfa>> dfa;
+
+    struct Fallback;
+    std::unique_ptr<Sync<Fallback>> fallback;
+
+    /**
+     * Call `callback` for the matches found by `std::regex`. Returns
+     * false without calling `callback` if `std::regex` takes too
+     * many steps.
+     */
+    bool forEachMatchBacktracking(std::string_view subject, std::function<void(const RegexMatch &)> callback) const;
+
+    /**
+     * Run the DFA over `subject`. Returns `std::nullopt` if the DFA
+     * became too large.
+     */
+    std::optional<bool> dfaMatch(std::string_view subject) const;
+};
+
+}
@@ -2,6 +2,7 @@
 #include "nix/util/error.hh"
 #include "nix/util/types.hh"
 #include <nlohmann/json_fwd.hpp>
+#include <cstring>
 #include <iostream>
 #include <optional>
 
@@ -146,4 +147,63 @@ StringSet getStringSet(const nlohmann::json & value)
 
     return stringSet;
 }
+
+size_t findJSONStringSpecial(std::string_view s, size_t pos)
+{
+    constexpr uint64_t ones = 0x0101010101010101ULL;
+    constexpr uint64_t highs = 0x8080808080808080ULL;
+
+    auto hasZero = [&](uint64_t x) { return (x - ones) & ~x & highs; };
+
+    while (pos + 8 <= s.size()) {
+        uint64_t x;
+        std::memcpy(&x, s.data() + pos, 8);
+        /* Non-ASCII bytes, bytes below 0x20, '"' and '\\'. */
+        if ((x | ((x - ones * 0x20) & ~x) | hasZero(x ^ (ones * '"')) | hasZero(x ^ (ones * '\\'))) & highs)
+            break;
+        pos += 8;
+    }
+
+    for (; pos < s.size(); ++pos) {
+        unsigned char c = s[pos];
+        if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\')
+            break;
+    }
+
+    return pos;
+}
+
+size_t utf8SequenceLength(std::string_view s)
+{
+    if (s.empty()) return 0;
+
+    unsigned char c = s[0];
+    if (c < 0x80) return 1;
+
+    /* See table 3-7 in the Unicode standard. */
+    size_t len;
+    unsigned char lo = 0x80, hi = 0xbf;
+    if (c >= 0xc2 && c <= 0xdf) len = 2;
+    else if (c >= 0xe0 && c <= 0xef) {
+        len = 3;
+        if (c == 0xe0) lo = 0xa0;
+        else if (c == 0xed) hi = 0x9f;
+    }
+    else if (c >= 0xf0 && c <= 0xf4) {
+        len = 4;
+        if (c == 0xf0) lo = 0x90;
+        else if (c == 0xf4) hi = 0x8f;
+    }
+    else return 0;
+
+    if (s.size() < len) return 0;
+
+    unsigned char c1 = s[1];
+    if (c1 < lo || c1 > hi) return 0;
+    for (size_t i = 2; i < len; ++i)
+        if (((unsigned char) s[i] & 0xc0) != 0x80) return 0;
+
+    return len;
+}
+
 }
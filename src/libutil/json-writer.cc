@@ -0,0 +1,199 @@
+#include "nix/util/json-writer.hh"
+#include "nix/util/json-utils.hh"
+
+#include <cassert>
+#include <charconv>
+
+
+namespace nix {
+
+
+JSONWriter::JSONWriter(Sink & sink, int indent)
+    : sink(sink), indent(indent)
+{
+}
+
+
+void JSONWriter::flush()
+{
+    if (buf.empty()) return;
+    sink(buf);
+    buf.clear();
+}
+
+
+void JSONWriter::newline(size_t depth)
+{
+    buf += '\n';
+    buf.append(depth * indent, ' ');
+}
+
+
+void JSONWriter::beginValue()
+{
+    maybeFlush();
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    if (hasMembers.empty()) return;
+    if (hasMembers.back()) buf += ',';
+    hasMembers.back() = true;
+    if (indent >= 0) newline(hasMembers.size());
+}
+
+
+void JSONWriter::endContainer(char c)
+{
+    assert(!hasMembers.empty() && !afterKey);
+    bool nonEmpty = hasMembers.back();
+    hasMembers.pop_back();
+    if (nonEmpty && indent >= 0) newline(hasMembers.size());
+    buf += c;
+}
+
+
+void JSONWriter::null()
+{
+    beginValue();
+    buf += "null";
+}
+
+
+void JSONWriter::boolean(bool b)
+{
+    beginValue();
+    buf += b ? "true" : "false";
+}
+
+
+void JSONWriter::integer(int64_t n)
+{
+    beginValue();
+    char tmp[24];
+    auto [end, ec] = std::to_chars(tmp, tmp + sizeof(tmp), n);
+    buf.append(tmp, end);
+}
+
+
+void JSONWriter::number(double d)
+{
+    beginValue();
+    /* Let nlohmann produce the shortest representation that round
+       trips, so that the output doesn't change. */
+    buf += nlohmann::json(d).dump();
+}
+
+
+void JSONWriter::string(std::string_view s)
+{
+    beginValue();
+    writeString(s);
+}
+
+
+void JSONWriter::json(const nlohmann::json & j)
+{
+    beginValue();
+    auto s = j.dump(indent);
+    if (indent > 0 && !hasMembers.empty()) {
+        /* `dump()` indents as if `j` were at the top level. */
+        for (auto c : s) {
+            if (c == '\n')
+                newline(hasMembers.size());
+            else
+                buf += c;
+        }
+    } else
+        buf += s;
+}
+
+
+void JSONWriter::beginObject()
+{
+    beginValue();
+    buf += '{';
+    hasMembers.push_back(false);
+}
+
+
+void JSONWriter::key(std::string_view k)
+{
+    assert(!hasMembers.empty() && !afterKey);
+    beginValue();
+    writeString(k);
+    buf += indent >= 0 ? ": " : ":";
+    afterKey = true;
+}
+
+
+void JSONWriter::endObject()
+{
+    endContainer('}');
+}
+
+
+void JSONWriter::beginArray()
+{
+    beginValue();
+    buf += '[';
+    hasMembers.push_back(false);
+}
+
+
+void JSONWriter::endArray()
+{
+    endContainer(']');
+}
+
+
+void JSONWriter::writeString(std::string_view s)
+{
+    auto start = buf.size();
+    buf += '"';
+
+    size_t pos = 0;
+    while (true) {
+        auto next = findJSONStringSpecial(s, pos);
+        buf.append(s.data() + pos, next - pos);
+        if (next == s.size()) break;
+
+        unsigned char c = s[next];
+
+        if (c >= 0x80) {
+            auto len = utf8SequenceLength(s.substr(next));
+            if (!len) {
+                /* Let nlohmann throw its usual error about the
+                   invalid UTF-8. */
+                buf.resize(start);
+                buf += nlohmann::json(std::string(s)).dump();
+                return;
+            }
+            buf.append(s.data() + next, len);
+            pos = next + len;
+            continue;
+        }
+
+        switch (c) {
+        case '"': buf += "\\\""; break;
+        case '\\': buf += "\\\\"; break;
+        case '\b': buf += "\\b"; break;
+        case '\f': buf += "\\f"; break;
+        case '\n': buf += "\\n"; break;
+        case '\r': buf += "\\r"; break;
+        case '\t': buf += "\\t"; break;
+        default: {
+            static constexpr char hex[] = "0123456789abcdef";
+            buf += "\\u00";
+            buf += hex[c >> 4];
+            buf += hex[c & 0xf];
+        }
+        }
+        pos = next + 1;
+    }
+
+    buf += '"';
+}
+
+
+}
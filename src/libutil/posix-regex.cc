@@ -0,0 +1,1119 @@
+#include "nix/util/posix-regex.hh"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <regex>
+
+namespace nix {
+
+namespace {
+
+/**
+ * Maximum number of NFA instructions, corresponding to libstdc++'s
+ * `_GLIBCXX_REGEX_STATE_LIMIT`. Counted repetitions are expanded, so
+ * this also bounds things like `(a{1000}){1000}`.
+ */
+constexpr size_t maxProgramSize = 100000;
+
+/**
+ * Maximum nesting of groups and repetitions, to bound the recursion
+ * depth of the parser and compiler.
+ */
+constexpr unsigned int maxNesting = 1000;
+
+/**
+ * Maximum number of DFA states per expression. If a match needs more,
+ * the cache is discarded and the match runs on the NFA instead.
+ */
+constexpr size_t maxDfaStates = 4096;
+
+/**
+ * Maximum number of instructions visited while checking whether
+ * repetitions are deterministic. Beyond that, they're assumed not to
+ * be.
+ */
+constexpr size_t maxDeterminismWork = 1000000;
+
+/**
+ * Maximum number of subject iterator operations that `std::regex` may
+ * perform per byte of the subject (plus one) before
+ * `forEachMatchBacktracking()` gives up on it. This bounds the
+ * exponential cases of its backtracking to a fraction of a second.
+ */
+constexpr size_t maxBacktrackingStepsPerByte = 1 << 16;
+
+/**
+ * A `const char *` that counts how often `std::regex` uses it, and
+ * throws `BacktrackingLimit` once `limit` is reached.
+ */
+struct CountingIterator
+{
+    struct Budget
+    {
+        size_t steps = 0;
+        size_t limit;
+    };
+
+    struct BacktrackingLimit
+    { };
+
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = char;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const char *;
+    using reference = const char &;
+
+    const char * p = nullptr;
+    Budget * budget = nullptr;
+
+    void step() const
+    {
+        if (++budget->steps > budget->limit) throw BacktrackingLimit();
+    }
+
+    reference operator *() const { step(); return *p; }
+    CountingIterator & operator ++() { step(); ++p; return *this; }
+    CountingIterator & operator --() { step(); --p; return *this; }
+    CountingIterator operator ++(int) { auto tmp = *this; ++*this; return tmp; }
+    CountingIterator operator --(int) { auto tmp = *this; --*this; return tmp; }
+    bool operator ==(const CountingIterator & other) const { return p == other.p; }
+};
+
+typedef std::bitset<256> CharSet;
+
+struct Inst
+{
+    enum Op : uint8_t {
+        /**
+         * Consume a byte in `charSets[x]`.
+         */
+        Char,
+        /**
+         * Continue at `x`, or (with lower priority) at `y`.
+         */
+        Split,
+        /**
+         * Continue at `x`.
+         */
+        Jmp,
+        /**
+         * Record the current position in capture slot `x`.
+         */
+        Save,
+        /**
+         * The end of the body of a loop: continue at the `Split` at `x`.
+         * However, if the iteration was empty, that is, slot `y` still
+         * holds the current position, leave the loop instead. This gives
+         * the groups inside the loop the values of an empty last
+         * iteration, as with libstdc++.
+         */
+        Loop,
+        /**
+         * Assert that this is the start of the subject.
+         */
+        Bol,
+        /**
+         * Assert that this is the end of the subject.
+         */
+        Eol,
+        Match,
+    };
+
+    Op op;
+    uint32_t x = 0, y = 0;
+};
+
+struct Node
+{
+    enum Kind { Concat, Alt, Char, Bol, Eol, Group, Repeat };
+
+    static constexpr uint32_t unbounded = UINT32_MAX;
+
+    Kind kind;
+    uint32_t arg = 0; //< `Char`: the character set; `Group`: the group number; `Repeat`: the minimum
+    uint32_t max = 0; //< `Repeat`: the maximum, or `unbounded`
+    std::vector<Node> children;
+};
+
+}
+
+struct PosixRegex::Program
+{
+    std::string pattern;
+    std::vector<Inst> insts;
+    std::vector<CharSet> charSets;
+    size_t nrGroups = 0;
+
+    /**
+     * Extra slots used by `Loop` instructions, after the capture
+     * slots.
+     */
+    size_t nrLoopSlots = 0;
+
+    /**
+     * Bytes that no character set distinguishes get the same class,
+     * which keeps the DFA transition tables small.
+     */
+    std::array<uint16_t, 256> byteClass;
+    size_t nrByteClasses = 0;
+
+    /**
+     * If set, a match must start with a byte in `firstBytes`, so a
+     * search can skip other bytes.
+     */
+    bool useFirstBytes = false;
+    CharSet firstBytes;
+
+    /**
+     * The `Split` instructions that choose between another iteration
+     * of a repetition (`x`) and leaving it (`y`).
+     */
+    std::vector<uint32_t> repeatSplits;
+
+    /**
+     * Whether the body of some repetition with a choice between
+     * iterating and leaving can match the empty string.
+     */
+    bool nullableRepeat = false;
+
+    /**
+     * Whether the next byte always decides whether a repetition
+     * iterates again or is left, i.e. no repetition has a nullable
+     * body and no byte can both start another iteration and start
+     * what follows the repetition.
+     *
+     * libstdc++'s backtracking search doesn't look for a longer match
+     * after leaving a repetition once another iteration has led to a
+     * match, so it can return a shorter match than leftmost-longest.
+     * For deterministic repetitions, that never happens.
+     */
+    bool deterministicRepeats = false;
+
+    size_t nrCaptureSlots() const
+    {
+        return 2 * (nrGroups + 1);
+    }
+
+    size_t nrSlots() const
+    {
+        return nrCaptureSlots() + nrLoopSlots;
+    }
+};
+
+namespace {
+
+static CharSet classSet(std::string_view name)
+{
+    int (*pred)(int) = nullptr;
+    bool underscore = false;
+    if (name == "alnum") pred = isalnum;
+    else if (name == "alpha") pred = isalpha;
+    else if (name == "blank") pred = isblank;
+    else if (name == "cntrl") pred = iscntrl;
+    else if (name == "digit" || name == "d") pred = isdigit;
+    else if (name == "graph") pred = isgraph;
+    else if (name == "lower") pred = islower;
+    else if (name == "print") pred = isprint;
+    else if (name == "punct") pred = ispunct;
+    else if (name == "space" || name == "s") pred = isspace;
+    else if (name == "upper") pred = isupper;
+    else if (name == "xdigit") pred = isxdigit;
+    else if (name == "w") { pred = isalnum; underscore = true; }
+    else throw RegexError("invalid character class '%s'", name);
+
+    /* Like `std::regex` in the classic locale, only ASCII characters
+       belong to a class. */
+    CharSet set;
+    for (int c = 0; c < 128; ++c)
+        if (pred(c)) set.set(c);
+    if (underscore) set.set('_');
+    return set;
+}
+
+/**
+ * Recursive descent parser for POSIX extended regular expressions,
+ * following the grammar accepted by libstdc++'s `std::regex::extended`.
+ */
+struct Parser
+{
+    std::string_view s;
+    size_t pos = 0;
+    PosixRegex::Program & prog;
+
+    [[noreturn]] void fail(std::string_view msg)
+    {
+        throw RegexError("%s at offset %d", msg, pos);
+    }
+
+    bool atEnd() const
+    {
+        return pos == s.size();
+    }
+
+    Node charNode(const CharSet & set)
+    {
+        prog.charSets.push_back(set);
+        return Node{.kind = Node::Char, .arg = (uint32_t) (prog.charSets.size() - 1)};
+    }
+
+    Node parseAlt(unsigned int depth)
+    {
+        Node first = parseConcat(depth);
+        if (atEnd() || s[pos] != '|') return first;
+        Node alt{.kind = Node::Alt};
+        alt.children.push_back(std::move(first));
+        while (!atEnd() && s[pos] == '|') {
+            pos++;
+            alt.children.push_back(parseConcat(depth));
+        }
+        return alt;
+    }
+
+    Node parseConcat(unsigned int depth)
+    {
+        Node concat{.kind = Node::Concat};
+        while (!atEnd() && s[pos] != '|' && s[pos] != ')')
+            concat.children.push_back(parseTerm(depth));
+        return concat;
+    }
+
+    Node parseTerm(unsigned int depth)
+    {
+        if (s[pos] == '^') { pos++; return Node{.kind = Node::Bol}; }
+        if (s[pos] == '$') { pos++; return Node{.kind = Node::Eol}; }
+
+        Node node = parseAtom(depth);
+
+        while (!atEnd()) {
+            uint32_t min, max;
+            char c = s[pos];
+            if (c == '*') { min = 0; max = Node::unbounded; pos++; }
+            else if (c == '+') { min = 1; max = Node::unbounded; pos++; }
+            else if (c == '?') { min = 0; max = 1; pos++; }
+            else if (c == '{') {
+                pos++;
+                min = max = parseCount();
+                if (!atEnd() && s[pos] == ',') {
+                    pos++;
+                    max = !atEnd() && isdigit(s[pos]) ? parseCount() : Node::unbounded;
+                }
+                if (atEnd() || s[pos] != '}') fail("invalid repetition count");
+                pos++;
+                if (max < min) fail("invalid repetition count");
+            } else
+                break;
+            if (++depth > maxNesting)
+                throw RegexSpaceError("regular expression is nested too deeply");
+            Node repeat{.kind = Node::Repeat, .arg = min, .max = max};
+            repeat.children.push_back(std::move(node));
+            node = std::move(repeat);
+        }
+
+        return node;
+    }
+
+    uint32_t parseCount()
+    {
+        if (atEnd() || !isdigit(s[pos])) fail("invalid repetition count");
+        size_t n = 0;
+        while (!atEnd() && isdigit(s[pos])) {
+            n = n * 10 + (s[pos++] - '0');
+            if (n > maxProgramSize)
+                throw RegexSpaceError("repetition count is too large");
+        }
+        return n;
+    }
+
+    Node parseAtom(unsigned int depth)
+    {
+        char c = s[pos++];
+        switch (c) {
+
+        case '(': {
+            if (depth + 1 > maxNesting)
+                throw RegexSpaceError("regular expression is nested too deeply");
+            Node group{.kind = Node::Group, .arg = (uint32_t) ++prog.nrGroups};
+            group.children.push_back(parseAlt(depth + 1));
+            if (atEnd() || s[pos] != ')') fail("unmatched '('");
+            pos++;
+            return group;
+        }
+
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            pos--;
+            fail("repetition operator without operand");
+
+        case '[':
+            return charNode(parseBracket());
+
+        case '.': {
+            /* Like libstdc++, match anything but NUL. */
+            CharSet set;
+            set.set();
+            set.reset(0);
+            return charNode(set);
+        }
+
+        case '\\': {
+            if (atEnd()) fail("trailing backslash");
+            c = s[pos++];
+            if (!strchr("^$\\.*+?()[{|", c)) {
+                pos--;
+                fail("invalid escape sequence");
+            }
+            [[fallthrough]];
+        }
+
+        default: {
+            CharSet set;
+            set.set((unsigned char) c);
+            return charNode(set);
+        }
+        }
+    }
+
+    /**
+     * Parse the inside of a bracket expression. As in libstdc++, only a
+     * single character (possibly written as a collating element) can
+     * start a range, only an ordinary character can end one, and a '-'
+     * is a literal only at the start or end of the expression.
+     */
+    CharSet parseBracket()
+    {
+        CharSet set;
+        bool negate = false;
+        if (!atEnd() && s[pos] == '^') {
+            negate = true;
+            pos++;
+        }
+
+        /* The last character, if it may still start a range, or -1. */
+        int last = -1;
+
+        auto pushChar = [&](unsigned char c) {
+            if (last >= 0) set.set(last);
+            last = c;
+        };
+
+        auto pushClass = [&](const CharSet & cls) {
+            if (last >= 0) set.set(last);
+            last = -1;
+            set |= cls;
+        };
+
+        for (bool first = true; ; first = false) {
+            if (atEnd()) fail("unmatched '['");
+            char c = s[pos++];
+
+            if (c == '[' && !atEnd() && strchr(".:=", s[pos])) {
+                char kind = s[pos];
+                auto end = s.find(std::string{kind, ']'}, pos + 1);
+                if (end == s.npos) fail("unmatched '['");
+                auto name = s.substr(pos + 1, end - pos - 1);
+                pos = end + 2;
+                if (kind == ':')
+                    pushClass(classSet(name));
+                else {
+                    if (name.size() != 1) fail("unsupported collating element");
+                    unsigned char ch = name[0];
+                    if (kind == '.')
+                        pushChar(ch);
+                    else
+                        /* libstdc++ compares the lowercase forms. */
+                        pushClass(CharSet().set(ch).set(tolower(ch)).set(toupper(ch)));
+                }
+            }
+
+            /* A ']' is a literal if it comes first. */
+            else if (c == ']' && !first)
+                break;
+
+            else if (c == '-' && !first) {
+                if (!atEnd() && s[pos] == ']')
+                    pushChar('-');
+                else if (last < 0)
+                    fail("invalid use of '-' in bracket expression");
+                else {
+                    if (atEnd()) fail("unmatched '['");
+                    if (s[pos] == '[' && pos + 1 < s.size() && strchr(".:=", s[pos + 1]))
+                        fail("invalid range");
+                    unsigned char hi = s[pos++];
+                    if (last > hi) fail("invalid range");
+                    for (unsigned int ch = last; ch <= hi; ++ch)
+                        set.set(ch);
+                    last = -1;
+                }
+            }
+
+            else
+                pushChar(c);
+        }
+
+        if (last >= 0) set.set(last);
+        if (negate) set.flip();
+        return set;
+    }
+};
+
+struct Compiler
+{
+    PosixRegex::Program & prog;
+
+    uint32_t add(Inst inst)
+    {
+        if (prog.insts.size() >= maxProgramSize)
+            throw RegexSpaceError("regular expression is too large");
+        prog.insts.push_back(inst);
+        return prog.insts.size() - 1;
+    }
+
+    uint32_t here() const
+    {
+        return prog.insts.size();
+    }
+
+    /**
+     * Whether `node` can match the empty string.
+     */
+    static bool nullable(const Node & node)
+    {
+        switch (node.kind) {
+        case Node::Concat:
+            return std::all_of(node.children.begin(), node.children.end(), nullable);
+        case Node::Alt:
+            return std::any_of(node.children.begin(), node.children.end(), nullable);
+        case Node::Char:
+            return false;
+        case Node::Bol:
+        case Node::Eol:
+            return true;
+        case Node::Group:
+            return nullable(node.children[0]);
+        case Node::Repeat:
+            return node.arg == 0 || nullable(node.children[0]);
+        }
+        return false;
+    }
+
+    void emit(const Node & node)
+    {
+        switch (node.kind) {
+
+        case Node::Concat:
+            for (auto & child : node.children)
+                emit(child);
+            break;
+
+        case Node::Alt: {
+            std::vector<uint32_t> jumps;
+            for (size_t i = 0; i < node.children.size(); ++i) {
+                if (i + 1 < node.children.size()) {
+                    auto split = add({Inst::Split});
+                    prog.insts[split].x = here();
+                    emit(node.children[i]);
+                    jumps.push_back(add({Inst::Jmp}));
+                    prog.insts[split].y = here();
+                } else
+                    emit(node.children[i]);
+            }
+            for (auto jump : jumps)
+                prog.insts[jump].x = here();
+            break;
+        }
+
+        case Node::Char:
+            add({Inst::Char, node.arg});
+            break;
+
+        case Node::Bol:
+            add({Inst::Bol});
+            break;
+
+        case Node::Eol:
+            add({Inst::Eol});
+            break;
+
+        case Node::Group:
+            add({Inst::Save, 2 * node.arg});
+            emit(node.children[0]);
+            add({Inst::Save, 2 * node.arg + 1});
+            break;
+
+        case Node::Repeat: {
+            auto & child = node.children[0];
+            for (uint32_t i = 0; i < node.arg; ++i)
+                emit(child);
+            if (node.max == Node::unbounded) {
+                /* Greedy: prefer another iteration over stopping. */
+                if (nullable(child)) {
+                    prog.nullableRepeat = true;
+                    /* Emit the body twice, and after a non-empty
+                       iteration continue in the other copy, so that an
+                       empty iteration at the end isn't cut short by
+                       instructions already visited at this position. */
+                    uint32_t slot = prog.nrCaptureSlots() + prog.nrLoopSlots++;
+                    uint32_t splits[2], loops[2];
+                    for (int i = 0; i < 2; ++i) {
+                        splits[i] = add({Inst::Split});
+                        prog.insts[splits[i]].x = here();
+                        add({Inst::Save, slot});
+                        emit(child);
+                        loops[i] = add({Inst::Loop, 0, slot});
+                    }
+                    for (int i = 0; i < 2; ++i) {
+                        prog.insts[splits[i]].y = here();
+                        prog.insts[loops[i]].x = splits[1 - i];
+                    }
+                } else {
+                    auto split = add({Inst::Split});
+                    prog.insts[split].x = here();
+                    prog.repeatSplits.push_back(split);
+                    emit(child);
+                    add({Inst::Jmp, split});
+                    prog.insts[split].y = here();
+                }
+            } else {
+                if (node.max > node.arg && nullable(child))
+                    prog.nullableRepeat = true;
+                std::vector<uint32_t> splits;
+                for (uint32_t i = node.arg; i < node.max; ++i) {
+                    auto split = add({Inst::Split});
+                    prog.insts[split].x = here();
+                    splits.push_back(split);
+                    prog.repeatSplits.push_back(split);
+                    emit(child);
+                }
+                for (auto split : splits)
+                    prog.insts[split].y = here();
+            }
+            break;
+        }
+        }
+    }
+};
+
+/**
+ * A set of small integers with constant-time clearing.
+ */
+struct SparseSet
+{
+    std::vector<uint32_t> sparse, dense;
+    size_t size = 0;
+
+    SparseSet(size_t capacity)
+        : sparse(capacity), dense(capacity)
+    { }
+
+    bool contains(uint32_t n) const
+    {
+        auto i = sparse[n];
+        return i < size && dense[i] == n;
+    }
+
+    void insert(uint32_t n)
+    {
+        sparse[n] = size;
+        dense[size++] = n;
+    }
+
+    void clear()
+    {
+        size = 0;
+    }
+};
+
+/**
+ * Compute the ε-closure of `start` without tracking captures, as
+ * used by the DFA. The result contains the `Char` and `Match`
+ * instructions reached, and the `Eol` instructions that would be
+ * passed at the end of the subject (unless `eol` is set, in which
+ * case they are followed).
+ */
+static std::vector<uint32_t> closure(
+    const PosixRegex::Program & prog, const std::vector<uint32_t> & start, bool bol, bool eol, SparseSet & visited)
+{
+    std::vector<uint32_t> res;
+    std::vector<uint32_t> stack(start.rbegin(), start.rend());
+    visited.clear();
+    while (!stack.empty()) {
+        auto pc = stack.back();
+        stack.pop_back();
+        if (visited.contains(pc)) continue;
+        visited.insert(pc);
+        auto & inst = prog.insts[pc];
+        switch (inst.op) {
+        case Inst::Split:
+            stack.push_back(inst.y);
+            stack.push_back(inst.x);
+            break;
+        case Inst::Jmp:
+        case Inst::Loop:
+            stack.push_back(inst.x);
+            break;
+        case Inst::Save:
+            stack.push_back(pc + 1);
+            break;
+        case Inst::Bol:
+            if (bol) stack.push_back(pc + 1);
+            break;
+        case Inst::Eol:
+            if (eol) stack.push_back(pc + 1);
+            else res.push_back(pc);
+            break;
+        case Inst::Char:
+        case Inst::Match:
+            res.push_back(pc);
+            break;
+        }
+    }
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+/**
+ * Simulation of the NFA with capture tracking (a "Pike VM"). Threads
+ * are kept in priority order, and of the threads that reach the same
+ * instruction at the same position only the one with the highest
+ * priority is kept. This yields the same groups as a backtracking
+ * matcher would, in time linear in the length of the subject.
+ */
+struct PikeVM
+{
+    enum Mode {
+        /**
+         * The match must span the whole subject.
+         */
+        Exact,
+        /**
+         * Find the leftmost-longest match starting at or after `from`.
+         */
+        Search,
+        /**
+         * Find the longest non-empty match starting at `from`.
+         */
+        ContinuousNotNull,
+    };
+
+    const PosixRegex::Program & prog;
+    std::string_view subject;
+    size_t nrSlots;
+
+    struct ThreadList
+    {
+        SparseSet visited;
+        std::vector<uint32_t> pcs;
+        std::vector<size_t> slots;
+
+        ThreadList(size_t nrInsts)
+            : visited(nrInsts)
+        { }
+
+        void clear()
+        {
+            visited.clear();
+            pcs.clear();
+            slots.clear();
+        }
+    };
+
+    ThreadList clist, nlist;
+
+    /**
+     * The capture slots of the thread being added.
+     */
+    std::vector<size_t> work;
+
+    struct StackEntry
+    {
+        uint32_t pc;
+        bool restore = false;
+        size_t old = 0;
+    };
+
+    std::vector<StackEntry> stack;
+
+    PikeVM(const PosixRegex::Program & prog, std::string_view subject)
+        : prog(prog)
+        , subject(subject)
+        , nrSlots(prog.nrSlots())
+        , clist(prog.insts.size())
+        , nlist(prog.insts.size())
+        , work(nrSlots)
+    { }
+
+    /**
+     * Add the thread at `pc0` with capture slots `work`, and all
+     * threads reachable from it without consuming input, to `list`.
+     */
+    void addThread(ThreadList & list, uint32_t pc0, size_t pos)
+    {
+        stack.push_back({pc0});
+        while (!stack.empty()) {
+            auto e = stack.back();
+            stack.pop_back();
+            if (e.restore) {
+                work[e.pc] = e.old;
+                continue;
+            }
+            auto pc = e.pc;
+            if (list.visited.contains(pc)) continue;
+            list.visited.insert(pc);
+            auto & inst = prog.insts[pc];
+            switch (inst.op) {
+            case Inst::Split:
+                stack.push_back({inst.y});
+                stack.push_back({inst.x});
+                break;
+            case Inst::Jmp:
+                stack.push_back({inst.x});
+                break;
+            case Inst::Loop:
+                stack.push_back({work[inst.y] == pos ? prog.insts[inst.x].y : inst.x});
+                break;
+            case Inst::Save:
+                /* Restore the slot once everything reachable from
+                   here has been added. */
+                stack.push_back({inst.x, true, work[inst.x]});
+                work[inst.x] = pos;
+                stack.push_back({pc + 1});
+                break;
+            case Inst::Bol:
+                if (pos == 0) stack.push_back({pc + 1});
+                break;
+            case Inst::Eol:
+                if (pos == subject.size()) stack.push_back({pc + 1});
+                break;
+            case Inst::Char:
+            case Inst::Match:
+                list.pcs.push_back(pc);
+                list.slots.insert(list.slots.end(), work.begin(), work.end());
+                break;
+            }
+        }
+    }
+
+    std::optional<RegexMatch> run(size_t from, Mode mode)
+    {
+        const size_t npos = std::string_view::npos;
+        std::optional<RegexMatch> best;
+
+        clist.clear();
+
+        for (size_t pos = from; pos <= subject.size(); ++pos) {
+            if (!best && (mode == Search || pos == from)) {
+                if (mode == Search && clist.pcs.empty() && prog.useFirstBytes) {
+                    while (pos < subject.size() && !prog.firstBytes[(unsigned char) subject[pos]])
+                        ++pos;
+                    if (pos == subject.size()) break;
+                }
+                std::fill(work.begin(), work.end(), npos);
+                addThread(clist, 0, pos);
+            }
+
+            if (clist.pcs.empty() && (best || mode != Search)) break;
+
+            nlist.clear();
+
+            for (size_t i = 0; i < clist.pcs.size(); ++i) {
+                auto & inst = prog.insts[clist.pcs[i]];
+                const size_t * slots = &clist.slots[i * nrSlots];
+
+                /* Matches starting later than one that has been found
+                   can't be leftmost. */
+                if (best && slots[0] > best->start()) continue;
+
+                if (inst.op == Inst::Match) {
+                    if (mode == Exact && pos != subject.size()) continue;
+                    if (mode == ContinuousNotNull && pos == slots[0]) continue;
+                    if (!best || slots[0] < best->start() || pos > best->end())
+                        best = RegexMatch{.offsets = {slots, slots + prog.nrCaptureSlots()}};
+                    continue;
+                }
+
+                if (pos < subject.size() && prog.charSets[inst.x][(unsigned char) subject[pos]]) {
+                    std::copy(slots, slots + nrSlots, work.begin());
+                    addThread(nlist, clist.pcs[i] + 1, pos + 1);
+                }
+            }
+
+            std::swap(clist, nlist);
+
+            if (clist.pcs.empty() && (best || mode != Search)) break;
+        }
+
+        return best;
+    }
+};
+
+}
+
+struct PosixRegex::Dfa
+{
+    struct State
+    {
+        std::vector<uint32_t> pcs;
+        bool bol;
+        /**
+         * Whether the subject matches if it ends in this state: -1 if
+         * not yet known.
+         */
+        int acceptAtEnd = -1;
+    };
+
+    std::vector<State> states;
+
+    /**
+     * The transitions of state `s` on byte class `c` are at
+     * `s * nrByteClasses + c`: -1 if not yet known.
+     */
+    std::vector<int32_t> next;
+
+    std::map<std::pair<bool, std::vector<uint32_t>>, uint32_t> index;
+
+    void clear()
+    {
+        states.clear();
+        next.clear();
+        index.clear();
+    }
+};
+
+struct PosixRegex::Fallback
+{
+    /**
+     * The pattern compiled by `std::regex`, built on first use.
+     */
+    std::shared_ptr<const std::regex> regex;
+};
+
+PosixRegex::PosixRegex(std::string_view pattern)
+{
+    auto prog = std::make_unique<Program>();
+    prog->pattern = pattern;
+
+    Parser parser{.s = pattern, .prog = *prog};
+    auto root = parser.parseAlt(0);
+    if (!parser.atEnd()) parser.fail("unmatched ')'");
+
+    Compiler compiler{.prog = *prog};
+    compiler.add({Inst::Save, 0});
+    compiler.emit(root);
+    compiler.add({Inst::Save, 1});
+    compiler.add({Inst::Match});
+
+    /* Partition the bytes into classes that all character sets treat
+       the same way. */
+    prog->byteClass.fill(0);
+    prog->nrByteClasses = 1;
+    for (auto & set : prog->charSets) {
+        std::map<std::pair<uint16_t, bool>, uint16_t> refined;
+        for (unsigned int c = 0; c < 256; ++c) {
+            auto [i, inserted] = refined.try_emplace({prog->byteClass[c], set[c]}, refined.size());
+            prog->byteClass[c] = i->second;
+        }
+        prog->nrByteClasses = refined.size();
+    }
+
+    /* If every match has to start by consuming a byte, collect the
+       bytes it can start with. */
+    SparseSet visited(prog->insts.size());
+    prog->useFirstBytes = true;
+    for (auto pc : closure(*prog, {0}, false, false, visited)) {
+        auto & inst = prog->insts[pc];
+        if (inst.op == Inst::Char)
+            prog->firstBytes |= prog->charSets[inst.x];
+        else
+            prog->useFirstBytes = false;
+    }
+    /* `closure()` drops paths that need to be at the start. */
+    for (auto & inst : prog->insts)
+        if (inst.op == Inst::Bol) prog->useFirstBytes = false;
+
+    /* Check whether the bytes that can start another iteration of
+       each repetition are disjoint from those that can follow it.
+       Following anchors over-approximates both sets, which is fine. */
+    prog->deterministicRepeats = !prog->nullableRepeat;
+    size_t work = 0;
+    auto bytesAfter = [&](uint32_t pc) {
+        CharSet bytes;
+        for (auto pc2 : closure(*prog, {pc}, true, true, visited))
+            if (prog->insts[pc2].op == Inst::Char)
+                bytes |= prog->charSets[prog->insts[pc2].x];
+        work += visited.size;
+        return bytes;
+    };
+    for (auto split : prog->repeatSplits) {
+        if (!prog->deterministicRepeats) break;
+        auto & inst = prog->insts[split];
+        if ((bytesAfter(inst.x) & bytesAfter(inst.y)).any() || work > maxDeterminismWork)
+            prog->deterministicRepeats = false;
+    }
+
+    program = std::move(prog);
+    dfa = std::make_unique<Sync<Dfa>>();
+    fallback = std::make_unique<Sync<Fallback>>();
+}
+
+PosixRegex::~PosixRegex() = default;
+
+size_t PosixRegex::groups() const
+{
+    return program->nrGroups;
+}
+
+std::optional<bool> PosixRegex::dfaMatch(std::string_view subject) const
+{
+    auto & prog = *program;
+    auto dfa(this->dfa->lock());
+    SparseSet visited(prog.insts.size());
+
+    auto getState = [&](bool bol, std::vector<uint32_t> pcs) -> std::optional<uint32_t> {
+        auto i = dfa->index.find({bol, pcs});
+        if (i != dfa->index.end()) return i->second;
+        if (dfa->states.size() >= maxDfaStates) {
+            dfa->clear();
+            return std::nullopt;
+        }
+        uint32_t n = dfa->states.size();
+        dfa->index.emplace(std::pair{bol, pcs}, n);
+        dfa->states.push_back({.pcs = std::move(pcs), .bol = bol});
+        dfa->next.resize(dfa->states.size() * prog.nrByteClasses, -1);
+        return n;
+    };
+
+    if (dfa->states.empty())
+        getState(true, closure(prog, {0}, true, false, visited));
+
+    uint32_t state = 0;
+
+    for (unsigned char c : subject) {
+        auto cls = prog.byteClass[c];
+        auto next = dfa->next[state * prog.nrByteClasses + cls];
+        if (next < 0) {
+            std::vector<uint32_t> kernel;
+            for (auto pc : dfa->states[state].pcs) {
+                auto & inst = prog.insts[pc];
+                if (inst.op == Inst::Char && prog.charSets[inst.x][c])
+                    kernel.push_back(pc + 1);
+            }
+            auto s = getState(false, closure(prog, kernel, false, false, visited));
+            if (!s) return std::nullopt;
+            next = *s;
+            dfa->next[state * prog.nrByteClasses + cls] = next;
+        }
+        state = next;
+        if (dfa->states[state].pcs.empty()) return false;
+    }
+
+    auto & st = dfa->states[state];
+    if (st.acceptAtEnd < 0) {
+        std::vector<uint32_t> kernel;
+        for (auto pc : st.pcs)
+            kernel.push_back(prog.insts[pc].op == Inst::Eol ? pc + 1 : pc);
+        st.acceptAtEnd = false;
+        for (auto pc : closure(prog, kernel, st.bol, true, visited))
+            if (prog.insts[pc].op == Inst::Match) st.acceptAtEnd = true;
+    }
+    return st.acceptAtEnd;
+}
+
+bool PosixRegex::match(std::string_view subject, RegexMatch * match) const
+{
+    auto res = dfaMatch(subject);
+    if (res && !*res) return false;
+
+    if (res && (!match || program->nrGroups == 0)) {
+        if (match) match->offsets = {0, subject.size()};
+        return true;
+    }
+
+    /* Either the groups are needed, or the DFA got too big. */
+    PikeVM vm(*program, subject);
+    auto m = vm.run(0, PikeVM::Exact);
+    if (!m) return false;
+    if (match) *match = std::move(*m);
+    return true;
+}
+
+void PosixRegex::forEachMatch(std::string_view subject, std::function<void(const RegexMatch &)> callback) const
+{
+    if (!program->deterministicRepeats && forEachMatchBacktracking(subject, callback))
+        return;
+
+    PikeVM vm(*program, subject);
+
+    auto m = vm.run(0, PikeVM::Search);
+
+    while (m) {
+        callback(*m);
+        auto start = m->start(), end = m->end();
+        if (start != end)
+            m = vm.run(end, PikeVM::Search);
+        else {
+            /* After an empty match, look for a non-empty one at the
+               same position before moving on. */
+            if (end == subject.size()) break;
+            m = vm.run(end, PikeVM::ContinuousNotNull);
+            if (!m) m = vm.run(end + 1, PikeVM::Search);
+        }
+    }
+}
+
+bool PosixRegex::forEachMatchBacktracking(std::string_view subject, std::function<void(const RegexMatch &)> callback) const
+{
+    std::shared_ptr<const std::regex> regex;
+
+    auto rethrow = [](std::regex_error & e) {
+        if (e.code() == std::regex_constants::error_space)
+            throw RegexSpaceError("regular expression is too large");
+        throw RegexError("%s", e.what());
+    };
+
+    try {
+        auto fallback(this->fallback->lock());
+        if (!fallback->regex)
+            fallback->regex = std::make_shared<const std::regex>(
+                program->pattern.data(), program->pattern.size(), std::regex::extended);
+        regex = fallback->regex;
+    } catch (std::regex_error & e) {
+        rethrow(e);
+    }
+
+    CountingIterator::Budget budget{.limit = (subject.size() + 1) * maxBacktrackingStepsPerByte};
+    CountingIterator begin{subject.data(), &budget}, end{subject.data() + subject.size(), &budget};
+    const size_t npos = std::string_view::npos;
+
+    /* Collect the matches first, so that nothing has been passed to
+       `callback` if we have to give up. */
+    std::vector<RegexMatch> matches;
+
+    try {
+        using Iterator = std::regex_iterator<CountingIterator>;
+        for (auto i = Iterator(begin, end, *regex); i != Iterator(); ++i) {
+            RegexMatch m;
+            for (auto & group : *i) {
+                m.offsets.push_back(group.matched ? group.first.p - begin.p : npos);
+                m.offsets.push_back(group.matched ? group.second.p - begin.p : npos);
+            }
+            matches.push_back(std::move(m));
+        }
+    } catch (std::regex_error & e) {
+        rethrow(e);
+    } catch (CountingIterator::BacktrackingLimit &) {
+        return false;
+    }
+
+    for (auto & m : matches)
+        callback(m);
+
+    return true;
+}
+
+}
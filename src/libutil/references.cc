@@ -6,18 +6,60 @@
 #include <cstdlib>
 #include <mutex>
 #include <algorithm>
+#include <bit>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
 
 
 namespace nix {
 
 
-static size_t refLength = 32; /* characters */
+static constexpr size_t refLength = 32; /* characters */
 
 
-static void search(
-    std::string_view s,
-    StringSet & hashes,
-    StringSet & seen)
+#if defined(__SSE2__)
+
+/**
+ * Return a mask with bit `k` set iff `p[k]` is *not* a nix32
+ * character, for `0 <= k < 16`. This must be kept in sync with
+ * `nix32Chars`, i.e. digits and lowercase letters except 'e', 'o',
+ * 'u' and 't'.
+ */
+static inline uint32_t nonBase32Mask16(const char * p)
+{
+    __m128i c = _mm_loadu_si128((const __m128i *) p);
+
+    auto inRange = [&](char lo, char hi) {
+        return _mm_and_si128(
+            _mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)),
+            _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+    };
+
+    auto eq = [&](char x) {
+        return _mm_cmpeq_epi8(c, _mm_set1_epi8(x));
+    };
+
+    __m128i ok = _mm_or_si128(inRange('0', '9'), inRange('a', 'z'));
+    __m128i excluded = _mm_or_si128(_mm_or_si128(eq('e'), eq('o')), _mm_or_si128(eq('u'), eq('t')));
+
+    return ~_mm_movemask_epi8(_mm_andnot_si128(excluded, ok)) & 0xffff;
+}
+
+/**
+ * Return a mask with bit `k` set iff `p[k]` is not a nix32 character,
+ * for `0 <= k < refLength`.
+ */
+static inline uint32_t nonBase32Mask(const char * p)
+{
+    static_assert(refLength == 32);
+    return nonBase32Mask16(p) | (nonBase32Mask16(p + 16) << 16);
+}
+
+#else
+
+static inline uint32_t nonBase32Mask(const char * p)
 {
     static std::once_flag initialised;
     static bool isBase32[256];
@@ -27,20 +69,36 @@ static void search(
             isBase32[(unsigned char) nix32Chars[i]] = true;
     });
 
+    /* Scan backwards, so that we can stop at the last non-nix32
+       character, which is all the caller needs. */
+    for (int j = refLength - 1; j >= 0; --j)
+        if (!isBase32[(unsigned char) p[j]])
+            return uint32_t(1) << j;
+    return 0;
+}
+
+#endif
+
+
+static void search(
+    std::string_view s,
+    StringSet & hashes,
+    StringSet & seen)
+{
     for (size_t i = 0; i + refLength <= s.size(); ) {
-        int j;
-        bool match = true;
-        for (j = refLength - 1; j >= 0; --j)
-            if (!isBase32[(unsigned char) s[i + j]]) {
-                i += j + 1;
-                match = false;
-                break;
-            }
-        if (!match) continue;
-        std::string ref(s.substr(i, refLength));
-        if (hashes.erase(ref)) {
+        /* If there is a non-nix32 character in the window, no
+           reference can start at or before it, so skip past the last
+           one. */
+        if (auto bad = nonBase32Mask(s.data() + i)) {
+            i += refLength - std::countl_zero(bad);
+            continue;
+        }
+        /* The set has a transparent comparator, so the lookup doesn't
+           allocate, and a hit moves the node over to `seen`. */
+        auto ref = s.substr(i, refLength);
+        if (auto j = hashes.find(ref); j != hashes.end()) {
             debug("found reference to '%1%' at offset '%2%'", ref, i);
-            seen.insert(ref);
+            seen.insert(hashes.extract(j));
         }
         ++i;
     }
@@ -0,0 +1,128 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+namespace nix {
+
+/**
+ * An evaluator on top of a dummy store, set up like the one in
+ * `LibExprTest`.
+ */
+struct EvalFixture
+{
+    bool readOnlyMode = true;
+    fetchers::Settings fetchSettings{};
+    EvalSettings evalSettings{readOnlyMode};
+    ref<Store> store;
+    std::shared_ptr<EvalState> state;
+
+    EvalFixture()
+        : store(openStore("dummy://"))
+    {
+        evalSettings.nixPath = {};
+        state = std::make_shared<EvalState>(LookupPath{}, store, fetchSettings, evalSettings, nullptr);
+    }
+};
+
+/**
+ * Parse `expr` once, then evaluate it deeply in every iteration. Each
+ * iteration evaluates a fresh thunk, so nothing is shared between
+ * iterations except the parsed expression.
+ */
+static void evalBenchmark(benchmark::State & state, const std::string & expr)
+{
+    EvalFixture fixture;
+    auto & es = *fixture.state;
+    auto e = es.parseExprFromString(expr, es.rootPath(CanonPath::root));
+
+    for (auto _ : state) {
+        Value v;
+        es.eval(e, v);
+        es.forceValueDeep(v);
+        benchmark::DoNotOptimize(v);
+    }
+}
+
+static void BM_Eval_AttrLookup(benchmark::State & state)
+{
+    evalBenchmark(state, R"(
+        let
+          attrs = builtins.listToAttrs (builtins.genList (i: { name = "a${toString i}"; value = i; }) 1000);
+        in builtins.foldl' (acc: i: acc + attrs.a500 + attrs.a1 + attrs.a999) 0 (builtins.genList (i: i) 10000)
+    )");
+}
+
+BENCHMARK(BM_Eval_AttrLookup);
+
+static void BM_Eval_Update(benchmark::State & state)
+{
+    evalBenchmark(state, R"(
+        builtins.foldl' (acc: i: acc // { "a${toString (builtins.bitAnd i 255)}" = i; }) { } (builtins.genList (i: i) 5000)
+    )");
+}
+
+BENCHMARK(BM_Eval_Update);
+
+static void BM_Eval_Sort(benchmark::State & state)
+{
+    evalBenchmark(state, R"(
+        builtins.sort builtins.lessThan (builtins.genList (i: builtins.bitXor (i * 7919) 4095) 10000)
+    )");
+}
+
+BENCHMARK(BM_Eval_Sort);
+
+static void BM_Eval_StringInterpolation(benchmark::State & state)
+{
+    evalBenchmark(state, R"(
+        map (i: "prefix-${toString i}-${toString (i * 2)}-suffix") (builtins.genList (i: i) 10000)
+    )");
+}
+
+BENCHMARK(BM_Eval_StringInterpolation);
+
+static void BM_Eval_ReplaceStrings(benchmark::State & state)
+{
+    evalBenchmark(state, R"(
+        let
+          escapeXML = builtins.replaceStrings [ "\"" "'" "<" ">" "&" ] [ "&quot;" "&apos;" "&lt;" "&gt;" "&amp;" ];
+        in map (i: escapeXML "<package name=\"pkg-${toString i}\"> & 'friends'") (builtins.genList (i: i) 10000)
+    )");
+}
+
+BENCHMARK(BM_Eval_ReplaceStrings);
+
+static void BM_Eval_FromJSON(benchmark::State & state)
+{
+    std::string json = "[";
+    for (int i = 0; i < 2000; ++i) {
+        if (i) json += ",";
+        json += fmt(R"({"name":"package-%1%","version":"1.%1%","tags":["a","b","c"],"size":%1%,"broken":false})", i);
+    }
+    json += "]";
+
+    evalBenchmark(state, "builtins.fromJSON ''" + json + "''");
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+
+BENCHMARK(BM_Eval_FromJSON);
+
+static void BM_Eval_ToJSON(benchmark::State & state)
+{
+    evalBenchmark(state, R"(
+        builtins.toJSON (builtins.genList (i: {
+          name = "package-${toString i}";
+          version = "1.${toString i}";
+          tags = [ "a" "b" "c" ];
+          size = i;
+          broken = false;
+        }) 2000)
+    )");
+}
+
+BENCHMARK(BM_Eval_ToJSON);
+
+}
@@ -0,0 +1,106 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+/**
+ * A small nixpkgs-like package set on disk: a `lib.nix` with `fix`
+ * and `callPackageWith`, and `nrPackages` files under `pkgs/` that
+ * each call `derivation` and depend on a couple of other packages.
+ * `default.nix` evaluates to the list of all `drvPath`s.
+ */
+struct SyntheticPackageSet
+{
+    AutoDelete cleanup;
+    std::filesystem::path root;
+
+    SyntheticPackageSet(size_t nrPackages)
+        : cleanup(createTempDir(), true)
+        , root(cleanup.path())
+    {
+        writeFile(root / "lib.nix", R"(
+            rec {
+              fix = f: let x = f x; in x;
+              callPackageWith = autoArgs: fn: args:
+                let f = import fn;
+                in f (builtins.intersectAttrs (builtins.functionArgs f) autoArgs // args);
+            }
+        )");
+
+        std::filesystem::create_directory(root / "pkgs");
+
+        std::string attrs;
+        for (size_t i = 0; i < nrPackages; ++i) {
+            std::string args = "mkDerivation";
+            std::string deps;
+            for (auto dep : {i / 2, i / 3}) {
+                if (dep == i || deps.find(fmt("pkg%d ", dep)) != std::string::npos)
+                    continue;
+                args += fmt(", pkg%d", dep);
+                deps += fmt("pkg%d ", dep);
+            }
+            writeFile(
+                root / "pkgs" / fmt("pkg-%d.nix", i),
+                fmt(R"(
+                    { %s }:
+                    mkDerivation {
+                      pname = "pkg%d";
+                      version = "1.0.%d";
+                      buildInputs = [ %s];
+                      meta.description = "Synthetic package number %d";
+                    }
+                )", args, i, i, deps, i));
+            attrs += fmt("  pkg%1% = callPackage ./pkgs/pkg-%1%.nix { };\n", i);
+        }
+
+        writeFile(root / "default.nix", R"(
+            let
+              lib = import ./lib.nix;
+              pkgs = lib.fix (self: let callPackage = lib.callPackageWith self; in {
+                mkDerivation = { pname, version, buildInputs ? [ ], ... }@args:
+                  derivation (removeAttrs args [ "meta" ] // {
+                    name = "${pname}-${version}";
+                    system = "x86_64-linux";
+                    builder = "/bin/sh";
+                    args = [ "-c" "echo ${pname} > $out" ];
+                  });
+            )" + attrs + R"(
+              });
+            in map (name: pkgs.${name}.drvPath) (builtins.filter (name: name != "mkDerivation") (builtins.attrNames pkgs))
+        )");
+    }
+};
+
+/**
+ * Evaluate the `drvPath` of every package in a synthetic package set,
+ * with a fresh evaluator per iteration so that parsing, file lookups
+ * and derivation instantiation are all included.
+ */
+static void BM_Macro_InstantiatePackageSet(benchmark::State & state)
+{
+    SyntheticPackageSet packages(state.range(0));
+
+    bool readOnlyMode = true;
+    fetchers::Settings fetchSettings{};
+    EvalSettings evalSettings{readOnlyMode};
+    evalSettings.nixPath = {};
+    auto store = openStore("dummy://");
+
+    for (auto _ : state) {
+        EvalState es({}, store, fetchSettings, evalSettings, nullptr);
+        Value v;
+        es.evalFile(es.rootPath(CanonPath((packages.root / "default.nix").string())), v);
+        es.forceValueDeep(v);
+        benchmark::DoNotOptimize(v);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_Macro_InstantiatePackageSet)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+}
@@ -0,0 +1,22 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/store/globals.hh"
+#include "nix/expr/eval-gc.hh"
+
+using namespace nix;
+
+int main(int argc, char ** argv)
+{
+    initLibStore(false);
+    initGC();
+
+    /* Benchmarks never build anything. */
+    settings.buildHook = {};
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,55 @@
+{
+  lib,
+  mkMesonExecutable,
+
+  nix-util,
+  nix-store,
+  nix-fetchers,
+  nix-expr,
+
+  gbenchmark,
+
+  # Configuration Options
+
+  version,
+}:
+
+let
+  inherit (lib) fileset;
+in
+
+mkMesonExecutable (finalAttrs: {
+  pname = "nix-benchmarks";
+  inherit version;
+
+  workDir = ./.;
+  fileset = fileset.unions [
+    ../../nix-meson-build-support
+    ./nix-meson-build-support
+    ../../.version
+    ./.version
+    ./meson.build
+    (fileset.fileFilter (file: file.hasExt "cc") ./.)
+    (fileset.fileFilter (file: file.hasExt "hh") ./.)
+  ];
+
+  # Hack for sake of the dev shell
+  passthru.externalBuildInputs = [
+    gbenchmark
+  ];
+
+  buildInputs = finalAttrs.passthru.externalBuildInputs ++ [
+    nix-util
+    nix-store
+    nix-fetchers
+    nix-expr
+  ];
+
+  mesonFlags = [
+  ];
+
+  meta = {
+    platforms = lib.platforms.unix;
+    mainProgram = finalAttrs.pname;
+  };
+})
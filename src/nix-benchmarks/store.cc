@@ -0,0 +1,159 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/store/derivations.hh"
+#include "nix/store/store-api.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+/**
+ * A derivation with `nrEnv` environment variables, some of which need
+ * escaping, similar in shape to typical nixpkgs derivations.
+ */
+static Derivation makeDerivation(size_t nrEnv)
+{
+    Derivation drv;
+    drv.name = "benchmark-1.0";
+    drv.platform = "x86_64-linux";
+    drv.builder = "/nix/store/w7jl0h7mwrrrcy2kgvk9c9h9142f1ca0-bash/bin/bash";
+    drv.args = {"-e", "/nix/store/v6x3cs394jgqfbi0a42pam708flxaphh-default-builder.sh"};
+    StorePath outPath(hashString(HashAlgorithm::SHA256, "out"), drv.name);
+    drv.outputs.emplace("out", DerivationOutput::InputAddressed{.path = outPath});
+    for (size_t i = 0; i < 10; ++i)
+        drv.inputSrcs.insert(StorePath(hashString(HashAlgorithm::SHA256, std::to_string(i)), fmt("src-%d", i)));
+    for (size_t i = 0; i < nrEnv; ++i)
+        drv.env.emplace(fmt("var%d", i), fmt("value %d with \"quotes\",\na newline and a \\ backslash", i));
+    drv.env.emplace("out", "/nix/store/" + std::string(outPath.to_string()));
+    return drv;
+}
+
+static ref<Store> dummyStore()
+{
+    static auto store = openStore("dummy://");
+    return store;
+}
+
+static void BM_ParseDerivation(benchmark::State & state)
+{
+    auto store = dummyStore();
+    auto text = makeDerivation(state.range(0)).unparse(*store, false);
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(parseDerivation(*store, std::string(text), "benchmark-1.0"));
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+
+BENCHMARK(BM_ParseDerivation)->Arg(10)->Arg(200);
+
+static void BM_UnparseDerivation(benchmark::State & state)
+{
+    auto store = dummyStore();
+    auto drv = makeDerivation(state.range(0));
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(drv.unparse(*store, false));
+}
+
+BENCHMARK(BM_UnparseDerivation)->Arg(10)->Arg(200);
+
+static void BM_HashDerivationModulo(benchmark::State & state)
+{
+    auto store = dummyStore();
+    auto drv = makeDerivation(state.range(0));
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(hashDerivationModulo(*store, drv, true));
+}
+
+BENCHMARK(BM_HashDerivationModulo)->Arg(10)->Arg(200);
+
+/**
+ * A local store in a temporary directory containing a chain of
+ * `nrPaths` text paths, each referring to its two predecessors.
+ */
+struct SyntheticStore
+{
+    AutoDelete cleanup;
+    ref<Store> store;
+    std::vector<StorePath> paths;
+
+    SyntheticStore(size_t nrPaths)
+        : cleanup(createTempDir(), true)
+        , store(openStore("local?root=" + cleanup.path().string()))
+    {
+        for (size_t i = 0; i < nrPaths; ++i) {
+            StorePathSet references;
+            if (i > 0) references.insert(paths[i - 1]);
+            if (i > 1) references.insert(paths[i / 2]);
+            auto contents = fmt("contents of path %d", i);
+            StringSource source(contents);
+            paths.push_back(store->addToStoreFromDump(
+                source,
+                fmt("path-%d", i),
+                FileSerialisationMethod::Flat,
+                ContentAddressMethod::Raw::Text,
+                HashAlgorithm::SHA256,
+                references));
+        }
+    }
+};
+
+static SyntheticStore & syntheticStore()
+{
+    static SyntheticStore store(1000);
+    return store;
+}
+
+static void BM_LocalStore_queryPathInfo(benchmark::State & state)
+{
+    auto & s = syntheticStore();
+    size_t i = 0;
+    for (auto _ : state) {
+        /* Bypass the in-memory cache to measure the database. */
+        s.store->clearPathInfoCache();
+        benchmark::DoNotOptimize(s.store->queryPathInfo(s.paths[i++ % s.paths.size()]));
+    }
+}
+
+BENCHMARK(BM_LocalStore_queryPathInfo);
+
+static void BM_LocalStore_isValidPath(benchmark::State & state)
+{
+    auto & s = syntheticStore();
+    size_t i = 0;
+    for (auto _ : state) {
+        s.store->clearPathInfoCache();
+        benchmark::DoNotOptimize(s.store->isValidPath(s.paths[i++ % s.paths.size()]));
+    }
+}
+
+BENCHMARK(BM_LocalStore_isValidPath);
+
+static void BM_LocalStore_queryReferrers(benchmark::State & state)
+{
+    auto & s = syntheticStore();
+    size_t i = 0;
+    for (auto _ : state) {
+        StorePathSet referrers;
+        s.store->queryReferrers(s.paths[i++ % s.paths.size()], referrers);
+        benchmark::DoNotOptimize(referrers);
+    }
+}
+
+BENCHMARK(BM_LocalStore_queryReferrers);
+
+static void BM_LocalStore_computeFSClosure(benchmark::State & state)
+{
+    auto & s = syntheticStore();
+    for (auto _ : state) {
+        s.store->clearPathInfoCache();
+        StorePathSet closure;
+        s.store->computeFSClosure(s.paths.back(), closure);
+        benchmark::DoNotOptimize(closure);
+    }
+}
+
+BENCHMARK(BM_LocalStore_computeFSClosure);
+
+}
@@ -0,0 +1,127 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/util/archive.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/fs-sink.hh"
+#include "nix/util/hash.hh"
+#include "nix/util/references.hh"
+
+#include <random>
+
+namespace nix {
+
+/**
+ * Deterministic pseudo-random printable data.
+ */
+static std::string makeData(size_t size, unsigned int seed = 0)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> dist(' ', '~');
+    std::string s;
+    s.reserve(size);
+    while (s.size() < size)
+        s.push_back((char) dist(gen));
+    return s;
+}
+
+static void BM_HashSink(benchmark::State & state, HashAlgorithm algo)
+{
+    auto data = makeData(state.range(0));
+    for (auto _ : state) {
+        HashSink sink(algo);
+        sink(data);
+        benchmark::DoNotOptimize(sink.finish());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+BENCHMARK_CAPTURE(BM_HashSink, md5, HashAlgorithm::MD5)->Arg(1 << 20);
+BENCHMARK_CAPTURE(BM_HashSink, sha1, HashAlgorithm::SHA1)->Arg(1 << 20);
+BENCHMARK_CAPTURE(BM_HashSink, sha256, HashAlgorithm::SHA256)->Arg(1 << 20);
+BENCHMARK_CAPTURE(BM_HashSink, sha512, HashAlgorithm::SHA512)->Arg(1 << 20);
+BENCHMARK_CAPTURE(BM_HashSink, blake3, HashAlgorithm::BLAKE3)->Arg(1 << 20);
+
+/* Scan data for a number of hash parts, like scanForReferences does
+   for the output of a build. */
+static void BM_RefScanSink(benchmark::State & state)
+{
+    StringSet hashes;
+    for (int i = 0; i < state.range(1); ++i)
+        hashes.insert(std::string(hashString(HashAlgorithm::SHA256, std::to_string(i)).to_string(HashFormat::Nix32, false), 0, 32));
+
+    auto data = makeData(state.range(0));
+    /* Embed some of the hashes. */
+    size_t pos = 0;
+    for (auto & hash : hashes) {
+        pos += data.size() / (hashes.size() + 1);
+        data.replace(pos, hash.size(), hash);
+        if (pos > data.size() / 2) break;
+    }
+
+    for (auto _ : state) {
+        RefScanSink sink{StringSet(hashes)};
+        sink(data);
+        benchmark::DoNotOptimize(sink.getResult());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+BENCHMARK(BM_RefScanSink)->Args({1 << 20, 10})->Args({1 << 20, 1000});
+
+/**
+ * A directory tree with `nrDirs` directories of `nrFiles` files each.
+ */
+struct SyntheticTree
+{
+    Path dir;
+    AutoDelete cleanup;
+
+    SyntheticTree(size_t nrDirs, size_t nrFiles)
+        : dir(createTempDir())
+        , cleanup(dir, true)
+    {
+        for (size_t i = 0; i < nrDirs; ++i) {
+            auto subdir = fmt("%s/dir-%d", dir, i);
+            createDirs(subdir);
+            for (size_t j = 0; j < nrFiles; ++j)
+                writeFile(fmt("%s/file-%d", subdir, j), makeData(1024 * (1 + (i + j) % 16), i * nrFiles + j));
+        }
+    }
+};
+
+static SyntheticTree & syntheticTree()
+{
+    static SyntheticTree tree(100, 20);
+    return tree;
+}
+
+static void BM_DumpPath(benchmark::State & state)
+{
+    auto & tree = syntheticTree();
+    uint64_t narSize = 0;
+    for (auto _ : state) {
+        LengthSink sink;
+        dumpPath(tree.dir, sink);
+        narSize = sink.length;
+    }
+    state.SetBytesProcessed(state.iterations() * narSize);
+}
+
+BENCHMARK(BM_DumpPath);
+
+static void BM_ParseDump(benchmark::State & state)
+{
+    StringSink nar;
+    dumpPath(syntheticTree().dir, nar);
+
+    for (auto _ : state) {
+        StringSource source(nar.s);
+        NullFileSystemObjectSink sink;
+        parseDump(sink, source);
+    }
+    state.SetBytesProcessed(state.iterations() * nar.s.size());
+}
+
+BENCHMARK(BM_ParseDump);
+
+}
@@ -5,6 +5,7 @@
 #include "nix/expr/eval.hh"
 #include "nix/expr/eval-inline.hh"
 #include "nix/expr/value-to-json.hh"
+#include "nix/util/json-writer.hh"
 
 #include <nlohmann/json.hpp>
 
@@ -118,7 +119,16 @@ struct CmdEval : MixJSON, InstallableValueCommand, MixReadOnlyOption
         }
 
         else if (json) {
-            printJSON(printValueAsJSON(*state, true, *v, pos, context, false));
+            /* Stream the document to stdout as it is evaluated. If
+               evaluation fails, the output is truncated JSON, but the
+               command fails as well. */
+            logger->stop();
+            FdSink sink(getStandardOutput());
+            JSONWriter out(sink, outputPretty ? 2 : -1);
+            printValueAsJSON(*state, true, *v, pos, out, context, false);
+            out.flush();
+            sink("\n");
+            sink.flush();
         }
 
         else {
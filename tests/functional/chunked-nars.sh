@@ -0,0 +1,77 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+clearStore
+clearCache
+
+cacheURI="file://$cacheDir?compression=zstd&chunked-nars=true"
+chunkCache="$TEST_ROOT/chunk-cache"
+rm -rf "$chunkCache"
+
+outPath=$(nix-build dependencies.nix --no-out-link)
+
+nix copy --to "$cacheURI" "$outPath"
+
+HASH=$(nix hash path "$outPath")
+
+# NARs are stored as chunk lists referring to compressed chunks.
+grep -q "Compression: chunked" "$cacheDir"/*.narinfo
+ls "$cacheDir/nar/"*.chunks > /dev/null
+ls "$cacheDir/chunks/"*.zst > /dev/null
+
+clearStore
+clearCacheCache
+
+nix copy --from "file://$cacheDir?local-chunk-cache=$chunkCache" "$outPath" --no-check-sigs
+
+[[ "$HASH" = "$(nix hash path "$outPath")" ]]
+
+# The chunks are now in the local chunk cache, so they don't have to
+# be fetched again.
+[[ $(find "$chunkCache" -type f | wc -l) -ge 1 ]]
+
+clearStore
+clearCacheCache
+rm -rf "$cacheDir/chunks"
+
+nix copy --from "file://$cacheDir?local-chunk-cache=$chunkCache" "$outPath" --no-check-sigs
+
+[[ "$HASH" = "$(nix hash path "$outPath")" ]]
+
+# The local chunk cache is bounded by local-chunk-cache-size.
+clearCache
+nix copy --to "$cacheURI" "$outPath"
+
+clearStore
+clearCacheCache
+rm -rf "$chunkCache"
+
+nix copy --from "file://$cacheDir?local-chunk-cache=$chunkCache&local-chunk-cache-size=0" "$outPath" --no-check-sigs
+
+[[ "$HASH" = "$(nix hash path "$outPath")" ]]
+[[ $(find "$chunkCache" -type f | wc -l) -eq 0 ]]
+
+# Paths with mostly the same contents share most of their chunks, so
+# uploading the second one adds fewer chunk files than it has chunks.
+clearStore
+clearCache
+
+seq 1 1000000 > "$TEST_ROOT/big1"
+{ cat "$TEST_ROOT/big1"; echo extra; } > "$TEST_ROOT/big2"
+path1=$(nix-store --add "$TEST_ROOT/big1")
+path2=$(nix-store --add "$TEST_ROOT/big2")
+
+nix copy --to "$cacheURI" "$path1"
+chunksBefore=$(find "$cacheDir/chunks" -type f | wc -l)
+
+nix copy --to "$cacheURI" "$path2"
+chunksAfter=$(find "$cacheDir/chunks" -type f | wc -l)
+
+chunkList=$(grep '^URL: ' "$cacheDir/$(basename "$path2" | cut -c1-32).narinfo" | cut -d' ' -f2)
+nrChunks=$(grep -c '^Chunk: ' "$cacheDir/$chunkList")
+
+(( nrChunks > 1 ))
+(( chunksAfter - chunksBefore < nrChunks ))
@@ -0,0 +1,29 @@
+with import ./config.nix;
+
+let
+
+  mk = name: deps: mkDerivation {
+    inherit name;
+    buildCommand = ''
+      ${toString (map (dep: "test -e ${dep}\n") deps)}
+      echo ${name} >> ${shared}.order
+      sleep 1
+      mkdir $out
+    '';
+  };
+
+  # Everything else waits for this, so that all goals are set up
+  # before the others compete for the build slot.
+  gate = mk "gate" [];
+
+  quick = mk "a-quick" [ gate ];
+
+  slow = mk "b-slow" [ gate ];
+
+  top = mk "c-top" [ slow ];
+
+in
+
+{
+  inherit quick top;
+}
@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+# With one build slot, `a-quick` and `b-slow` become buildable at the
+# same time. By default they are started in order of their names.
+clearStore
+rm -f "$_NIX_TEST_SHARED.order"
+nix-build -j1 critical-path-scheduling.nix --no-out-link
+[[ $(sed -n 2p "$_NIX_TEST_SHARED.order") = a-quick ]]
+
+# With `critical-path-scheduling`, `b-slow` goes first, because
+# `c-top` is waiting on it.
+clearStore
+rm -f "$_NIX_TEST_SHARED.order"
+nix-build -j1 critical-path-scheduling.nix --no-out-link --option critical-path-scheduling true
+[[ $(sed -n 2p "$_NIX_TEST_SHARED.order") = b-slow ]]
+
+# The build times have been recorded.
+[[ -e $TEST_HOME/.cache/nix/build-times-v1.sqlite ]]
@@ -8,6 +8,14 @@ drvPath=$(nix-instantiate dependencies.nix)
 
 echo "derivation is $drvPath"
 
+# Adding the derivation again hashes its input derivations, which are
+# then kept in the derivation hash cache.
+nix derivation show "$drvPath" | jq '.[]' > "$TEST_ROOT"/dependencies.json
+[[ "$(nix derivation add < "$TEST_ROOT"/dependencies.json)" = "$drvPath" ]]
+[[ -e "$TEST_HOME"/.cache/nix/drv-hashes-v2.sqlite ]]
+[[ "$(nix derivation add < "$TEST_ROOT"/dependencies.json)" = "$drvPath" ]]
+[[ "$(nix derivation add --option drv-hash-cache false < "$TEST_ROOT"/dependencies.json)" = "$drvPath" ]]
+
 nix-store -q --tree "$drvPath" | grep '───.*builder-dependencies-input-1.sh'
 
 # Test Graphviz graph generation.
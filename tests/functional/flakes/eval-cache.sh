@@ -48,3 +48,16 @@ nix build --no-link "$flake1Dir#stack-depth"
 expect 1 nix build "$flake1Dir#ifd" --option allow-import-from-derivation false 2>&1 \
   | grepQuiet 'error: cannot build .* during evaluation because the option '\''allow-import-from-derivation'\'' is disabled'
 nix build --no-link "$flake1Dir#ifd"
+
+# The evaluation cache is frozen into a memory-mapped snapshot, which
+# is used (and kept up to date) by later evaluations.
+[[ -n $(find "$TEST_HOME/.cache/nix/eval-cache-v5" -name '*.attrs') ]]
+expect 1 nix build "$flake1Dir#foo.bar" 2>&1 | grepQuiet 'error: breaks'
+[[ $(nix eval --raw "$flake1Dir#drv.name") == build ]]
+[[ $(nix eval --raw "$flake1Dir#drv.name") == build ]]
+
+# A corrupt snapshot is ignored.
+for f in "$TEST_HOME/.cache/nix/eval-cache-v5"/*.attrs; do
+    echo garbage > "$f"
+done
+[[ $(nix eval --raw "$flake1Dir#drv.name") == build ]]
@@ -99,3 +99,12 @@ expect_trace 'builtins.derivationStrict { name = "somepackage"; }' "
 expect_trace 'builtins.derivationStrict { }' "
 «string»:1:1:primop derivationStrict 1
 "
+
+# pprof output is a gzipped protobuf containing the function names
+nix-instantiate \
+    --eval-profiler pprof \
+    --eval-profiler-frequency 0 \
+    --eval-profile-file "$TEST_ROOT/nix.pprof" \
+    --expr 'let someFunction = arg: arg; in someFunction 1'
+gzip -dc "$TEST_ROOT/nix.pprof" | grep -aq someFunction
+gzip -dc "$TEST_ROOT/nix.pprof" | grep -aq alloc_objects
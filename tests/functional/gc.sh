@@ -44,9 +44,33 @@ cat "$outPath/reference-to-input-2/bar"
 # Check that the derivation has been GC'd.
 if test -e "$drvPath"; then false; fi
 
+# Check that --max-freed stops the GC near the limit.
+garbage=()
+for i in $(seq 1 20); do
+    head -c 100000 /dev/zero > "$TEST_ROOT/garbage-$i"
+    echo "$i" >> "$TEST_ROOT/garbage-$i"
+    garbage+=("$(nix-store --add "$TEST_ROOT/garbage-$i")")
+done
+
+countGarbage() {
+    local n=0
+    for p in "${garbage[@]}"; do
+        if [[ -e $p ]]; then n=$((n + 1)); fi
+    done
+    echo "$n"
+}
+
+nix-store --gc --max-freed 1
+(( $(countGarbage) >= 19 ))
+
+nix-store --gc --max-freed 150000 --option gc-threads 4
+remaining=$(countGarbage)
+(( remaining >= 8 && remaining <= 17 ))
+
 rm "$NIX_STATE_DIR/gcroots/foo"
 
-nix-collect-garbage
+# Delete the remaining paths in parallel.
+nix-collect-garbage --option gc-threads 4
 
 # Check that the output has been GC'd.
 if test -e "$outPath/foobar"; then false; fi
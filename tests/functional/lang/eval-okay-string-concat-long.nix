@@ -0,0 +1,40 @@
+let
+  drv = derivation {
+    name = "fail";
+    builder = "/bin/false";
+    system = "x86_64-linux";
+    outputs = [
+      "out"
+      "foo"
+    ];
+  };
+
+  lines = builtins.genList (n: "line ${toString n} of a long generated file\n") 1000;
+  expected = builtins.concatStringsSep "" lines;
+
+  # Building a long string by repeated concatenation.
+  viaPlus = builtins.foldl' (acc: line: acc + line) "" lines;
+  viaInterpolation = builtins.foldl' (acc: line: "${acc}${line}") "" lines;
+
+  # A long string that is extended in two different ways.
+  shared = viaPlus + "shared\n";
+  left = shared + "left";
+  right = "${shared}right";
+
+  # Contexts of all the parts are kept.
+  withContext = builtins.foldl' (acc: s: acc + s) "" (
+    lines ++ [ drv.outPath ] ++ lines ++ [ drv.foo.outPath drv.outPath ]
+  );
+in
+[
+  (viaPlus == expected)
+  (viaInterpolation == expected)
+  (builtins.stringLength viaPlus == builtins.stringLength expected)
+  (builtins.substring 0 25 viaPlus == "line 0 of a long generate")
+  (left == expected + "shared\nleft")
+  (right == expected + "shared\nright")
+  (builtins.hashString "sha256" left == builtins.hashString "sha256" (expected + "shared\nleft"))
+  (!builtins.hasContext viaPlus)
+  (builtins.getContext withContext == builtins.getContext "${drv.outPath}${drv.foo.outPath}")
+  (builtins.unsafeDiscardStringContext withContext == expected + drv.outPath + expected + drv.foo.outPath + drv.outPath)
+]
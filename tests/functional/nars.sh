@@ -159,3 +159,26 @@ expectStderr 1 nix-store --restore "$TEST_ROOT/out" < executable-after-contents.
 # Test that the 'name' field cannot come before the 'node' field in a directory entry.
 rm -rf "$TEST_ROOT/out"
 expectStderr 1 nix-store --restore "$TEST_ROOT/out" < name-after-node.nar | grepQuiet "expected tag 'name'"
+
+# Test restoring large files directly from a NAR file, and writing
+# small files in parallel.
+rm -rf "$TEST_ROOT/in" "$TEST_ROOT/out"
+mkdir -p "$TEST_ROOT/in/dir"
+head -c 300000 /dev/urandom > "$TEST_ROOT/in/large"
+for i in $(seq 1 100); do echo "$i" > "$TEST_ROOT/in/dir/$i"; done
+echo foo > "$TEST_ROOT/in/exec"
+chmod +x "$TEST_ROOT/in/exec"
+nix-store --dump "$TEST_ROOT/in" > "$TEST_ROOT/tmp.nar"
+
+nix-store --restore "$TEST_ROOT/out" < "$TEST_ROOT/tmp.nar"
+diff -r "$TEST_ROOT/in" "$TEST_ROOT/out"
+rm -rf "$TEST_ROOT/out"
+
+# shellcheck disable=SC2002
+cat "$TEST_ROOT/tmp.nar" | nix-store --option restore-threads 4 --restore "$TEST_ROOT/out"
+diff -r "$TEST_ROOT/in" "$TEST_ROOT/out"
+[[ -x "$TEST_ROOT/out/exec" ]]
+rm -rf "$TEST_ROOT/out"
+
+nix-store --option restore-threads 4 --restore "$TEST_ROOT/out" < "$TEST_ROOT/tmp.nar"
+diff -r "$TEST_ROOT/in" "$TEST_ROOT/out"
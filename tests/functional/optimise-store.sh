@@ -41,6 +41,18 @@ if [ "$inode1" != "$inode3" ]; then
     exit 1
 fi
 
+# A second run skips the paths optimised by the first one, but still
+# handles new paths.
+outPath4=$(echo 'with import '"${config_nix}"'; mkDerivation { name = "foo4"; builder = builtins.toFile "builder" "mkdir $out; echo hello > $out/foo"; }' | nix-build - --no-out-link)
+
+NIX_REMOTE="" nix-store --optimise -vvvv 2>&1 | grepQuiet "^[1-9][0-9]* paths have already been optimised"
+
+inode4="$(stat --format=%i $outPath4/foo)"
+if [ "$inode1" != "$inode4" ]; then
+    echo "inodes do not match"
+    exit 1
+fi
+
 nix-store --gc
 
 if [ -n "$(ls $NIX_STORE_DIR/.links)" ]; then
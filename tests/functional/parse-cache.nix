@@ -0,0 +1,32 @@
+let
+  inherit (builtins) map length;
+  x = 3;
+  attrs = rec {
+    a = 1;
+    b = a + x;
+    ${"dyn" + "amic"} = [ a b ];
+    inherit (attrs) a2;
+    a2 = 2.5;
+  };
+  /** Adds two numbers. */
+  add = { a, b ? 2, ... }@args: a + b;
+  s = "interpolated ${toString attrs.b} string";
+  indented = ''
+    line ${s}
+      more
+  '';
+in
+with attrs;
+assert a == 1 -> true;
+{
+  inherit a b dynamic indented;
+  sum = add { a = 40; };
+  updated = { p = 1; } // { q = !false; };
+  lists = [ 1 ] ++ map (y: y * 2) [ 1 2 3 ];
+  cmp = a < b && (b > a || false) && a != b;
+  has = attrs ? a2 && !(attrs ? nope.deeper);
+  sel = attrs.nope or "default";
+  path = ./parse-cache.nix == ./. + "/parse-cache.nix";
+  pos = (__curPos).line;
+  count = length [ s ];
+}
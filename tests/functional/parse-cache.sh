@@ -0,0 +1,54 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+cacheDir="$TEST_HOME/.cache/nix/parse-cache-v2"
+rm -rf "$cacheDir"
+
+expected=$(nix-instantiate --eval --strict parse-cache.nix)
+
+# Without the setting, nothing is cached.
+[[ ! -e "$cacheDir" ]]
+
+# The first run populates the cache, the second one reads from it.
+[[ $(nix-instantiate --eval --strict --option parse-cache true parse-cache.nix) == "$expected" ]]
+[[ $(find "$cacheDir" -name '*.ast' | wc -l) -ge 1 ]]
+[[ $(nix-instantiate --eval --strict --option parse-cache true parse-cache.nix) == "$expected" ]]
+
+# Positions survive the round trip.
+[[ $(nix eval --option parse-cache true --expr '(builtins.unsafeGetAttrPos "sum" (import ./parse-cache.nix)).line') == 23 ]]
+
+# A corrupt or truncated cache entry is ignored.
+for f in "$cacheDir"/*.ast; do
+    echo garbage > "$f"
+done
+[[ $(nix-instantiate --eval --strict --option parse-cache true parse-cache.nix) == "$expected" ]]
+for f in "$cacheDir"/*.ast; do
+    truncate --size=-1 "$f"
+done
+[[ $(nix-instantiate --eval --strict --option parse-cache true parse-cache.nix) == "$expected" ]]
+
+# Changing the file invalidates the entry.
+cp parse-cache.nix "$TEST_ROOT/parse-cache.nix"
+[[ $(nix-instantiate --eval --strict --option parse-cache true "$TEST_ROOT/parse-cache.nix" -A a) == 1 ]]
+sed -i 's/a = 1;/a = 5;/' "$TEST_ROOT/parse-cache.nix"
+[[ $(nix-instantiate --eval --strict --option parse-cache true "$TEST_ROOT/parse-cache.nix" -A a) == 5 ]]
+
+# Entries that haven't been used for a long time are pruned.
+rm -rf "$cacheDir"
+nix-instantiate --eval --strict --option parse-cache true parse-cache.nix
+oldEntries=("$cacheDir"/*.ast)
+touch --date=@0 "${oldEntries[@]}"
+rm "$cacheDir/.last-prune"
+echo 1 > "$TEST_ROOT/one.nix"
+nix-instantiate --eval --strict --option parse-cache true "$TEST_ROOT/one.nix"
+for f in "${oldEntries[@]}"; do
+    [[ ! -e "$f" ]]
+done
+[[ $(find "$cacheDir" -name '*.ast' | wc -l) -ge 1 ]]
+
+# The cache is pruned to its maximum size.
+rm "$cacheDir/.last-prune"
+echo 2 > "$TEST_ROOT/two.nix"
+nix-instantiate --eval --strict --option parse-cache true --option parse-cache-max-size 1 "$TEST_ROOT/two.nix"
+[[ $(find "$cacheDir" -name '*.ast' | wc -l) -eq 0 ]]
@@ -35,4 +35,11 @@ nix-store --dump-db > $TEST_ROOT/d1
 NIX_REMOTE= nix-store --dump-db > $TEST_ROOT/d2
 cmp $TEST_ROOT/d1 $TEST_ROOT/d2
 
+# Closures computed through the daemon (which may query the path infos
+# of a whole level of the closure at once) match the local ones.
+outPath=$(nix-build dependencies.nix --no-out-link)
+diff <(nix-store -qR "$outPath" | sort) <(NIX_REMOTE= nix-store -qR "$outPath" | sort)
+diff <(nix-store -qR --include-outputs "$(nix-instantiate dependencies.nix)" | sort) \
+    <(NIX_REMOTE= nix-store -qR --include-outputs "$(nix-instantiate dependencies.nix)" | sort)
+
 killDaemon